@@ -32,9 +32,13 @@
 #include <sqlite3.h>
 #include "gs_data.h"        // uint_hash, uint_compare
 
-static la_hash *ac_data_cache = NULL;
-static time_t last_gc_time = 0L;
-static size_t ac_cache_entry_count = 0;
+#define BS_DB_COLUMNS "Registration,ICAOTypeCode,OperatorFlagCode,Manufacturer,Type,RegisteredOwners"
+
+// Frames are decoded by several AVLC decoder threads, so each of them
+// keeps its own cache and prepared statement on the shared connection.
+static __thread la_hash *ac_data_cache = NULL;
+static __thread time_t last_gc_time = 0L;
+static long ac_cache_entry_count = 0;
 
 typedef struct {
 	time_t ctime;
@@ -45,16 +49,15 @@ typedef struct {
 #define AC_CACHE_GC_INTERVAL 305L
 
 #define AC_CACHE_ENTRY_COUNT_ADD(x) do { \
-	if((x) < 0 && ac_cache_entry_count < (unsigned long)(-(x))) { \
-		ac_cache_entry_count = 0; \
-	} else { \
-		ac_cache_entry_count += (x); \
-	} \
-	statsd_set("ac_data.cache.entries", ac_cache_entry_count); \
+	long _cnt = __atomic_add_fetch(&ac_cache_entry_count, (x), __ATOMIC_RELAXED); \
+	statsd_set("ac_data.cache.entries", _cnt > 0 ? _cnt : 0); \
 } while(0)
 
+#define AC_DATA_QUERY "SELECT " BS_DB_COLUMNS " FROM Aircraft WHERE ModeS = ?"
+
 static sqlite3 *db = NULL;
-static sqlite3_stmt *stmt = NULL;
+static __thread sqlite3_stmt *stmt = NULL;
+static __thread bool thread_init_failed = false;    // don't retry on every lookup
 
 static void ac_data_entry_destroy(void *data) {
 	if(data == NULL) {
@@ -89,8 +92,6 @@ static void ac_data_cache_entry_create(uint32_t addr, ac_data_entry *ac_entry) {
 	AC_CACHE_ENTRY_COUNT_ADD(1);
 }
 
-#define BS_DB_COLUMNS "Registration,ICAOTypeCode,OperatorFlagCode,Manufacturer,Type,RegisteredOwners"
-
 static int ac_data_entry_from_db(uint32_t addr, ac_data_entry **result) {
 	if(db == NULL || stmt == NULL) {
 		return -1;
@@ -159,8 +160,37 @@ bool is_cache_entry_expired(void const *key, void const *value, void *ctx) {
 	return (cache_entry->ctime + AC_CACHE_TTL <= now);
 }
 
+// Sets up the lookup state of the calling thread
+static int ac_data_thread_init() {
+	int rc = sqlite3_prepare_v2(db, AC_DATA_QUERY, -1, &stmt, NULL);
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "could not query Aircraft table: %s\n", sqlite3_errmsg(db));
+		thread_init_failed = true;
+		return -1;
+	}
+	ac_data_cache = la_hash_new(uint_hash, uint_compare, la_simple_free, ac_data_cache_entry_destroy);
+	last_gc_time = time(NULL);
+	return 0;
+}
+
+// Frees the lookup state of the calling thread.
+// Must be called by each thread doing lookups before it exits.
+void ac_data_thread_destroy() {
+	if(ac_data_cache != NULL) {
+		la_hash_destroy(ac_data_cache);
+		ac_data_cache = NULL;
+	}
+	if(stmt != NULL) {
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+	}
+}
+
 ac_data_entry *ac_data_entry_lookup(uint32_t addr) {
-	if(ac_data_cache == NULL) {
+	if(db == NULL) {
+		return NULL;
+	}
+	if(ac_data_cache == NULL && (thread_init_failed || ac_data_thread_init() < 0)) {
 		return NULL;
 	}
 
@@ -213,38 +243,59 @@ int ac_data_init(char const *bs_db_file) {
 		return -1;
 	}
 	db = NULL;
+	sqlite3_stmt *test_stmt = NULL;
 
-	int rc = sqlite3_open_v2(bs_db_file, &db, SQLITE_OPEN_READONLY, NULL);
+	int rc = sqlite3_open_v2(bs_db_file, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX, NULL);
 	if(rc != 0){
 		fprintf(stderr, "Can't open database %s: %s\n", bs_db_file, sqlite3_errmsg(db));
 		goto fail;
 	}
-	rc = sqlite3_prepare_v2(db, "SELECT " BS_DB_COLUMNS " FROM Aircraft WHERE ModeS = ?", -1, &stmt, NULL);
+	// Lookup threads prepare their own statements. Just check if the query works.
+	rc = sqlite3_prepare_v2(db, AC_DATA_QUERY, -1, &test_stmt, NULL);
 	if(rc != SQLITE_OK) {
-		fprintf(stderr, "%s: could not query Aircraft table: %s\n", bs_db_file, sqlite3_errmsg(db));
+		fprintf(stderr, "could not query Aircraft table: %s\n", sqlite3_errmsg(db));
+		fprintf(stderr, "%s: database is unusable.\n", bs_db_file);
 		goto fail;
 	}
-	ac_data_cache = la_hash_new(uint_hash, uint_compare, la_simple_free, ac_data_cache_entry_destroy);
-	last_gc_time = time(NULL);
-#ifdef WITH_STATSD
-	statsd_initialize_counter_set(ac_data_counters);
-#endif
-	if(ac_data_entry_from_db(0, NULL) != SQLITE_OK) {
+	if(sqlite3_column_count(test_stmt) < 6) {
+		fprintf(stderr, "%s: not enough columns in the query result, database is unusable.\n", bs_db_file);
+		goto fail;
+	}
+	rc = sqlite3_bind_text(test_stmt, 1, "000000", -1, SQLITE_STATIC);
+	if(rc == SQLITE_OK) {
+		rc = sqlite3_step(test_stmt);
+	}
+	if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
 		fprintf(stderr, "%s: test query failed, database is unusable.\n", bs_db_file);
 		goto fail;
 	}
+	sqlite3_finalize(test_stmt);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(ac_data_counters);
+#endif
 	fprintf(stderr, "%s: database opened\n", bs_db_file);
 	return 0;
 fail:
-	la_hash_destroy(ac_data_cache);
+	sqlite3_finalize(test_stmt);
 	sqlite3_close(db);
+	db = NULL;
 	return -1;
 }
 
+// Must be called after all threads doing lookups have finished
 void ac_data_destroy() {
-	la_hash_destroy(ac_data_cache);
-	sqlite3_finalize(stmt);
+	if(db == NULL) {
+		return;
+	}
+	ac_data_thread_destroy();
+	// Finalize statements of threads which haven't called
+	// ac_data_thread_destroy(), otherwise the connection would never be freed
+	sqlite3_stmt *s = NULL;
+	while((s = sqlite3_next_stmt(db, NULL)) != NULL) {
+		sqlite3_finalize(s);
+	}
 	sqlite3_close(db);
+	db = NULL;
 }
 
 #else // !WITH_SQLITE
@@ -261,4 +312,6 @@ ac_data_entry *ac_data_entry_lookup(uint32_t addr) {
 
 void ac_data_destroy() { }
 
+void ac_data_thread_destroy() { }
+
 #endif // WITH_SQLITE
@@ -31,4 +31,5 @@ typedef struct {
 // ac_file.c
 int ac_data_init(char const *bs_db_file);
 void ac_data_destroy();
+void ac_data_thread_destroy();
 ac_data_entry *ac_data_entry_lookup(uint32_t addr);
@@ -37,7 +37,6 @@
 #include "x25.h"
 
 #define MIN_AVLC_LEN    11
-#define GOOD_FCS        0xF0B8u
 
 #ifdef IS_BIG_ENDIAN
 #define BSHIFT 0
@@ -156,9 +155,30 @@ static char const *U_cmd[] = {
 // Forward declaration
 la_type_descriptor const proto_DEF_avlc_frame;
 
+static uint32_t dlc_addr_value(uint8_t const *buf) {
+	return reverse((buf[0] >> 1) | (buf[1] << 6) | (buf[2] << 13) | ((buf[3] & 0xfe) << 20), 28) & ONES(28);
+}
+
 uint32_t parse_dlc_addr(uint8_t *buf) {
 	debug_print(D_PROTO_DETAIL, "%02x %02x %02x %02x\n", buf[0], buf[1], buf[2], buf[3]);
-	return reverse((buf[0] >> 1) | (buf[1] << 6) | (buf[2] << 13) | ((buf[3] & 0xfe) << 20), 28) & ONES(28);
+	return dlc_addr_value(buf);
+}
+
+// Returns a value identifying the conversation the frame belongs to.
+// This is the aircraft address or, if there is no aircraft involved,
+// a value derived from both addresses, regardless of their order.
+uint32_t avlc_conversation_key(uint8_t const *buf, uint32_t len) {
+	if(len < 8) {
+		return 0;
+	}
+	avlc_addr_t const dst = { .val = dlc_addr_value(buf) };
+	avlc_addr_t const src = { .val = dlc_addr_value(buf + 4) };
+	if(IS_AIRCRAFT(src)) {
+		return src.a_addr.addr;
+	} else if(IS_AIRCRAFT(dst)) {
+		return dst.a_addr.addr;
+	}
+	return src.a_addr.addr ^ dst.a_addr.addr;
 }
 
 la_proto_node *avlc_parse(avlc_frame_qentry_t *q, uint32_t *msg_type, reasm_contexts *reasm_ctx) {
@@ -173,8 +193,8 @@ la_proto_node *avlc_parse(avlc_frame_qentry_t *q, uint32_t *msg_type, reasm_cont
 	debug_print(D_PROTO, "Frame %d: len=%u\n", q->metadata->idx, len);
 	debug_print_buf_hex(D_PROTO_DETAIL, buf, len, "Frame data:\n");
 
-	// FCS check
-	uint16_t fcs = crc16_ccitt(buf, len, 0xFFFFu);
+	// FCS check (unless already done by the burst decoder)
+	uint16_t fcs = (q->flags & AVLC_FLAG_FCS_OK) ? GOOD_FCS : crc16_ccitt(buf, len, FCS_INIT);
 	debug_print(D_PROTO_DETAIL, "Check FCS: %04x\n", fcs);
 	if(fcs == GOOD_FCS) {
 		debug_print(D_PROTO, "FCS check OK\n");
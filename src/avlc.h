@@ -41,12 +41,18 @@ typedef union {
 	} a_addr;
 } avlc_addr_t;
 
+// avlc_frame_qentry_t flags (in addition to OUT_FLAG_*)
+#define AVLC_FLAG_FCS_OK (1 << 1)       // frame FCS has been verified
+#define AVLC_FLAG_POOLED (1 << 2)       // entry is recycled by the burst decoder, not freed
+
 typedef struct {
 	vdl2_msg_metadata *metadata;
 	octet_string_t *frame;
+	uint64_t seq;                   // receive order (used when output reordering is enabled)
 	int flags;
 } avlc_frame_qentry_t;
 
 uint32_t parse_dlc_addr(uint8_t *buf);
+uint32_t avlc_conversation_key(uint8_t const *buf, uint32_t len);
 la_proto_node *avlc_parse(avlc_frame_qentry_t *q, uint32_t *msg_type, reasm_contexts *reasm_ctx);
 #endif // !_AVLC_H
@@ -16,7 +16,15 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+
+// Bits are packed into 64-bit words in the order of arrival, starting
+// from the least significant bit of the first word, ie. bit number i
+// of the stream is bit (i % 64) of buf[i / 64]. The buffer has one spare
+// word at the end, so that reading or writing up to 64 bits at any valid
+// position never needs a bounds check.
+
 #include <stdio.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,10 +33,78 @@
 #include <errno.h>
 #include "dumpvdl2.h"
 
+#define BS_WORD_BITS 64
+#define BS_MASK(n) ((n) < BS_WORD_BITS ? (UINT64_C(1) << (n)) - 1 : ~UINT64_C(0))
+
+// Scrambler sequence length. The scrambler is a 15-bit LFSR with a fixed
+// initial value, so all bursts are XORed with the same sequence of bits.
+#define LFSR_PERIOD 32767
+
+// Scrambler sequence, packed in the same way as bit streams. There are at least 64 bits
+// more than one period, so that any 64 bits can be read without wrapping around.
+static uint64_t lfsr_seq[(LFSR_PERIOD + 2 * BS_WORD_BITS) / BS_WORD_BITS];
+
+// Returns n bits (n <= 64) starting at bit position pos. The first bit
+// is placed at the least significant bit of the result.
+static inline uint64_t bits_get(uint64_t const *buf, uint32_t pos, uint32_t n) {
+	uint32_t const w = pos / BS_WORD_BITS, off = pos % BS_WORD_BITS;
+	uint64_t v = buf[w] >> off;
+	if(off > 0 && off + n > BS_WORD_BITS) {
+		v |= buf[w + 1] << (BS_WORD_BITS - off);
+	}
+	return v & BS_MASK(n);
+}
+
+static inline uint64_t bs_get(bitstream_t const *bs, uint32_t pos, uint32_t n) {
+	return bits_get(bs->buf, pos, n);
+}
+
+// Stores n least significant bits of v (n <= 64) at bit position pos
+static inline void bs_put(bitstream_t *bs, uint32_t pos, uint64_t v, uint32_t n) {
+	uint32_t const w = pos / BS_WORD_BITS, off = pos % BS_WORD_BITS;
+	uint64_t const mask = BS_MASK(n);
+	v &= mask;
+	bs->buf[w] = (bs->buf[w] & ~(mask << off)) | (v << off);
+	if(off > 0 && off + n > BS_WORD_BITS) {
+		uint32_t const s = BS_WORD_BITS - off;
+		bs->buf[w + 1] = (bs->buf[w + 1] & ~(mask >> s)) | (v >> s);
+	}
+}
+
+// Stores n least significant bits of v (n <= 64) at bit position pos,
+// clobbering all bits following them in the same word. For appending only.
+static inline void bs_put_tail(bitstream_t *bs, uint32_t pos, uint64_t v, uint32_t n) {
+	uint32_t const w = pos / BS_WORD_BITS, off = pos % BS_WORD_BITS;
+	v &= BS_MASK(n);
+	bs->buf[w] = (bs->buf[w] & BS_MASK(off)) | (v << off);
+	if(off > 0 && off + n > BS_WORD_BITS) {
+		bs->buf[w + 1] = v >> (BS_WORD_BITS - off);
+	}
+}
+
+static inline uint32_t ctz64(uint64_t v) {
+#ifdef __GNUC__
+	return (uint32_t)__builtin_ctzll(v);
+#else
+	uint32_t n = 0;
+	for(; (v & 1) == 0; v >>= 1) {
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline uint8_t reverse8(uint8_t b) {
+	b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+	b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+	b = (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+	return b;
+}
+
 bitstream_t *bitstream_init(uint32_t len) {
 	if(len == 0) return NULL;
 	NEW(bitstream_t, ret);
-	ret->buf = XCALLOC(len, sizeof(uint8_t));
+	ret->buf = XCALLOC(len / BS_WORD_BITS + 2, sizeof(uint64_t));
 	ret->start = ret->end = ret->descrambler_pos = 0;
 	ret->len = len;
 	return ret;
@@ -48,9 +124,8 @@ int bitstream_append_msbfirst(bitstream_t *bs, uint8_t const *bytes,
 	if(bs->end + numbits * numbytes > bs->len)
 		return -1;
 	for(uint32_t i = 0; i < numbytes; i++) {
-		uint8_t t = bytes[i];
-		for(int j = numbits - 1; j >= 0; j--)
-			bs->buf[bs->end++] = (t >> j) & 0x01;
+		bs_put_tail(bs, bs->end, reverse8(bytes[i]) >> (8 - numbits), numbits);
+		bs->end += numbits;
 	}
 	return 0;
 }
@@ -59,10 +134,20 @@ int bitstream_append_lsbfirst(bitstream_t *bs, uint8_t const *bytes,
 		uint32_t numbytes, uint32_t numbits) {
 	if(bs->end + numbits * numbytes > bs->len)
 		return -1;
-	for(uint32_t i = 0; i < numbytes; i++) {
-		uint8_t t = bytes[i];
-		for(uint32_t j = 0; j < numbits; j++)
-			bs->buf[bs->end++] = (t >> j) & 0x01;
+	uint32_t i = 0;
+	if(numbits == 8) {
+		for(; i + 8 <= numbytes; i += 8) {
+			uint64_t v = 0;
+			for(int k = 7; k >= 0; k--) {
+				v = (v << 8) | bytes[i + k];
+			}
+			bs_put_tail(bs, bs->end, v, BS_WORD_BITS);
+			bs->end += BS_WORD_BITS;
+		}
+	}
+	for(; i < numbytes; i++) {
+		bs_put_tail(bs, bs->end, bytes[i], numbits);
+		bs->end += numbits;
 	}
 	return 0;
 }
@@ -71,12 +156,20 @@ int bitstream_read_lsbfirst(bitstream_t *bs, uint8_t *bytes,
 		uint32_t numbytes, uint32_t numbits) {
 	if(bs->start + numbits * numbytes > bs->end)
 		return -1;
-	for(uint32_t i = 0; i < numbytes; i++) {
-		bytes[i] = 0x00;
-		for(uint32_t j = 0; j < numbits; j++) {
-			bytes[i] |= (0x01 & bs->buf[bs->start++]) << j;
+	uint32_t i = 0;
+	if(numbits == 8) {
+		for(; i + 8 <= numbytes; i += 8) {
+			uint64_t v = bs_get(bs, bs->start, BS_WORD_BITS);
+			bs->start += BS_WORD_BITS;
+			for(int k = 0; k < 8; k++, v >>= 8) {
+				bytes[i + k] = (uint8_t)v;
+			}
 		}
 	}
+	for(; i < numbytes; i++) {
+		bytes[i] = (uint8_t)bs_get(bs, bs->start, numbits);
+		bs->start += numbits;
+	}
 	return 0;
 }
 
@@ -84,69 +177,231 @@ int bitstream_read_word_msbfirst(bitstream_t *bs, uint32_t *ret,
 		uint32_t numbits) {
 	if(bs->start + numbits > bs->end)
 		return -1;
-	*ret = 0;
-	for(uint32_t i = 0; i < numbits; i++) {
-		*ret |= (0x01 & bs->buf[bs->start++]) << (numbits-i-1);
-	}
+	*ret = reverse((uint32_t)bs_get(bs, bs->start, numbits), numbits);
+	bs->start += numbits;
 	return 0;
 }
 
-void bitstream_descramble(bitstream_t *bs, uint16_t *lfsr) {
-	uint8_t bit;
+void bitstream_descrambler_init(uint16_t iv) {
+	uint16_t lfsr = iv;
+	uint64_t bit;
+	memset(lfsr_seq, 0, sizeof(lfsr_seq));
+	for(uint32_t i = 0; i < sizeof(lfsr_seq) * CHAR_BIT; i++) {
+		ASSERT(i != LFSR_PERIOD || lfsr == iv);
+		/* LFSR length: 15; feedback polynomial: x^15 + x + 1 */
+		bit = ((lfsr >> 0) ^ (lfsr >> 14)) & 1;
+		lfsr = (lfsr >> 1) | (bit << 14);
+		lfsr_seq[i / BS_WORD_BITS] |= bit << (i % BS_WORD_BITS);
+	}
+}
 
+// Descrambles bits appended since the last call. pos is the position in the
+// scrambler sequence (0 at the start of the burst), updated on return.
+void bitstream_descramble(bitstream_t *bs, uint32_t *pos) {
 	if(bs->descrambler_pos < bs->start)
 		bs->descrambler_pos = bs->start;
-	for(uint32_t i = bs->descrambler_pos; i < bs->end; i++) {
-		/* LFSR length: 15; feedback polynomial: x^15 + x + 1 */
-		bit = ((*lfsr >> 0) ^ (*lfsr >> 14)) & 1;
-		*lfsr = (*lfsr >> 1) | (bit << 14);
-		bs->buf[i] ^= bit;
+	uint32_t i = bs->descrambler_pos;
+	while(i < bs->end) {
+		// process up to the end of the current word
+		uint32_t n = BS_WORD_BITS - i % BS_WORD_BITS;
+		if(n > bs->end - i) {
+			n = bs->end - i;
+		}
+		bs->buf[i / BS_WORD_BITS] ^= bits_get(lfsr_seq, *pos, n) << (i % BS_WORD_BITS);
+		i += n;
+		*pos += n;
+		if(*pos >= LFSR_PERIOD) {
+			*pos -= LFSR_PERIOD;
+		}
 	}
 	debug_print(D_BURST_DETAIL, "descrambled from %u to %u\n", bs->descrambler_pos, bs->end-1);
 	bs->descrambler_pos = bs->end;
 }
 
-int bitstream_copy_next_frame(bitstream_t *src, bitstream_t *dst) {
+// Longest chunk copied at once by bitstream_unstuff_next_frame(). Together with
+// up to 7 bits pending in the output accumulator it must fit in a word.
+#define UNSTUFF_CHUNK_BITS 56
+
+// HDLC unstuffer state machine transition, processing 8 bits at a time
+typedef struct {
+	uint8_t bits;               // output bits, stuffed zeros removed
+	uint8_t num_bits;
+	uint8_t ones;               // number of trailing consecutive ones
+	bool special;               // contains a flag or an invalid sequence
+} unstuff_step_t;
+
+// Indexed by the number of consecutive ones preceding the input (0-6)
+// and the next 8 input bits (first bit in LSB)
+static unstuff_step_t unstuff_tab[7][256];
+
+void bitstream_unstuffer_init() {
+	for(int state = 0; state < 7; state++) {
+		for(int in = 0; in < 256; in++) {
+			unstuff_step_t *s = &unstuff_tab[state][in];
+			int ones = state;
+			for(int k = 0; k < 8; k++) {
+				int const b = (in >> k) & 1;
+				if(b == 0 && ones == 5) {           // stuffed 0 bit
+					ones = 0;
+					continue;
+				}
+				if(ones == 6) {                     // 7 ones or a flag
+					s->special = true;
+					break;
+				}
+				s->bits |= b << s->num_bits++;
+				ones = (b == 1 ? ones + 1 : 0);
+			}
+			s->ones = ones;
+		}
+	}
+}
+
+// Extracts the next HDLC frame from src, removing stuffed zero bits, and stores
+// it in dst, which is dst_len octets long. The frame length in bits is returned
+// in num_bits. Initial and trailing flags are not included in the result.
+// The CRC of all complete octets of the frame is computed on the way, as they
+// are stored, and returned in fcs.
+// Returns -1 on error, 1 if there is more data in src after the frame, 0 otherwise.
+int bitstream_unstuff_next_frame(bitstream_t *src, uint8_t *dst, uint32_t dst_len,
+		uint32_t *num_bits, uint16_t *fcs) {
 	int ones;
-	uint32_t i, j;
+	uint32_t i, j, acc_bits;
+	uint32_t crc_len;                           // octets included in the CRC so far
+	uint64_t acc;
 restart:
 	ones = 0;
-	bitstream_reset(dst);
-	for(i = src->start, j = 0; i < src->end; i++, src->start++) {
-		if(src->buf[i] == 0x0 && ones == 5) {   // stuffed 0 bit - skip it
+	j = 0;                                      // octets stored in dst
+	acc = 0; acc_bits = 0;                      // bits not stored in dst yet
+	crc_len = 0;
+	*fcs = FCS_INIT;
+	for(i = src->start; i < src->end; ) {
+		while(src->end - i >= 8) {
+			// make room for up to UNSTUFF_CHUNK_BITS bits in the accumulator
+			for(; acc_bits >= 8; acc_bits -= 8, acc >>= 8) {
+				if(j == dst_len) {
+					goto overflow;
+				}
+				dst[j++] = (uint8_t)acc;
+			}
+			if(j - crc_len >= 8) {
+				*fcs = crc16_ccitt(dst + crc_len, j - crc_len, *fcs);
+				crc_len = j;
+			}
+			uint32_t const n = src->end - i < UNSTUFF_CHUNK_BITS ? src->end - i : UNSTUFF_CHUNK_BITS;
+			uint64_t const c = bs_get(src, i, n);
+			// Bits up to the next run of five ones (including those at the end of
+			// the previous chunk) are neither stuffed bits nor flags, so they can be
+			// copied as is. This is the case for most of the data.
+			if(ones < 5) {
+				uint64_t const x = (c << ones) | BS_MASK(ones);
+				uint64_t const runs = x & x >> 1 & x >> 2 & x >> 3 & x >> 4 & BS_MASK(n + ones - 4);
+				uint32_t const m = (runs == 0 ? n : ctz64(runs) + 4 - ones);
+				if(m >= 8) {
+					acc |= (c & BS_MASK(m)) << acc_bits;
+					acc_bits += m;
+					uint32_t top = 0;
+					while((c >> (m - 1 - top)) & 1) {
+						top++;
+					}
+					ones = (int)top;
+					i += m;
+					continue;
+				}
+			}
+			// Otherwise take 8 bits from the transition table, unless there
+			// is a flag or an invalid sequence among them
+			unstuff_step_t const *s = &unstuff_tab[ones][c & 0xff];
+			if(s->special) {
+				break;
+			}
+			acc |= (uint64_t)s->bits << acc_bits;
+			acc_bits += s->num_bits;
+			ones = s->ones;
+			i += 8;
+		}
+		if(i >= src->end) {
+			break;
+		}
+		// Near a flag or at the end of the stream - go bit by bit
+		uint32_t const b = (uint32_t)bs_get(src, i, 1);
+		if(b == 0x0 && ones == 5) {             // stuffed 0 bit - skip it
 			ones = 0;
+			i++;
 			continue;
-		} else if(src->buf[i] == 0x1) {
+		} else if(b == 0x1) {
 			ones++;
 			if(ones > 6) {                      // 7 ones - invalid bit sequence
 				debug_print(D_BURST_DETAIL, "Invalid bit stuffing sequence\n");
+				src->start = i;
 				return -1;
 			}
-		}
-		dst->buf[j] = src->buf[i];
-		if(src->buf[i] == 0x0) {
-			if(ones == 6) {                     // frame boundary flag (0x7e)
-				if(j == 7) {                    // move past the initial flag
-					src->start++;
-					debug_print(D_BURST_DETAIL, "Initial flag found, restarting\n");
-					goto restart;
-				} else {
-					if(j < 7) {
-						debug_print(D_BURST_DETAIL, "Invalid bit sequence - 6 ones at the start of the stream\n");
-						return -1;
-					}
-					dst->end = j - 7;           // remove trailing flag from the result
-					src->start++;
-					break;
+		} else if(ones == 6) {                  // frame boundary flag (0x7e)
+			// 7 bits of the flag preceding this one have already been output
+			uint32_t const len = j * 8 + acc_bits;
+			for(; acc_bits >= 8; acc_bits -= 8, acc >>= 8) {
+				if(j == dst_len) {
+					goto overflow;
 				}
+				dst[j++] = (uint8_t)acc;
 			}
+			// frame octets which may still be missing in the CRC
+			uint32_t const frame_len = len >= 7 ? (len - 7) / 8 : 0;
+			if(frame_len > crc_len) {
+				*fcs = crc16_ccitt(dst + crc_len, frame_len - crc_len, *fcs);
+			} else if(frame_len < crc_len) {
+				// An octet with bits of the flag went into the CRC already.
+				// This only happens if the frame is not a whole number of octets.
+				*fcs = crc16_ccitt(dst, frame_len, FCS_INIT);
+			}
+			if(len == 7) {                      // move past the initial flag
+				src->start = i + 1;
+				debug_print(D_BURST_DETAIL, "Initial flag found, restarting\n");
+				goto restart;
+			} else if(len < 7) {
+				debug_print(D_BURST_DETAIL, "Invalid bit sequence - 6 ones at the start of the stream\n");
+				src->start = i;
+				return -1;
+			}
+			*num_bits = len - 7;                // remove trailing flag from the result
+			src->start = i + 1;
+			goto end;
+		} else {
 			ones = 0;
 		}
-		j++; dst->end++;
+		acc |= (uint64_t)b << acc_bits;
+		acc_bits++;
+		i++;
+		if(acc_bits >= 8) {
+			if(j == dst_len) {
+				goto overflow;
+			}
+			dst[j++] = (uint8_t)acc;
+			acc >>= 8;
+			acc_bits -= 8;
+		}
+	}
+	src->start = i;
+	*num_bits = j * 8 + acc_bits;
+	// store complete octets left in the accumulator
+	for(; acc_bits >= 8; acc_bits -= 8, acc >>= 8) {
+		if(j == dst_len) {
+			goto overflow;
+		}
+		dst[j++] = (uint8_t)acc;
+	}
+	if(acc_bits > 0 && j < dst_len) {
+		dst[j] = (uint8_t)acc;
 	}
-	debug_print(D_BURST_DETAIL, "dst len: %u, next src read at %u, remaining src length: %u\n",
-			dst->end - dst->start, src->start, src->end - src->start);
+	*fcs = crc16_ccitt(dst + crc_len, j - crc_len, *fcs);
+end:
+	debug_print(D_BURST_DETAIL, "frame len: %u bits, next src read at %u, remaining src length: %u\n",
+			*num_bits, src->start, src->end - src->start);
 	return (src->start < src->end ? 1 : 0);
+overflow:
+	debug_print(D_BURST_DETAIL, "Output buffer too short (%u octets)\n", dst_len);
+	src->start = i;
+	return -1;
 }
 
 uint32_t reverse(uint32_t v, int numbits) {
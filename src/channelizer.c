@@ -0,0 +1,165 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Shared FFT channelizer (overlap-save filter bank).
+//
+// The input thread transforms each block of N = CHANNELIZER_OUT_LEN * oversample
+// input samples with a single forward FFT. Consecutive blocks overlap by
+// CHANNELIZER_OVERLAP * oversample samples. Each channel then picks
+// CHANNELIZER_OUT_LEN bins centered around its frequency, multiplies them by
+// the lowpass filter response and runs a short inverse FFT. This downconverts,
+// filters and decimates the channel in one go. The result is equivalent to
+// mixing the channel down by the frequency of its center bin, so the caller
+// has to correct the residual offset with dphi and block_dphi.
+//
+// The cost of the forward FFT is shared by all channels, while the per-channel
+// cost is a CHANNELIZER_OUT_LEN-point inverse FFT per block instead of mixing
+// and filtering every input sample.
+
+#include <math.h>               // floor, lround
+#include <string.h>             // memcpy, memmove
+#include "channelizer.h"
+#include "dsp.h"                // dsp
+#include "fft.h"
+#include "dumpvdl2.h"           // NEW, XCALLOC, XREALLOC, XFREE
+
+static fft_plan_t *fwd_plan, *inv_plan;
+static uint32_t fft_len, overlap_len;
+static cfloat_t *filter_bins;   // CHANNELIZER_OUT_LEN bins of the lowpass filter response
+static cfloat_t *inbuf;         // fft_len samples
+static uint32_t inbuf_len;
+
+// Convert a phase value in cycles to a 24-bit fixed point
+// value as used by the downmixer (0x0-0xFFFFFF == 0..2*pi)
+static uint32_t cycles_to_phase(double cycles) {
+	cycles -= floor(cycles);
+	return (uint32_t)(cycles * 16777216.0) & 0xffffff;
+}
+
+uint32_t channelizer_filter_len(uint32_t oversample) {
+	return CHANNELIZER_OVERLAP * oversample + 1;
+}
+
+void channelizer_init(uint32_t oversample, float const *taps, uint32_t num_taps) {
+	ASSERT(taps != NULL);
+	ASSERT(num_taps <= channelizer_filter_len(oversample));
+	fft_len = CHANNELIZER_OUT_LEN * oversample;
+	overlap_len = CHANNELIZER_OVERLAP * oversample;
+	fwd_plan = fft_plan_new(fft_len, false);
+	inv_plan = fft_plan_new(CHANNELIZER_OUT_LEN, true);
+	ASSERT(fwd_plan != NULL && inv_plan != NULL);
+
+	// Compute filter frequency response and keep bins which fall into the channel bandwidth.
+	// Scale them by 1/fft_len to normalize the inverse transform.
+	cfloat_t *h = XCALLOC(fft_len, sizeof(cfloat_t));
+	cfloat_t *hf = XCALLOC(fft_len, sizeof(cfloat_t));
+	for(uint32_t i = 0; i < num_taps; i++) {
+		h[i].re = taps[i];
+	}
+	fft_execute(fwd_plan, h, hf);
+	filter_bins = XCALLOC(CHANNELIZER_OUT_LEN, sizeof(cfloat_t));
+	for(uint32_t i = 0; i < CHANNELIZER_OUT_LEN / 2; i++) {
+		filter_bins[i].re = hf[i].re / (float)fft_len;
+		filter_bins[i].im = hf[i].im / (float)fft_len;
+		uint32_t const j = CHANNELIZER_OUT_LEN - 1 - i;
+		filter_bins[j].re = hf[fft_len - 1 - i].re / (float)fft_len;
+		filter_bins[j].im = hf[fft_len - 1 - i].im / (float)fft_len;
+	}
+	XFREE(h);
+	XFREE(hf);
+
+	// Prefill the overlap region with zeros, so that the first channel
+	// sample corresponds to the first input sample
+	inbuf = XCALLOC(fft_len, sizeof(cfloat_t));
+	inbuf_len = overlap_len;
+	debug_print(D_DEMOD, "fft_len: %u overlap_len: %u filter taps: %u\n", fft_len, overlap_len, num_taps);
+}
+
+channelizer_channel_t *channelizer_channel_new(int32_t freq_offset, uint32_t source_rate, uint32_t oversample) {
+	ASSERT(source_rate != 0);
+	uint32_t const n = CHANNELIZER_OUT_LEN * oversample;
+	NEW(channelizer_channel_t, c);
+	long bin = lround((double)freq_offset * (double)n / (double)source_rate);
+	double residual = (double)freq_offset - (double)bin * (double)source_rate / (double)n;
+	c->center_bin = (uint32_t)((bin % (long)n + (long)n) % (long)n);
+	// Selecting bins centered around center_bin shifts the channel down by bin * source_rate / n Hz.
+	// The remaining offset is removed by mixing each channel sample with -residual.
+	// Blocks are CHANNELIZER_HOP channel samples apart, so the downmix phase has
+	// to advance by the full offset over that period to stay continuous across blocks.
+	c->dphi = cycles_to_phase(-residual * (double)oversample / (double)source_rate);
+	c->block_dphi = cycles_to_phase(-(double)freq_offset * (double)(CHANNELIZER_HOP * oversample) / (double)source_rate);
+	c->bins = XCALLOC(CHANNELIZER_OUT_LEN, sizeof(cfloat_t));
+	c->out = XCALLOC(CHANNELIZER_OUT_LEN, sizeof(cfloat_t));
+	debug_print(D_DEMOD, "freq_offset: %d center_bin: %u residual: %f Hz dphi: 0x%x block_dphi: 0x%x\n",
+			freq_offset, c->center_bin, residual, c->dphi, c->block_dphi);
+	return c;
+}
+
+// Transform all complete blocks of the given buffer of interleaved I/Q samples
+// and store the spectra in the given sample block. len is the number of floats
+// in buf. Samples which do not fill up a complete block are retained and used
+// in the next call.
+void channelizer_put_samples(float const *buf, uint32_t len, sample_block_t *out) {
+	ASSERT(inbuf != NULL);
+	ASSERT(out != NULL);
+	out->num_spectra = 0;
+	uint32_t const blocks_max = (inbuf_len + len / 2) / (fft_len - overlap_len) + 1;
+	if(blocks_max * fft_len > out->spectra_capacity) {
+		out->spectra = XREALLOC(out->spectra, blocks_max * fft_len * sizeof(cfloat_t));
+		out->spectra_capacity = blocks_max * fft_len;
+	}
+	for(uint32_t i = 0; i + 1 < len;) {
+		for(; inbuf_len < fft_len && i + 1 < len; inbuf_len++) {
+			inbuf[inbuf_len].re = buf[i++];
+			inbuf[inbuf_len].im = buf[i++];
+		}
+		if(inbuf_len < fft_len) {
+			break;
+		}
+		ASSERT(out->num_spectra < blocks_max);
+		fft_execute(fwd_plan, inbuf, out->spectra + out->num_spectra * fft_len);
+		out->num_spectra++;
+		memmove(inbuf, inbuf + fft_len - overlap_len, overlap_len * sizeof(cfloat_t));
+		inbuf_len = overlap_len;
+	}
+}
+
+// Returns CHANNELIZER_HOP samples of the given channel computed from
+// the given spectrum of the sample block. The result is valid until the next
+// call for this channel.
+cfloat_t const *channelizer_channel_get_block(channelizer_channel_t *c, sample_block_t const *b, uint32_t block) {
+	ASSERT(c != NULL);
+	ASSERT(b != NULL);
+	ASSERT(block < b->num_spectra);
+	cfloat_t const *spectrum = b->spectra + block * fft_len;
+	uint32_t s = (c->center_bin + fft_len - CHANNELIZER_OUT_LEN / 2) % fft_len;
+	uint32_t d = CHANNELIZER_OUT_LEN / 2;
+	// Bins are copied in contiguous runs, split where either index wraps around
+	for(uint32_t j = 0; j < CHANNELIZER_OUT_LEN;) {
+		uint32_t run = CHANNELIZER_OUT_LEN - j;
+		if(fft_len - s < run) run = fft_len - s;
+		if(CHANNELIZER_OUT_LEN - d < run) run = CHANNELIZER_OUT_LEN - d;
+		dsp.cmul(c->bins + d, spectrum + s, filter_bins + d, run);
+		j += run;
+		s = (s + run) % fft_len;
+		d = (d + run) % CHANNELIZER_OUT_LEN;
+	}
+	fft_execute(inv_plan, c->bins, c->out);
+	return c->out + CHANNELIZER_OVERLAP;
+}
@@ -0,0 +1,49 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHANNELIZER_H
+#define _CHANNELIZER_H 1
+#include <stdint.h>
+#include "fft.h"                // cfloat_t
+#include "sample_ring.h"        // sample_block_t
+
+// Number of channel samples (after decimation) produced from a single
+// forward FFT block. Forward FFT length is CHANNELIZER_OUT_LEN * oversample.
+#define CHANNELIZER_OUT_LEN 256
+// Overlap between consecutive FFT blocks (in channel samples).
+// Lowpass filter impulse response is truncated to this length.
+#define CHANNELIZER_OVERLAP 32
+// Number of valid channel samples produced per FFT block
+#define CHANNELIZER_HOP (CHANNELIZER_OUT_LEN - CHANNELIZER_OVERLAP)
+
+typedef struct channelizer_channel {
+	uint32_t center_bin;    // forward FFT bin nearest to the channel frequency
+	uint32_t dphi;          // residual downmix phase increment per channel sample
+	uint32_t block_dphi;    // downmix phase advance between consecutive blocks
+	cfloat_t *bins;         // work buffers, CHANNELIZER_OUT_LEN elements each
+	cfloat_t *out;
+} channelizer_channel_t;
+
+uint32_t channelizer_filter_len(uint32_t oversample);
+void channelizer_init(uint32_t oversample, float const *taps, uint32_t num_taps);
+channelizer_channel_t *channelizer_channel_new(int32_t freq_offset, uint32_t source_rate, uint32_t oversample);
+void channelizer_put_samples(float const *buf, uint32_t len, sample_block_t *out);
+cfloat_t const *channelizer_channel_get_block(channelizer_channel_t *c, sample_block_t const *b, uint32_t block);
+
+#endif // !_CHANNELIZER_H
@@ -18,7 +18,7 @@
  */
 #include <stdint.h>
 
-uint16_t crc16_ccitt(uint8_t *data, uint32_t len, uint16_t crc_init) {
+uint16_t crc16_ccitt(uint8_t const *data, uint32_t len, uint16_t crc_init) {
 	/* CRC-16-CCITT, poly: 0x1021 */
 	static uint16_t const crctable[256] =
 	{
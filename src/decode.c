@@ -17,12 +17,14 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #define _GNU_SOURCE
+#include <stddef.h>                 // offsetof
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <glib.h>                   // GAsyncQueue, g_async_queue_*
 #include <math.h>                   // log10f
 #include <libacars/libacars.h>      // la_proto_node, la_proto_tree_destroy()
@@ -35,7 +37,9 @@
 #include "output-common.h"
 #include "dumpvdl2.h"
 #include "avlc.h"                   // avlc_frame_qentry_t
+#include "mpsc_queue.h"             // mpsc_queue_t, mpsc_queue_*
 #include "reassembly.h"             // reasm_ctx, reasm_ctx_new()
+#include "ac_data.h"                // ac_data_thread_destroy()
 
 // Reasonable limits for transmission lengths in bits
 // This is to avoid blocking the decoder in DEC_DATA for a long time
@@ -49,8 +53,110 @@
 
 #define LFSR_IV 0x6959u
 
+// Upper limits of burst component sizes, given MAX_FRAME_LENGTH
+#define MAX_DATA_OCTETS ((MAX_FRAME_LENGTH + 7) / 8)
+#define MAX_RS_BLOCKS ((MAX_DATA_OCTETS + RS_K - 1) / RS_K)
+
 bool decoder_thread_active;
-static GAsyncQueue *avlc_decoder_queue;
+// Frames waiting for each AVLC decoder thread
+#define AVLC_QUEUE_LEN 1024
+// Maximum number of frames taken off the queue at once
+#define AVLC_DECODER_BATCH 32
+
+// Mutex-protected stack of recycled objects. Objects embed pool_node_t
+// as their first member.
+typedef struct pool_node {
+	struct pool_node *next;
+} pool_node_t;
+
+typedef struct {
+	pool_node_t *head;
+	pthread_mutex_t mutex;
+} object_pool_t;
+
+// A burst handed over by the demodulator to a burst decoder thread
+typedef struct {
+	pool_node_t node;
+	bitstream_t *bs;                    // descrambled header already consumed
+	struct timeval burst_timestamp;
+	float frame_pwr;
+	float mag_nf;
+	float ppm_error;
+	uint32_t freq;
+	uint32_t datalen, datalen_octets, last_block_len_octets, fec_octets;
+	uint32_t num_blocks;
+	uint32_t syndrome;
+	uint32_t lfsr_pos;
+	int flags;
+} vdl2_burst_t;
+
+// Scratch space for decoding a single burst, preallocated for the longest
+// acceptable burst
+typedef struct {
+	uint8_t data[MAX_DATA_OCTETS];
+	uint8_t fec[MAX_RS_BLOCKS * (RS_N - RS_K)];
+	uint8_t rs_tab[MAX_RS_BLOCKS][RS_N];
+	int rs_ret[MAX_RS_BLOCKS];
+} burst_scratch_t;
+
+typedef struct {
+	GAsyncQueue *q;
+	pthread_t thread;
+	burst_scratch_t *scratch;
+} burst_decoder_t;
+
+// AVLC decoder queue entry together with the frame and its metadata,
+// recycled as a whole after the AVLC decoder is done with it
+typedef struct {
+	pool_node_t node;
+	avlc_frame_qentry_t qentry;
+	vdl2_msg_metadata metadata;
+	octet_string_t frame;
+	uint8_t buf[MAX_DATA_OCTETS];
+} avlc_frame_slot_t;
+
+// Output queue entry produced from a frame, waiting for the resequencer
+typedef struct {
+	la_list *outputs;
+	output_qentry_t *qentry;
+} pending_output_t;
+
+typedef struct {
+	mpsc_queue_t *q;
+	pthread_t thread;
+	la_list *pending;                   // pending_output_t's of the current frame (ordered output only)
+} avlc_decoder_t;
+
+static burst_decoder_t *burst_decoders;
+static int num_burst_decoders;
+static avlc_decoder_t *avlc_decoders;
+static int num_avlc_decoders;
+static int active_avlc_decoders;
+static la_list *avlc_fmtr_list;
+
+// Restores the receive order of frames decoded by different AVLC decoder
+// threads. Each frame gets a sequence number when it's queued. Outputs
+// produced from it are held in its slot until all older frames are done.
+// Then they are moved to the ready list, which is passed to outputs by one
+// thread at a time, without holding the mutex (output_queue_push may block).
+static bool ordered_output;
+static uint64_t avlc_frame_seq;
+static struct {
+	la_list **outputs;                  // pending_output_t's of each frame
+	bool *done;
+	uint64_t mask;
+	uint64_t next;                      // oldest frame not moved to the ready list yet
+	la_list *ready;                     // pending_output_t lists of completed frames, in receive order
+	la_list *ready_tail;
+	bool flushing;                      // some thread is passing the ready list to outputs
+	int waiting;                        // dispatchers waiting for a free slot
+	pthread_mutex_t mutex;
+	pthread_cond_t slot_freed;
+} reseq = { .mutex = PTHREAD_MUTEX_INITIALIZER, .slot_freed = PTHREAD_COND_INITIALIZER };
+// Bursts returned by burst decoders (with their bit streams), ready to be reused by demodulators
+static object_pool_t burst_pool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+// Frame slots returned by the AVLC decoder
+static object_pool_t frame_pool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
 
 static uint32_t const H[HDRFECLEN] = {
 	0b0000000011111111111110000,
@@ -162,42 +268,315 @@ static int deinterleave(uint8_t *in, uint32_t len, uint32_t rows, uint32_t cols,
 	return 0;
 }
 
+static void *pool_get(object_pool_t *p) {
+	pthread_mutex_lock(&p->mutex);
+	pool_node_t *n = p->head;
+	if(n != NULL) {
+		p->head = n->next;
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return n;
+}
+
+static void pool_put(object_pool_t *p, void *obj) {
+	pool_node_t *n = obj;
+	pthread_mutex_lock(&p->mutex);
+	n->next = p->head;
+	p->head = n;
+	pthread_mutex_unlock(&p->mutex);
+}
+
+// Returns a free frame slot. New slots are only allocated until the pool
+// warms up, which is counted in decoder.allocs.
+static avlc_frame_slot_t *avlc_frame_slot_get(uint32_t freq) {
+	avlc_frame_slot_t *slot = pool_get(&frame_pool);
+	if(slot == NULL) {
+		slot = XCALLOC(1, sizeof(avlc_frame_slot_t));
+		statsd_increment_per_channel(freq, "decoder.allocs");
+	}
+	return slot;
+}
+
+static void avlc_frame_slot_release(avlc_frame_qentry_t *q) {
+	pool_put(&frame_pool, (uint8_t *)q - offsetof(avlc_frame_slot_t, qentry));
+}
+
+// Waits until the frame with the given sequence number fits in the resequencer
+// ring. The ring fills up when a stalled decoder (eg. one blocked in
+// output_queue_push) holds back the oldest frame while others keep going.
+// All older frames have been dispatched already, so the wait always ends.
+static void reseq_slot_wait(uint64_t seq) {
+	if(seq - __atomic_load_n(&reseq.next, __ATOMIC_ACQUIRE) <= reseq.mask) {
+		return;
+	}
+	pthread_mutex_lock(&reseq.mutex);
+	reseq.waiting++;
+	while(seq - reseq.next > reseq.mask) {
+		pthread_cond_wait(&reseq.slot_freed, &reseq.mutex);
+	}
+	reseq.waiting--;
+	pthread_mutex_unlock(&reseq.mutex);
+}
+
+// Frames of a single conversation must go to the same AVLC decoder thread,
+// so that its reassembly contexts get all fragments in order.
+static void avlc_decoder_dispatch(avlc_frame_qentry_t *q) {
+	avlc_decoder_t *d = &avlc_decoders[0];
+	if(num_avlc_decoders > 1) {
+		uint32_t const hash = avlc_conversation_key(q->frame->buf, q->frame->len) * 2654435761u;
+		d = &avlc_decoders[((uint64_t)hash * num_avlc_decoders) >> 32];
+	}
+	if(ordered_output) {
+		q->seq = __atomic_fetch_add(&avlc_frame_seq, 1, __ATOMIC_RELAXED);
+		reseq_slot_wait(q->seq);
+	}
+	mpsc_queue_push(d->q, q);
+}
+
 void avlc_decoder_queue_push(vdl2_msg_metadata *metadata, octet_string_t *frame, int flags) {
 	NEW(avlc_frame_qentry_t, qentry);
 	qentry->metadata = metadata;
 	qentry->frame = frame;
 	qentry->flags = flags;
-	g_async_queue_push(avlc_decoder_queue, qentry);
+	avlc_decoder_dispatch(qentry);
 }
 
-static void decode_frame(vdl2_channel_t const *v,
-		int frame_num, uint8_t *buf,
+// Passes the frame unstuffed into slot->buf to the AVLC decoder.
+// The slot is released by the AVLC decoder.
+static void decode_frame(vdl2_burst_t const *b, int num_fec_corrections,
+		int frame_num, avlc_frame_slot_t *slot,
 		size_t len) {
-	NEW(vdl2_msg_metadata, metadata);
+	vdl2_msg_metadata *metadata = &slot->metadata;
+	*metadata = (vdl2_msg_metadata){0};
 	metadata->version = 1;
 	metadata->station_id = Config.station_id;
-	metadata->freq = v->freq;
-	metadata->frame_pwr_dbfs = 10.0f * log10f(v->frame_pwr);
-	metadata->nf_pwr_dbfs = 20.0f * log10f(v->mag_nf + 0.001f);
-	metadata->ppm_error = v->ppm_error;
-	metadata->burst_timestamp.tv_sec = v->burst_timestamp.tv_sec;
-	metadata->burst_timestamp.tv_usec = v->burst_timestamp.tv_usec;
-	metadata->datalen_octets = v->datalen_octets;
-	metadata->synd_weight = synd_weight[v->syndrome];
-	metadata->num_fec_corrections = v->num_fec_corrections;
+	metadata->freq = b->freq;
+	metadata->frame_pwr_dbfs = 10.0f * log10f(b->frame_pwr);
+	metadata->nf_pwr_dbfs = 20.0f * log10f(b->mag_nf + 0.001f);
+	metadata->ppm_error = b->ppm_error;
+	metadata->burst_timestamp.tv_sec = b->burst_timestamp.tv_sec;
+	metadata->burst_timestamp.tv_usec = b->burst_timestamp.tv_usec;
+	metadata->datalen_octets = b->datalen_octets;
+	metadata->synd_weight = synd_weight[b->syndrome];
+	metadata->num_fec_corrections = num_fec_corrections;
 	metadata->idx = frame_num;
-	int flags = 0;
+	slot->frame.buf = slot->buf;
+	slot->frame.len = len;
+	slot->qentry.metadata = metadata;
+	slot->qentry.frame = &slot->frame;
+	slot->qentry.flags = AVLC_FLAG_FCS_OK | AVLC_FLAG_POOLED;
+	avlc_decoder_dispatch(&slot->qentry);
+}
+
+// Descrambles the data part of the burst, deinterleaves it, verifies FEC, unstuffs
+// AVLC frames and passes them to the AVLC decoder.
+static void decode_burst_data(vdl2_burst_t *b, burst_scratch_t *scratch) {
+#ifdef WITH_STATSD
+	struct timeval tstart;
+	gettimeofday(&tstart, NULL);
+#endif
+	int num_fec_corrections = 0;
+	// octets read or written by all decoding stages
+	size_t bytes_touched = b->datalen_octets + b->fec_octets;
+	avlc_frame_slot_t *slot = NULL;
+	ASSERT(b->datalen_octets <= MAX_DATA_OCTETS);
+	ASSERT(b->num_blocks <= MAX_RS_BLOCKS);
+	bitstream_descramble(b->bs, &b->lfsr_pos);
+	uint8_t *data = scratch->data;
+	uint8_t *fec = scratch->fec;
+	if(bitstream_read_lsbfirst(b->bs, data, b->datalen_octets, 8) < 0) {
+		debug_print(D_BURST, "Frame data truncated\n");
+		statsd_increment_per_channel(b->freq, "decoder.errors.data_truncated");
+		goto cleanup;
+	}
+	if(bitstream_read_lsbfirst(b->bs, fec, b->fec_octets, 8) < 0) {
+		debug_print(D_BURST, "FEC data truncated\n");
+		statsd_increment_per_channel(b->freq, "decoder.errors.fec_truncated");
+		goto cleanup;
+	}
+	debug_print_buf_hex(D_BURST_DETAIL, data, b->datalen_octets, "Data:\n");
+	debug_print_buf_hex(D_BURST_DETAIL, fec, b->fec_octets, "FEC:\n") ;
+	{
+		uint8_t (*rs_tab)[RS_N] = scratch->rs_tab;
+		// Deinterleaver fills all rows except the last one completely
+		memset(rs_tab[b->num_blocks - 1], 0, RS_N);
+		int ret;
+		if((ret = deinterleave(data, b->datalen_octets, b->num_blocks, RS_N, rs_tab, RS_K, 0)) < 0) {
+			debug_print(D_BURST, "Deinterleaver failed with error %d\n", ret);
+			statsd_increment_per_channel(b->freq, "decoder.errors.deinterleave_data");
+			goto cleanup;
+		}
+
+		// if last block is < 3 bytes long, no FEC is done on it, so we should not write FEC bytes into the last row
+		uint32_t fec_rows = b->num_blocks;
+		if(get_fec_octetcount(b->last_block_len_octets) == 0)
+			fec_rows--;
+
+		if((ret = deinterleave(fec, b->fec_octets, fec_rows, RS_N, rs_tab, RS_N - RS_K, RS_K)) < 0) {
+			debug_print(D_BURST, "Deinterleaver failed with error %d\n", ret);
+			statsd_increment_per_channel(b->freq, "decoder.errors.deinterleave_fec");
+			goto cleanup;
+		}
+#ifdef DEBUG
+		debug_print(D_BURST_DETAIL, "Deinterleaved blocks:\n");
+		for(uint32_t r = 0; r < b->num_blocks; r++) {
+			debug_print_buf_hex(D_BURST_DETAIL, rs_tab[r], RS_N, "Block %d:\n", r);
+		}
+#endif
+		bitstream_reset(b->bs);
+		bytes_touched += b->num_blocks * RS_N + b->datalen_octets;
+		int *rs_ret = scratch->rs_ret;
+		rs_verify_blocks(rs_tab, b->num_blocks, b->last_block_len_octets,
+				get_fec_octetcount(b->last_block_len_octets), rs_ret);
+		for(uint32_t r = 0; r < b->num_blocks; r++) {
+			statsd_increment_per_channel(b->freq, "decoder.blocks.processed");
+			int num_fec_octets = RS_N - RS_K;   // full block
+			if(r == b->num_blocks - 1) {        // final, partial block
+				num_fec_octets = get_fec_octetcount(b->last_block_len_octets);
+			}
+			ret = rs_ret[r];
+			debug_print(D_BURST, "Block %d FEC: %d\n", r, ret);
+			if(ret < 0) {
+				debug_print(D_BURST, "FEC check failed\n");
+				statsd_increment_per_channel(b->freq, "decoder.errors.fec_bad");
+				goto cleanup;
+			} else {
+				statsd_increment_per_channel(b->freq, "decoder.blocks.fec_ok");
+				if(ret > 0) {
+					debug_print_buf_hex(D_BURST_DETAIL, rs_tab[r], RS_N, "Corrected block %d:\n", r);
+					// count corrected octets, excluding intended erasures
+					num_fec_corrections += ret - (RS_N - RS_K - num_fec_octets);
+				}
+			}
+			if(r != b->num_blocks - 1)
+				ret = bitstream_append_lsbfirst(b->bs, (uint8_t *)&rs_tab[r], RS_K, 8);
+			else
+				ret = bitstream_append_lsbfirst(b->bs, (uint8_t *)&rs_tab[r], b->last_block_len_octets, 8);
+			if(ret < 0) {
+				debug_print(D_BURST, "bitstream_append_lsbfirst failed\n");
+				statsd_increment_per_channel(b->freq, "decoder.errors.bitstream");
+				goto cleanup;
+			}
+		}
+	}
+	// bitstream_append_lsbfirst() reads whole bytes, but datalen usually isn't a multiple
+	// of 8 due to bit stuffing, so we need to truncate the padding bits from the end of the bit stream.
+	if(b->datalen < b->bs->end - b->bs->start) {
+		debug_print(D_BURST, "Cut last %u bits from bitstream, bs->end was %u now is %u\n",
+				b->bs->end - b->bs->start - b->datalen, b->bs->end, b->datalen);
+		b->bs->end = b->datalen;
+	}
+	int ret;
+	int frame_cnt = 0;
+	uint32_t frame_len;
+	uint16_t fcs;
+	// Frames are unstuffed straight into the buffer which is later handed over
+	// to the AVLC decoder. A frame with a bad FCS is dropped here and its buffer
+	// is reused for the next one.
+	uint32_t frame_buf_len = (b->bs->end - b->bs->start + 7) / 8;
+	ASSERT(frame_buf_len <= MAX_DATA_OCTETS);
+	while(true) {
+		if(slot == NULL) {
+			slot = avlc_frame_slot_get(b->freq);
+		}
+		if((ret = bitstream_unstuff_next_frame(b->bs, slot->buf, frame_buf_len, &frame_len, &fcs)) < 0) {
+			break;
+		}
+		if(frame_len % 8 != 0) {
+			debug_print(D_BURST, "Frame %d: Bit stream error: does not end on a byte boundary\n", frame_cnt);
+			statsd_increment_per_channel(b->freq, "decoder.errors.truncated_octets");
+			goto cleanup;
+		}
+		uint32_t frame_len_octets = frame_len / 8;
+		bytes_touched += frame_len_octets;
+		debug_print(D_BURST, "Frame %d: Stream OK after unstuffing, length is %u octets\n",
+				frame_cnt, frame_len_octets);
+		statsd_increment_per_channel(b->freq, "decoder.msg.good");
+		if(fcs == GOOD_FCS) {
+			decode_frame(b, num_fec_corrections, frame_cnt, slot, frame_len_octets);
+			slot = NULL;
+		} else {
+			debug_print(D_BURST, "Frame %d: FCS check failed\n", frame_cnt);
+			statsd_increment_per_channel(b->freq, "avlc.errors.bad_fcs");
+		}
+		frame_cnt++;
+		if(ret == 0) { // this was the last frame in this burst
+			break;
+		}
+	}
+	if(ret < 0) {
+		statsd_increment_per_channel(b->freq, "decoder.errors.unstuff");
+		goto cleanup;
+	}
+	statsd_timing_delta_per_channel(b->freq, "decoder.msg.processing_time", tstart);
+	if(b->frame_pwr > 1.0F) {	// check for log(b->frame_pwr) > 0dBFs
+		statsd_increment_per_channel(b->freq, "decoder.msg.good_loud");
+	}
+cleanup:
+	statsd_add_per_channel(b->freq, "decoder.bytes.touched", bytes_touched);
+	if(slot != NULL) {
+		pool_put(&frame_pool, slot);
+	}
+}
 
-	uint8_t *copy = XCALLOC(len, sizeof(uint8_t));
-	memcpy(copy, buf, len);
-	avlc_decoder_queue_push(metadata, octet_string_new(copy, len), flags);
+static void *burst_decoder_thread(void *arg) {
+	ASSERT(arg != NULL);
+	burst_decoder_t *d = arg;
+	vdl2_burst_t *b = NULL;
+	while(1) {
+		b = g_async_queue_pop(d->q);
+		if(b->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			XFREE(b);
+			break;
+		}
+		decode_burst_data(b, d->scratch);
+		bitstream_reset(b->bs);
+		pool_put(&burst_pool, b);
+	}
+	return NULL;
+}
+
+// Hands over the data part of the burst to the decoder thread serving the channel.
+// Bursts from a single channel are always decoded by the same thread, so frames
+// reach the AVLC decoder in the order of reception.
+static void burst_decoder_push(vdl2_channel_t *v) {
+	int const n = __atomic_load_n(&num_burst_decoders, __ATOMIC_ACQUIRE);
+	if(n == 0) {
+		// Decoders are shut down - drop the burst
+		debug_print(D_BURST, "burst decoders are not running, dropping burst\n");
+		return;
+	}
+	vdl2_burst_t *b = pool_get(&burst_pool);
+	if(b == NULL) {
+		b = XCALLOC(1, sizeof(vdl2_burst_t));
+		b->bs = bitstream_init(BSLEN);
+		statsd_increment_per_channel(v->freq, "decoder.allocs");
+	}
+	// hand over the filled bit stream, take an empty one in exchange
+	bitstream_t *bs = b->bs;
+	b->bs = v->bs;
+	v->bs = bs;
+	b->burst_timestamp = v->burst_timestamp;
+	b->frame_pwr = v->frame_pwr;
+	b->mag_nf = v->mag_nf;
+	b->ppm_error = v->ppm_error;
+	b->freq = v->freq;
+	b->datalen = v->datalen;
+	b->datalen_octets = v->datalen_octets;
+	b->last_block_len_octets = v->last_block_len_octets;
+	b->fec_octets = v->fec_octets;
+	b->num_blocks = v->num_blocks;
+	b->syndrome = v->syndrome;
+	b->lfsr_pos = v->lfsr_pos;
+	b->flags = 0;
+	g_async_queue_push(burst_decoders[v->burst_decoder % n].q, b);
 }
 
 void decode_vdl2_burst(vdl2_channel_t *v) {
 	switch(v->decoder_state) {
 		case DEC_HEADER:
-			v->lfsr = LFSR_IV;
-			bitstream_descramble(v->bs, &v->lfsr);
+			v->lfsr_pos = 0;
+			bitstream_descramble(v->bs, &v->lfsr_pos);
 			uint32_t header;
 			if(bitstream_read_word_msbfirst(v->bs, &header, HEADER_LEN) < 0) {
 				debug_print(D_BURST, "Could not read header from bitstream\n");
@@ -257,124 +636,7 @@ void decode_vdl2_burst(vdl2_channel_t *v) {
 			v->decoder_state = DEC_DATA;
 			return;
 		case DEC_DATA:
-#ifdef WITH_STATSD
-			gettimeofday(&v->tstart, NULL);
-#endif
-			bitstream_descramble(v->bs, &v->lfsr);
-			uint8_t *data = XCALLOC(v->datalen_octets, sizeof(uint8_t));
-			uint8_t *fec = XCALLOC(v->fec_octets, sizeof(uint8_t));
-			if(bitstream_read_lsbfirst(v->bs, data, v->datalen_octets, 8) < 0) {
-				debug_print(D_BURST, "Frame data truncated\n");
-				statsd_increment_per_channel(v->freq, "decoder.errors.data_truncated");
-				goto cleanup;
-			}
-			if(bitstream_read_lsbfirst(v->bs, fec, v->fec_octets, 8) < 0) {
-				debug_print(D_BURST, "FEC data truncated\n");
-				statsd_increment_per_channel(v->freq, "decoder.errors.fec_truncated");
-				goto cleanup;
-			}
-			debug_print_buf_hex(D_BURST_DETAIL, data, v->datalen_octets, "Data:\n");
-			debug_print_buf_hex(D_BURST_DETAIL, fec, v->fec_octets, "FEC:\n") ;
-			{
-				uint8_t rs_tab[v->num_blocks][RS_N];
-				memset(rs_tab, 0, sizeof(uint8_t[v->num_blocks][RS_N]));
-				int ret;
-				if((ret = deinterleave(data, v->datalen_octets, v->num_blocks, RS_N, rs_tab, RS_K, 0)) < 0) {
-					debug_print(D_BURST, "Deinterleaver failed with error %d\n", ret);
-					statsd_increment_per_channel(v->freq, "decoder.errors.deinterleave_data");
-					goto cleanup;
-				}
-
-				// if last block is < 3 bytes long, no FEC is done on it, so we should not write FEC bytes into the last row
-				uint32_t fec_rows = v->num_blocks;
-				if(get_fec_octetcount(v->last_block_len_octets) == 0)
-					fec_rows--;
-
-				if((ret = deinterleave(fec, v->fec_octets, fec_rows, RS_N, rs_tab, RS_N - RS_K, RS_K)) < 0) {
-					debug_print(D_BURST, "Deinterleaver failed with error %d\n", ret);
-					statsd_increment_per_channel(v->freq, "decoder.errors.deinterleave_fec");
-					goto cleanup;
-				}
-#ifdef DEBUG
-				debug_print(D_BURST_DETAIL, "Deinterleaved blocks:\n");
-				for(uint32_t r = 0; r < v->num_blocks; r++) {
-					debug_print_buf_hex(D_BURST_DETAIL, rs_tab[r], RS_N, "Block %d:\n", r);
-				}
-#endif
-				bitstream_reset(v->bs);
-				for(uint32_t r = 0; r < v->num_blocks; r++) {
-					statsd_increment_per_channel(v->freq, "decoder.blocks.processed");
-					int num_fec_octets = RS_N - RS_K;   // full block
-					if(r == v->num_blocks - 1) {        // final, partial block
-						num_fec_octets = get_fec_octetcount(v->last_block_len_octets);
-					}
-					ret = rs_verify((uint8_t *)&rs_tab[r], num_fec_octets);
-					debug_print(D_BURST, "Block %d FEC: %d\n", r, ret);
-					if(ret < 0) {
-						debug_print(D_BURST, "FEC check failed\n");
-						statsd_increment_per_channel(v->freq, "decoder.errors.fec_bad");
-						goto cleanup;
-					} else {
-						statsd_increment_per_channel(v->freq, "decoder.blocks.fec_ok");
-						if(ret > 0) {
-							debug_print_buf_hex(D_BURST_DETAIL, rs_tab[r], RS_N, "Corrected block %d:\n", r);
-							// count corrected octets, excluding intended erasures
-							v->num_fec_corrections += ret - (RS_N - RS_K - num_fec_octets);
-						}
-					}
-					if(r != v->num_blocks - 1)
-						ret = bitstream_append_lsbfirst(v->bs, (uint8_t *)&rs_tab[r], RS_K, 8);
-					else
-						ret = bitstream_append_lsbfirst(v->bs, (uint8_t *)&rs_tab[r], v->last_block_len_octets, 8);
-					if(ret < 0) {
-						debug_print(D_BURST, "bitstream_append_lsbfirst failed\n");
-						statsd_increment_per_channel(v->freq, "decoder.errors.bitstream");
-						goto cleanup;
-					}
-				}
-			}
-			// bitstream_append_lsbfirst() reads whole bytes, but datalen usually isn't a multiple
-			// of 8 due to bit stuffing, so we need to truncate the padding bits from the end of the bit stream.
-			if(v->datalen < v->bs->end - v->bs->start) {
-				debug_print(D_BURST, "Cut last %u bits from bitstream, bs->end was %u now is %u\n",
-						v->bs->end - v->bs->start - v->datalen, v->bs->end, v->datalen);
-				v->bs->end = v->datalen;
-			}
-			int ret;
-			int frame_cnt = 0;
-			while((ret = bitstream_copy_next_frame(v->bs, v->frame_bs)) >= 0) {
-				if((v->frame_bs->end - v->frame_bs->start) % 8 != 0) {
-					debug_print(D_BURST, "Frame %d: Bit stream error: does not end on a byte boundary\n", frame_cnt);
-					statsd_increment_per_channel(v->freq, "decoder.errors.truncated_octets");
-					goto cleanup;
-				}
-				debug_print(D_BURST, "Frame %d: Stream OK after unstuffing, length is %u octets\n",
-						frame_cnt, (v->frame_bs->end - v->frame_bs->start) / 8);
-				uint32_t frame_len_octets = (v->frame_bs->end - v->frame_bs->start) / 8;
-				memset(data, 0, frame_len_octets * sizeof(uint8_t));
-				if(bitstream_read_lsbfirst(v->frame_bs, data, frame_len_octets, 8) < 0) {
-					debug_print(D_BURST, "Frame %d: bitstream_read_lsbfirst failed\n", frame_cnt);
-					statsd_increment_per_channel(v->freq, "decoder.errors.bitstream");
-					goto cleanup;
-				}
-				statsd_increment_per_channel(v->freq, "decoder.msg.good");
-				decode_frame(v, frame_cnt, data, frame_len_octets);
-				frame_cnt++;
-				if(ret == 0) { // this was the last frame in this burst
-					break;
-				}
-			}
-			if(ret < 0) {
-				statsd_increment_per_channel(v->freq, "decoder.errors.unstuff");
-				goto cleanup;
-			}
-			statsd_timing_delta_per_channel(v->freq, "decoder.msg.processing_time", v->tstart);
-			if(v->frame_pwr > 1.0F) {	// check for log(v->frame_power) > 0dBFs
-				statsd_increment_per_channel(v->freq, "decoder.msg.good_loud");
-			}
-cleanup:
-			XFREE(data);
-			XFREE(fec);
+			burst_decoder_push(v);
 			v->decoder_state = DEC_IDLE;
 			debug_print(D_BURST, "DEC_IDLE\n");
 			return;
@@ -383,51 +645,112 @@ cleanup:
 	}
 }
 
-static void output_queue_push(void *data, void *ctx) {
-	ASSERT(data != NULL);
-	ASSERT(ctx != NULL);
-	output_instance_t *output = data;
-	output_qentry_t *qentry = ctx;
-
-	bool overflow = (Config.output_queue_hwm != OUTPUT_QUEUE_HWM_NONE &&
-			g_async_queue_length(output->ctx->q) >= Config.output_queue_hwm);
-	bool active = output->ctx->active;
-	if(qentry->flags & OUT_FLAG_ORDERED_SHUTDOWN || (active && !overflow)) {
-		output_qentry_t *copy = output_qentry_copy(qentry);
-		g_async_queue_push(output->ctx->q, copy);
-		debug_print(D_OUTPUT, "dispatched %s output %p\n", output->td->name, output);
+static void shutdown_outputs(la_list *fmtr_list) {
+	fmtr_instance_t *fmtr = NULL;
+	for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
+		fmtr = (fmtr_instance_t *)(p->data);
+		output_qentry_t *qentry = output_qentry_new(NULL, NULL, OFMT_UNKNOWN, OUT_FLAG_ORDERED_SHUTDOWN);
+		la_list_foreach(fmtr->outputs, output_queue_push, qentry);
+		output_qentry_release(qentry);
+	}
+}
+
+static void pending_output_flush(void *data, void *ctx) {
+	UNUSED(ctx);
+	pending_output_t *p = data;
+	la_list_foreach(p->outputs, output_queue_push, p->qentry);
+	output_qentry_release(p->qentry);
+	XFREE(p);
+}
+
+// Appends outputs of a completed frame to the ready list in constant time
+// (must be called with reseq.mutex held)
+static void reseq_ready_append(la_list *outputs) {
+	if(reseq.ready == NULL) {
+		reseq.ready = reseq.ready_tail = la_list_append(NULL, outputs);
 	} else {
-		if(overflow) {
-			fprintf(stderr, "%s output queue overflow, throttling\n", output->td->name);
-		} else if(!active) {
-			debug_print(D_OUTPUT, "%s output %p is inactive, skipping\n", output->td->name, output);
+		reseq.ready_tail = la_list_next(la_list_append(reseq.ready_tail, outputs));
+	}
+}
+
+// Stores outputs of the frame with the given sequence number and passes
+// all frames which are now complete in receive order to outputs
+static void reseq_complete(uint64_t seq, la_list *outputs) {
+	pthread_mutex_lock(&reseq.mutex);
+	ASSERT(seq - reseq.next <= reseq.mask);
+	ASSERT(!reseq.done[seq & reseq.mask]);
+	reseq.outputs[seq & reseq.mask] = outputs;
+	reseq.done[seq & reseq.mask] = true;
+	uint64_t idx, next = reseq.next;
+	while(reseq.done[idx = next & reseq.mask]) {
+		if(reseq.outputs[idx] != NULL) {
+			reseq_ready_append(reseq.outputs[idx]);
+		}
+		reseq.outputs[idx] = NULL;
+		reseq.done[idx] = false;
+		next++;
+	}
+	if(next != reseq.next) {
+		__atomic_store_n(&reseq.next, next, __ATOMIC_RELEASE);
+		if(reseq.waiting > 0) {
+			pthread_cond_broadcast(&reseq.slot_freed);
+		}
+	}
+	if(reseq.flushing) {
+		// The flushing thread will pass our frames to outputs after its current batch
+		pthread_mutex_unlock(&reseq.mutex);
+		return;
+	}
+	reseq.flushing = true;
+	while(reseq.ready != NULL) {
+		la_list *ready = reseq.ready;
+		reseq.ready = reseq.ready_tail = NULL;
+		pthread_mutex_unlock(&reseq.mutex);
+		for(la_list *l = ready; l != NULL; l = la_list_next(l)) {
+			la_list_foreach(l->data, pending_output_flush, NULL);
+			la_list_free(l->data);
 		}
+		la_list_free(ready);
+		pthread_mutex_lock(&reseq.mutex);
 	}
+	reseq.flushing = false;
+	pthread_mutex_unlock(&reseq.mutex);
 }
 
-static void shutdown_outputs(la_list *fmtr_list) {
-	fmtr_instance_t *fmtr = NULL;
-	for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
-		fmtr = (fmtr_instance_t *)(p->data);
-		output_qentry_t qentry = {
-			.msg = NULL,
-			.metadata = NULL,
-			.format = OFMT_UNKNOWN,
-			.flags = OUT_FLAG_ORDERED_SHUTDOWN
-		};
-		la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
+// Passes the entry to outputs. Takes over the caller's reference.
+static void avlc_decoder_output(avlc_decoder_t *d, la_list *outputs, output_qentry_t *qentry) {
+	if(ordered_output) {
+		NEW(pending_output_t, p);
+		p->outputs = outputs;
+		p->qentry = qentry;
+		d->pending = la_list_append(d->pending, p);
+	} else {
+		la_list_foreach(outputs, output_queue_push, qentry);
+		output_qentry_release(qentry);
+	}
+}
+
+static void avlc_decoder_update_stats() {
+	size_t depth = 0, high_water = 0;
+	for(int i = 0; i < num_avlc_decoders; i++) {
+		depth += mpsc_queue_depth(avlc_decoders[i].q);
+		size_t const hw = mpsc_queue_high_water(avlc_decoders[i].q);
+		if(hw > high_water) {
+			high_water = hw;
+		}
 	}
+	statsd_set("avlc.queue.depth", depth);
+	statsd_set("avlc.queue.high_water", high_water);
 }
 
-void *avlc_decoder_thread(void *arg) {
+static void *avlc_decoder_thread(void *arg) {
 	ASSERT(arg != NULL);
-	la_list *fmtr_list = arg;
+	avlc_decoder_t *d = arg;
+	la_list *fmtr_list = avlc_fmtr_list;
 	avlc_frame_qentry_t *q = NULL;
 	la_proto_node *root = NULL;
 	uint32_t msg_type = 0;
 
-	decoder_thread_active = true;
-
 // Currently there are two reassembly engine implementations:
 // - based on fragment offsets (in dumpvdl2, used only for CLNP)
 // - based on sequence numbers (in libacars, used for all other protocols)
@@ -452,84 +775,150 @@ void *avlc_decoder_thread(void *arg) {
 		DEC_SUCCESS,
 		DEC_FAILURE
 	} decoding_status;
+	void *batch[AVLC_DECODER_BATCH];
 	while(1) {
-		q = g_async_queue_pop(avlc_decoder_queue);
-
-		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
-			fprintf(stderr, "Shutting down decoder thread\n");
-			shutdown_outputs(fmtr_list);
-			decoder_thread_active = false;
-			return NULL;
-		}
+		size_t const num_entries = mpsc_queue_pop_batch(d->q, batch, AVLC_DECODER_BATCH);
+		avlc_decoder_update_stats();
+		for(size_t i = 0; i < num_entries; i++) {
+			q = batch[i];
+			if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+				XFREE(q);
+				ac_data_thread_destroy();
+				// The last thread to finish shuts down the outputs
+				if(__atomic_sub_fetch(&active_avlc_decoders, 1, __ATOMIC_ACQ_REL) == 0) {
+					fprintf(stderr, "Shutting down decoder thread\n");
+					shutdown_outputs(fmtr_list);
+					decoder_thread_active = false;
+				}
+				return NULL;
+			}
 
-		ASSERT(q->metadata != NULL);
-		statsd_increment_per_channel(q->metadata->freq, "avlc.frames.processed");
-
-		fmtr_instance_t *fmtr = NULL;
-		decoding_status = DEC_NOT_DONE;
-		for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
-			fmtr = p->data;
-			if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
-				// Decode the frame unless we've done it before
-				if(decoding_status == DEC_NOT_DONE) {
-					msg_type = 0;
-					root = avlc_parse(q, &msg_type, &rcontexts);
-					if(root != NULL) {
-						decoding_status = DEC_SUCCESS;
-					} else {
-						decoding_status = DEC_FAILURE;
-						la_proto_tree_destroy(root);
-						root = NULL;
+			ASSERT(q->metadata != NULL);
+			statsd_increment_per_channel(q->metadata->freq, "avlc.frames.processed");
+
+			fmtr_instance_t *fmtr = NULL;
+			decoding_status = DEC_NOT_DONE;
+			for(la_list *p = fmtr_list; p != NULL; p = la_list_next(p)) {
+				fmtr = p->data;
+				if(fmtr->intype == FMTR_INTYPE_DECODED_FRAME) {
+					// Decode the frame unless we've done it before
+					if(decoding_status == DEC_NOT_DONE) {
+						msg_type = 0;
+						root = avlc_parse(q, &msg_type, &rcontexts);
+						if(root != NULL) {
+							decoding_status = DEC_SUCCESS;
+						} else {
+							decoding_status = DEC_FAILURE;
+							la_proto_tree_destroy(root);
+							root = NULL;
+						}
 					}
-				}
-				if(decoding_status == DEC_SUCCESS) {
-					if((msg_type & Config.msg_filter) == msg_type) {
-						debug_print(D_OUTPUT, "msg_type: %x msg_filter: %x (accepted)\n", msg_type, Config.msg_filter);
-						octet_string_t *serialized_msg = fmtr->td->format_decoded_msg(q->metadata, root);
-						// First check if the formatter actually returned something.
-						// A formatter might be suitable only for a particular message type. If this is the case.
-						// it will return NULL for all messages it cannot handle.
-						// An example is pp_acars which only deals with ACARS messages.
-						if(serialized_msg != NULL) {
-							output_qentry_t qentry = {
-								.msg = serialized_msg,
-								.metadata = q->metadata,
-								.format = fmtr->td->output_format
-							};
-							la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-							// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-							octet_string_destroy(serialized_msg);
+					if(decoding_status == DEC_SUCCESS) {
+						if((msg_type & Config.msg_filter) == msg_type) {
+							debug_print(D_OUTPUT, "msg_type: %x msg_filter: %x (accepted)\n", msg_type, Config.msg_filter);
+							octet_string_t *serialized_msg = fmtr->td->format_decoded_msg(q->metadata, root);
+							// First check if the formatter actually returned something.
+							// A formatter might be suitable only for a particular message type. If this is the case.
+							// it will return NULL for all messages it cannot handle.
+							// An example is pp_acars which only deals with ACARS messages.
+							if(serialized_msg != NULL) {
+								// All outputs share the same entry, which now owns serialized_msg
+								avlc_decoder_output(d, fmtr->outputs, output_qentry_new(serialized_msg,
+											q->metadata, fmtr->td->output_format, 0));
+							}
+						} else {
+							debug_print(D_OUTPUT, "msg_type: %x msg_filter: %x (filtered out)\n", msg_type, Config.msg_filter);
 						}
-					} else {
-						debug_print(D_OUTPUT, "msg_type: %x msg_filter: %x (filtered out)\n", msg_type, Config.msg_filter);
+					}
+				} else if(fmtr->intype == FMTR_INTYPE_RAW_FRAME) {
+					octet_string_t *serialized_msg = fmtr->td->format_raw_msg(q->metadata, q->frame);
+					if(serialized_msg != NULL) {
+						avlc_decoder_output(d, fmtr->outputs, output_qentry_new(serialized_msg,
+									q->metadata, fmtr->td->output_format, 0));
 					}
 				}
-			} else if(fmtr->intype == FMTR_INTYPE_RAW_FRAME) {
-				octet_string_t *serialized_msg = fmtr->td->format_raw_msg(q->metadata, q->frame);
-				if(serialized_msg != NULL) {
-					output_qentry_t qentry = {
-						.msg = serialized_msg,
-						.metadata = q->metadata,
-						.format = fmtr->td->output_format
-					};
-					la_list_foreach(fmtr->outputs, output_queue_push, &qentry);
-					// output_queue_push makes a copy of serialized_msg, so it's safe to free it now
-					octet_string_destroy(serialized_msg);
-				}
+			}
+			la_proto_tree_destroy(root);
+			root = NULL;
+			if(ordered_output) {
+				// Frames which produced no output must complete too
+				reseq_complete(q->seq, d->pending);
+				d->pending = NULL;
+			}
+			if(q->flags & AVLC_FLAG_POOLED) {
+				avlc_frame_slot_release(q);
+			} else {
+				octet_string_destroy(q->frame);
+				XFREE(q->metadata);
+				XFREE(q);
 			}
 		}
-		la_proto_tree_destroy(root);
-		root = NULL;
-		octet_string_destroy(q->frame);
-		XFREE(q->metadata);
-		XFREE(q);
 	}
 }
 
-void avlc_decoder_init() {
-	avlc_decoder_queue = g_async_queue_new();
+void avlc_decoder_init(la_list *fmtr_list, int num_threads, bool reorder) {
+	ASSERT(num_threads > 0);
+	avlc_fmtr_list = fmtr_list;
+	num_avlc_decoders = active_avlc_decoders = num_threads;
+	avlc_decoders = XCALLOC(num_avlc_decoders, sizeof(avlc_decoder_t));
+	// Reordering is only needed when frames are decoded concurrently
+	ordered_output = reorder && num_avlc_decoders > 1;
+	if(ordered_output) {
+		// Room for all frames which may be queued at once. When some decoder
+		// stalls, dispatchers wait in reseq_slot_wait() for a free slot.
+		size_t len = 1;
+		while(len < 2 * (size_t)num_avlc_decoders * (AVLC_QUEUE_LEN + AVLC_DECODER_BATCH)) {
+			len <<= 1;
+		}
+		reseq.outputs = XCALLOC(len, sizeof(la_list *));
+		reseq.done = XCALLOC(len, sizeof(bool));
+		reseq.mask = len - 1;
+	}
+	decoder_thread_active = true;
+	for(int i = 0; i < num_avlc_decoders; i++) {
+		avlc_decoders[i].q = mpsc_queue_new(AVLC_QUEUE_LEN);
+		start_thread(&avlc_decoders[i].thread, avlc_decoder_thread, &avlc_decoders[i]);
+	}
+	fprintf(stderr, "Using %d AVLC decoder thread(s)%s\n", num_avlc_decoders,
+			ordered_output ? ", output in receive order" : "");
+}
+
+void burst_decoder_init(vdl2_state_t *ctx, int num_threads) {
+	ASSERT(ctx != NULL);
+	ASSERT(num_threads > 0);
+	num_burst_decoders = num_threads;
+	burst_decoders = XCALLOC(num_burst_decoders, sizeof(burst_decoder_t));
+	bitstream_descrambler_init(LFSR_IV);
+	bitstream_unstuffer_init();
+	for(int i = 0; i < ctx->num_channels; i++) {
+		ctx->channels[i]->burst_decoder = i % num_burst_decoders;
+	}
+	for(int i = 0; i < num_burst_decoders; i++) {
+		burst_decoders[i].q = g_async_queue_new();
+		burst_decoders[i].scratch = XCALLOC(1, sizeof(burst_scratch_t));
+		start_thread(&burst_decoders[i].thread, burst_decoder_thread, &burst_decoders[i]);
+	}
+	fprintf(stderr, "Using %d burst decoder thread(s)\n", num_burst_decoders);
 }
 
+// Waits until all queued bursts are decoded and stops the burst decoder threads
+void burst_decoder_shutdown() {
+	for(int i = 0; i < num_burst_decoders; i++) {
+		NEW(vdl2_burst_t, b);
+		b->flags = OUT_FLAG_ORDERED_SHUTDOWN;
+		g_async_queue_push(burst_decoders[i].q, b);
+	}
+	for(int i = 0; i < num_burst_decoders; i++) {
+		pthread_join(burst_decoders[i].thread, NULL);
+	}
+	__atomic_store_n(&num_burst_decoders, 0, __ATOMIC_RELEASE);
+}
+
+// Each AVLC decoder thread exits after decoding all frames queued before
 void avlc_decoder_shutdown() {
-	avlc_decoder_queue_push(NULL, NULL, OUT_FLAG_ORDERED_SHUTDOWN);
+	for(int i = 0; i < num_avlc_decoders; i++) {
+		NEW(avlc_frame_qentry_t, q);
+		q->flags = OUT_FLAG_ORDERED_SHUTDOWN;
+		mpsc_queue_push(avlc_decoders[i].q, q);
+	}
 }
@@ -25,8 +25,9 @@
 
 extern bool decoder_thread_active;
 void decode_vdl2_burst(vdl2_channel_t *v);
-void avlc_decoder_init();
-void *avlc_decoder_thread(void *arg);
+void burst_decoder_init(vdl2_state_t *ctx, int num_threads);
+void burst_decoder_shutdown();
+void avlc_decoder_init(la_list *fmtr_list, int num_threads, bool reorder);
 void avlc_decoder_shutdown();
 void avlc_decoder_queue_push(vdl2_msg_metadata *metadata, octet_string_t *frame, int flags);
 
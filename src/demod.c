@@ -20,23 +20,24 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>           // PRIu64
 #include <stdlib.h>             // calloc
-#include <math.h>               // sincosf, hypotf, atan2
+#include <math.h>               // roundf, fminf, powf, M_PI
+#include <stdatomic.h>
 #include <string.h>             // memset
 #include <sys/time.h>           // gettimeofday
-#include "config.h"
-#ifdef HAVE_PTHREAD_BARRIERS
-#include <pthread.h>            // pthread_barrier_wait
-#else
-#include "pthread_barrier.h"
-#endif
+#include <time.h>               // time
 #include "chebyshev.h"          // chebyshev_lpf_init
+#include "channelizer.h"        // channelizer_*
 #include "decode.h"             // decode_vdl2_burst
+#include "dsp.h"                // dsp
 #include "dumpvdl2.h"
+#include "sample_ring.h"        // sample_ring_*
 
-#define BSLEN 32768UL
 #define PHERR_MAX 1000.f        // initial value for frame sync error (read: high)
-#define SYNC_SKIP 3             // attempt frame sync every SYNC_SKIP samples (to reduce CPU usage)
+#define SYNC_SKIP 1             // attempt frame sync every SYNC_SKIP samples
+#define SYNC_HOLDOFF 3          // declare sync when the error metric has not improved for SYNC_HOLDOFF attempts
+#define NF_SKIP 3               // update noise floor estimate every NF_SKIP samples
 #define SYNC_THRESHOLD 4.f      // assume we got frame sync if phase error is less than this threshold
 #define ARITY 8
 #define MAG_LP 0.9f
@@ -46,52 +47,119 @@
 #define INP_LPF_RIPPLE_PERCENT 0.5f
 // do not change this; filtering routine is currently hardcoded to 2 poles to minimize CPU usage
 #define INP_LPF_NPOLES 2
+// CIC decimator front end constants
+#define CIC_ORDER 3
+#define CIC_INPUT_SCALE 1048576.0f      // input samples are converted to 20-bit integers
+#define CIC_LPF_TAPS 24                 // truncated impulse response of the channel lowpass filter
+#define CIC_FIR_LEN (CIC_LPF_TAPS + 2)  // convolved with a 3-tap CIC droop compensator
+// number of input samples processed in one pass by the per-channel front ends
+#define DEMOD_CHUNK_LEN 1024
+// report squelch statistics every SQUELCH_STATS_SAMPLES channel samples
+#define SQUELCH_STATS_SAMPLES (1 << 20)
+// minimum interval between "sample blocks dropped" warnings (seconds)
+#define INPUT_DROP_WARN_INTERVAL 10
 
-float *sbuf;
 static float *levels;
-static float sin_lut[257], cos_lut[257];
-static uint32_t sbuf_len;
+// Sample blocks passed from the input thread to demodulators
+static sample_ring_t *input_ring;
+// Conversion buffer for the FFT front end, where demodulators
+// get the spectra only (used by the input thread only)
+static float *sbuf;
+static uint32_t sbuf_capacity;
+static uint64_t input_blocks_dropped;
 // filter coefficients
 static float *A = NULL, *B = NULL;
+// CIC front end compensating FIR coefficients and output scaling factor
+static float cic_fir[CIC_FIR_LEN];
+static float cic_scale;
+
+// CIC decimator state. Integrators and combs use modular arithmetic,
+// so wrap-arounds in the integrators cancel out in the combs.
+typedef struct {
+	uint64_t integ_re[CIC_ORDER], integ_im[CIC_ORDER];
+	uint64_t comb_re[CIC_ORDER], comb_im[CIC_ORDER];
+	// FIR delay lines are stored twice to avoid wrapping the index
+	float fir_re[2 * CIC_FIR_LEN], fir_im[2 * CIC_FIR_LEN];
+	int fir_pos;
+	int cnt;
+} cic_state_t;
+
+// 2-pole IIR lowpass filter state
+typedef struct {
+	float x1_re, x2_re, y1_re, y2_re;
+	float x1_im, x2_im, y1_im, y2_im;
+	int cnt;
+} iir_state_t;
+
+// Working buffers
+typedef struct {
+	float re[DEMOD_CHUNK_LEN], im[DEMOD_CHUNK_LEN];             // downmixed input samples
+	float out_re[DEMOD_CHUNK_LEN], out_im[DEMOD_CHUNK_LEN];     // decimated channel samples
+	float phase[DEMOD_CHUNK_LEN], mag[DEMOD_CHUNK_LEN];
+} demod_buffers_t;
+
+// Per-channel front end state. Demodulator workers take the busy flag
+// before touching the channel, so that the channel is never processed
+// by more than one worker at a time.
+struct demod_frontend {
+	demod_buffers_t buf;
+	iir_state_t iir;
+	cic_state_t cic;
+	uint64_t input_seq;         // sequence number of the next sample block to process
+	atomic_bool busy;
+};
+
+// Compute the first len samples of the impulse response of a 2-pole IIR filter
+static void lpf_2pole_impulse_response(float const *a, float const *b, float *h, uint32_t len) {
+	float in[3] = { 1.0f, 0.0f, 0.0f }, out[3] = { 0.0f, 0.0f, 0.0f };
+	for(uint32_t i = 0; i < len; i++) {
+		out[0] = a[0] * in[0] + a[1] * in[1] + a[2] * in[2] + b[1] * out[1] + b[2] * out[2];
+		h[i] = out[0];
+		out[2] = out[1]; out[1] = out[0];
+		in[2] = in[1]; in[1] = in[0]; in[0] = 0.0f;
+	}
+}
 
-// phi range must be (0..1), rescaled to 0x0-0xFFFFFF
-static void sincosf_lut(uint32_t phi, float *sine, float *cosine) {
-	float v1, v2, fract;
-	uint32_t idx;
-	// get LUT index
-	idx = phi >> 16;
-	// cast fixed point fraction to float
-	fract = (float)(phi & 0xffff) / 65536.0f;
-	// get two adjacent values from LUT and interpolate
-	v1 = sin_lut[idx];
-	v2 = sin_lut[idx+1];
-	*sine = v1 + (v2 - v1) * fract;
-	v1 = cos_lut[idx];
-	v2 = cos_lut[idx+1];
-	*cosine = v1 + (v2 - v1) * fract;
-}
-
-static float chebyshev_lpf_2pole(float const *in, float const *out) {
-	float r = A[0] * in[0];
-	r += A[1] * in[1] + A[2] * in[2];
-	r += B[1] * out[1] + B[2] * out[2];
-	return r;
-}
-
-static float lr_X[PREAMBLE_SYMS];
-static float lr_denom;
+// Cumulative phase after each symbol of VDL2 preamble, wrapped to (-pi; pi> range
+static float const pr_phase[PREAMBLE_SYMS] = {
+	0 * M_PI / 4,
+	3 * M_PI / 4,
+	-3 * M_PI / 4,
+	1 * M_PI / 4,
+	1 * M_PI / 4,
+	2 * M_PI / 4,
+	0 * M_PI / 4,
+	4 * M_PI / 4,
+	-3 * M_PI / 4,
+	4 * M_PI / 4,
+	-2 * M_PI / 4,
+	3 * M_PI / 4,
+	1 * M_PI / 4,
+	-2 * M_PI / 4,
+	-3 * M_PI / 4,
+	0 * M_PI / 4
+};
+
+// Phase increments between consecutive preamble symbols
+static float pr_dphase[PREAMBLE_SYMS];
+// Linear regression constants for the first n points (n = 1..PREAMBLE_SYMS)
+// where x(i) = i: mean(x), 1/n and sum((x(i) - mean(x))^2)
+static float lr_mean_x[PREAMBLE_SYMS + 1];
+static float lr_inv_n[PREAMBLE_SYMS + 1];
+static float lr_denom[PREAMBLE_SYMS + 1];
 
 void demod_sync_init() {
-	// pre-compute linear regression constants
-	float mean_X = 0.f;
-	lr_denom = 0.f;
-	for(int i = 0; i < PREAMBLE_SYMS; i++) {
-		mean_X += i;
+	for(int i = 1; i < PREAMBLE_SYMS; i++) {
+		pr_dphase[i] = pr_phase[i] - pr_phase[i - 1];
 	}
-	mean_X /= PREAMBLE_SYMS;
-	for(int i = 0; i < PREAMBLE_SYMS; i++) {
-		lr_X[i] = i - mean_X;
-		lr_denom += (i - mean_X) * (i - mean_X);
+	for(int n = 1; n <= PREAMBLE_SYMS; n++) {
+		float const mean_x = (n - 1) / 2.0f;
+		lr_mean_x[n] = mean_x;
+		lr_inv_n[n] = 1.0f / n;
+		lr_denom[n] = 0.f;
+		for(int i = 0; i < n; i++) {
+			lr_denom[n] += (i - mean_x) * (i - mean_x);
+		}
 	}
 }
 
@@ -102,124 +170,143 @@ static float calc_para_vertex(float x, int d, float y1, float y2, float y3) {
 	return(-B / (2 * A));
 }
 
-static int got_sync(vdl2_channel_t *v) {
-	// Cumulative phase after each symbol of VDL2 preamble, wrapped to (-pi; pi> range
-	static float const pr_phase[PREAMBLE_SYMS] = {
-		0 * M_PI / 4,
-		3 * M_PI / 4,
-		-3 * M_PI / 4,
-		1 * M_PI / 4,
-		1 * M_PI / 4,
-		2 * M_PI / 4,
-		0 * M_PI / 4,
-		4 * M_PI / 4,
-		-3 * M_PI / 4,
-		4 * M_PI / 4,
-		-2 * M_PI / 4,
-		3 * M_PI / 4,
-		1 * M_PI / 4,
-		-2 * M_PI / 4,
-		-3 * M_PI / 4,
-		0 * M_PI / 4
-	};
-	// v->syncbuf stores phases (complex arguments) of previous PREAMBLE_SYMS * SPS samples.
-	// v->syncbufidx is the position of the last stored sample in the vector.
-	// Compute sync error as a vector of differences between each symbol phase and the expected phase of
-	// the respective preamble symbol.
-	float errvec[PREAMBLE_SYMS];
-	float errvec_mean = 0.f, unwrap = 0.f;
-	float prev_err = errvec_mean = errvec[0] = v->syncbuf[(v->syncbufidx + SPS) % SYNC_BUFLEN] - pr_phase[0];
+static void sync_reset(vdl2_channel_t *v) {
+	v->pherr[1] = PHERR_MAX;
+	v->sync_age = -1;
+}
+
+// Compute the frame sync error for the window of PREAMBLE_SYMS symbol-spaced phases.
+//
+// Sync error is a vector of differences between each symbol phase and the expected phase of
+// the respective preamble symbol. Its constant component (the starting phase of the preamble)
+// does not matter, so the vector is built from symbol-to-symbol phase increments, starting
+// from zero. Phase jumps larger than M_PI are removed on the way.
+//
+// If there is a non-zero frequency offset between transmitter and receiver, then error values
+// are not constant, but increasing or decreasing monotonically. This error is estimated with
+// a linear regression:
+// y=Ax+B
+// A = sum((x(i) - mean(x)) * (y(i) - mean(y))) / sum( (x(i) - mean(x))^2 )
+// The frame sync error is the sum of squared residuals of the regression:
+// sum((y(i) - mean(y))^2) - A * sum((x(i) - mean(x)) * (y(i) - mean(y)))
+// All sums are updated as the points are added, one at a time. Adding a point
+// never decreases the residual of the best fit, so the computation stops as
+// soon as the partial result reaches limit. This makes the evaluation cheap on
+// noise, which is what the detector sees most of the time.
+static float sync_error(float const *phase, float limit, float *freq_err) {
+	float err = 0.f, sum_y = 0.f, sum_yy = 0.f, sum_xy = 0.f;
+	float prev = phase[0];
 	for(int i = 1; i < PREAMBLE_SYMS; i++) {
-		float cur_err = v->syncbuf[(v->syncbufidx + (i + 1) * SPS) % SYNC_BUFLEN] - pr_phase[i];
-		float errdiff = cur_err - prev_err;
-		prev_err = cur_err;
-		// Remove phase jumps larger than M_PI
+		float const cur = phase[i * SPS];
+		float errdiff = cur - prev - pr_dphase[i];
+		prev = cur;
 		if(errdiff > M_PI) {
-			unwrap -= 2.0f * M_PI;
+			errdiff -= 2.0f * M_PI;
 		} else if(errdiff < -M_PI) {
-			unwrap += 2.0f * M_PI;
+			errdiff += 2.0f * M_PI;
+		}
+		err += errdiff;
+		sum_y += err;
+		sum_yy += err * err;
+		sum_xy += i * err;
+		int const n = i + 1;
+		float const cyy = sum_yy - sum_y * sum_y * lr_inv_n[n];
+		float const cxy = sum_xy - lr_mean_x[n] * sum_y;
+		// cyy - cxy^2 / lr_denom >= limit
+		if(cyy * lr_denom[n] - cxy * cxy >= limit * lr_denom[n] || n == PREAMBLE_SYMS) {
+			*freq_err = cxy / lr_denom[n];
+			return cyy - cxy * *freq_err;
 		}
-		errvec[i] = cur_err + unwrap;
-		errvec_mean += errvec[i];
-	}
-	errvec_mean /= PREAMBLE_SYMS;
-	// Starting phase of pr_phase is 0. If we have a sync with a preamble starting with phase of 0, then
-	// errvec is a string of close-to-zero values. If the starting phase is different, then phase
-	// increments between symbols are still preserved, so errvec is a string of a constant value, which
-	// we subtract to get a string of zeros.
-	for (int i = 0; i < PREAMBLE_SYMS; i++) {
-		errvec[i] -= errvec_mean;
 	}
-	// If there is a non-zero frequency offset between transmitter and receiver, then errvec values
-	// are not constant, but increasing or decreasing monotonically.
-	// In order to estimate this error, we apply a linear regression to errvec, according to:
-	// y=Ax+B
-	// A = sum((x(i) - mean(x)) * (y(i) - mean(y))) / sum( (x(i) - mean(x))^2 )
-	// lr_X = x(i) - mean(x) and lr_denom = sum( (x(i) - mean(x))^2 ) are precomputed in demod_sync_init().
+	return limit;       // not reached
+}
+
+static int got_sync(vdl2_channel_t *v) {
+	// v->syncbuf stores phases (complex arguments) of previous PREAMBLE_SYMS * SPS samples.
+	// v->syncbufidx is the position of the last stored sample in the vector. The vector is
+	// stored twice, so that the window of the last PREAMBLE_SYMS symbols is contiguous.
+	float const *phase = v->syncbuf + v->syncbufidx + SPS;
 	float freq_err = 0.f;
-	for(int i = 0; i < PREAMBLE_SYMS; i++) {
-		freq_err += lr_X[i] * errvec[i];
-	}
-	freq_err /= lr_denom;
-	// Compute new error vector with frequency correction applied
-	// and the overall frame sync error value
-	float err = 0.f;
-	v->pherr[0] = 0.f;
-	for(int i = 0; i < PREAMBLE_SYMS; i++) {
-		err = errvec[i] - freq_err * lr_X[i];
-		v->pherr[0] += err * err;
-	}
+	v->pherr[0] = sync_error(phase, SYNC_THRESHOLD, &freq_err);
 
-	if (v->pherr[1] < SYNC_THRESHOLD && v->pherr[0] > v->pherr[1]) {
-		// We have passed the minimum value of the error metric and we are below
-		// the threshold, so we have a successful sync.
-		// Approximate the last three error-squared values with a parabola and locate its vertex,
-		// which is the sync point, from where we start the symbol clock.
-		float vertex_x = calc_para_vertex(v->sclk, SYNC_SKIP, v->pherr[2], v->pherr[1], v->pherr[0]);
-		v->sclk = -roundf(vertex_x);
-		// Save phase at the sync point (v->sclk is negative, ie pointing at the past sample)
-		int sp = v->syncbufidx - v->sclk;
-		if(sp < 0) sp += SYNC_BUFLEN;
-		v->prev_phi = v->syncbuf[sp];
-		v->dphi = v->prev_dphi;
-		v->ppm_error = SYMBOL_RATE * v->dphi / (2.0f * M_PI * v->freq) * 1e+6;
-		debug_print(D_DEMOD, "Preamble found at %llu (pherr[2]=%f pherr[1]=%f pherr[0]=%f vertex_x=%f syncbufidx=%d, "
-				"syncpoint=%d syncpoint_phase=%f sclk=%d v->dphi=%f ppm=%f)\n",
-				v->samplenum - SYNC_SKIP, v->pherr[2], v->pherr[1], v->pherr[0], vertex_x, v->syncbufidx,
-				sp, v->prev_phi, v->sclk, v->dphi, v->ppm_error);
-		v->pherr[1] = v->pherr[2] = PHERR_MAX;
-		// ignore this preample if the ppm deviation is above the required threshold (if set)
-		return !(Config.max_ppm && fabsf(v->ppm_error) > Config.max_ppm);
+	// Sync error sampled this densely has some ripple on noisy signals, so the first
+	// local minimum below the threshold is not necessarily the right one. Remember
+	// the lowest value seen so far and declare sync if no better one comes up within
+	// SYNC_HOLDOFF attempts.
+	// Values at or above the threshold are not exact (see sync_error), so the neighbours
+	// of the minimum used for its interpolation are recomputed in full.
+	if(v->pherr[0] < SYNC_THRESHOLD && (v->sync_age < 0 || v->pherr[0] < v->pherr_min[1])) {
+		float unused;
+		v->pherr_min[0] = v->pherr[1] < SYNC_THRESHOLD || v->pherr[1] == PHERR_MAX ?
+			v->pherr[1] : sync_error(phase - SYNC_SKIP, INFINITY, &unused);
+		v->pherr_min[1] = v->pherr[0];
+		v->sync_dphi = freq_err;
+		v->sync_age = 0;
+	} else if(v->sync_age >= 0) {
+		v->sync_age++;
+		if(v->sync_age == 1) {
+			float unused;
+			v->pherr_min[2] = sync_error(phase, INFINITY, &unused);
+		}
+		if(v->sync_age == SYNC_HOLDOFF) {
+			// Approximate the error values around the minimum with a parabola and locate its vertex,
+			// which is the sync point, from where we start the symbol clock.
+			// The vertex position is relative to the sample following the minimum.
+			float vertex_x = calc_para_vertex(0, SYNC_SKIP, v->pherr_min[0], v->pherr_min[1], v->pherr_min[2]);
+			if(vertex_x < -2.0f * SYNC_SKIP || vertex_x > 0.0f || isnan(vertex_x)) {
+				vertex_x = -SYNC_SKIP;
+			}
+			// v->sclk is the number of samples elapsed since the sync point
+			v->sclk = roundf((v->sync_age - 1) * SYNC_SKIP - vertex_x);
+			// Save phase at the sync point
+			int sp = v->syncbufidx - v->sclk;
+			if(sp < 0) sp += SYNC_BUFLEN;
+			v->prev_phi = v->syncbuf[sp];
+			v->dphi = v->sync_dphi;
+			v->ppm_error = SYMBOL_RATE * v->dphi / (2.0f * M_PI * v->freq) * 1e+6;
+			debug_print(D_DEMOD, "Preamble found at %llu (pherr_min=%f/%f/%f vertex_x=%f syncbufidx=%d, "
+					"syncpoint=%d syncpoint_phase=%f sclk=%d v->dphi=%f ppm=%f)\n",
+					v->samplenum - v->sclk, v->pherr_min[0], v->pherr_min[1], v->pherr_min[2], vertex_x,
+					v->syncbufidx, sp, v->prev_phi, v->sclk, v->dphi, v->ppm_error);
+			sync_reset(v);
+			// ignore this preample if the ppm deviation is above the required threshold (if set)
+			return !(Config.max_ppm && fabsf(v->ppm_error) > Config.max_ppm);
+		}
 	}
-	v->pherr[2] = v->pherr[1];
 	v->pherr[1] = v->pherr[0];
-	v->prev_dphi = freq_err;
 	return 0;
 }
 
-static void multiply(float ar, float aj, float br, float bj, float *cr, float *cj) {
-	*cr = ar*br - aj*bj;
-	*cj = aj*br + ar*bj;
-}
-
 static void decoder_reset(vdl2_channel_t *v) {
 	v->decoder_state = DEC_HEADER;
 	v->requested_bits = HEADER_LEN;
-	v->num_fec_corrections = 0;
 	bitstream_reset(v->bs);
-	bitstream_reset(v->frame_bs);
 }
 
 static void demod_reset(vdl2_channel_t *v) {
 	decoder_reset(v);
 	v->sclk = 0;
 	v->demod_state = DM_INIT;
-	v->pherr[1] = v->pherr[2] = PHERR_MAX;
+	sync_reset(v);
 	v->frame_pwr = 0.f;
 	v->frame_pwr_cnt = 0;
 }
 
-static void demod(vdl2_channel_t *v, float re, float im) {
+// Update the noise floor estimate. Called every NF_SKIP samples.
+static void noise_floor_update(vdl2_channel_t *v, float mag) {
+	v->mag_lp = v->mag_lp * MAG_LP + mag * (1.0f - MAG_LP);
+	if(++v->nfcnt == 1000) {
+		v->nfcnt = 0;
+		// The initial estimate is way too high and it takes a while
+		// until it drops down to the actual noise level
+		if(v->mag_lp >= v->mag_nf) {
+			v->nf_settled = true;
+		}
+		v->mag_nf = NF_LP * v->mag_nf + (1.0f - NF_LP) * fminf(v->mag_lp, v->mag_nf) + 0.0001f;
+	}
+}
+
+static void demod(vdl2_channel_t *v, float re, float im, float phi, float mag) {
 	static uint8_t const graycode[ARITY] = { 0, 1, 3, 2, 6, 7, 5, 4 };
 
 	if(v->decoder_state == DEC_IDLE) {
@@ -229,18 +316,15 @@ static void demod(vdl2_channel_t *v, float re, float im) {
 	switch(v->demod_state) {
 		case DM_INIT:
 			v->syncbufidx++; v->syncbufidx %= SYNC_BUFLEN;
-			v->syncbuf[v->syncbufidx] = atan2(im, re);
+			v->syncbuf[v->syncbufidx] = v->syncbuf[v->syncbufidx + SYNC_BUFLEN] = phi;
+			if(++v->nfclk == NF_SKIP) {
+				v->nfclk = 0;
+				noise_floor_update(v, mag);
+			}
 			if(++v->sclk < SYNC_SKIP) {
 				return;
 			}
 			v->sclk = 0;
-			// update noise floor estimate
-			float mag = hypotf(re, im);
-			v->mag_lp = v->mag_lp * MAG_LP + mag * (1.0f - MAG_LP);
-			if(++v->nfcnt == 1000) {
-				v->nfcnt = 0;
-				v->mag_nf = NF_LP * v->mag_nf + (1.0f - NF_LP) * fminf(v->mag_lp, v->mag_nf) + 0.0001f;
-			}
 			if(got_sync(v)) {
 				statsd_increment_per_channel(v->freq, "demod.sync.good");
 				gettimeofday(&v->burst_timestamp, NULL);
@@ -253,7 +337,6 @@ static void demod(vdl2_channel_t *v, float re, float im) {
 				return;
 			}
 			v->sclk = 0;
-			float phi = atan2(im, re);
 			float dphi = phi - v->prev_phi - v->dphi;
 			if(dphi < 0) {
 				dphi += 2.0f * M_PI;
@@ -285,48 +368,225 @@ static void demod(vdl2_channel_t *v, float re, float im) {
 	}
 }
 
-void *process_samples(void *arg) {
-	int cnt = 0;
-	float cwf, swf;
-	float re[INP_LPF_NPOLES+1], im[INP_LPF_NPOLES+1];
-	float lp_re[INP_LPF_NPOLES+1], lp_im[INP_LPF_NPOLES+1];
-	vdl2_channel_t *v = arg;
-	v->samplenum = -1;
-	memset(lp_re, 0, sizeof(lp_re));
-	memset(lp_im, 0, sizeof(lp_im));
-	memset(re, 0, sizeof(re));
-	memset(im, 0, sizeof(im));
-	while(1) {
-		pthread_barrier_wait(&demods_ready);
-		pthread_barrier_wait(&samples_ready);
-		for(uint32_t i = 0; i < sbuf_len;) {
-			for(int k = INP_LPF_NPOLES; k > 0; k--) {
-				re[k] = re[k-1];
-				im[k] = im[k-1];
-				lp_re[k] = lp_re[k-1];
-				lp_im[k] = lp_im[k-1];
-			}
-			re[0] = sbuf[i++];
-			im[0] = sbuf[i++];
-			// downmix
-			if(v->offset_tuning) {
-				sincosf_lut(v->downmix_phi, &swf, &cwf);
-				multiply(re[0], im[0], cwf, swf, &re[0], &im[0]);
-				v->downmix_phi += v->downmix_dphi;
-				v->downmix_phi &= 0xffffff;
-			}
-			// lowpass IIR
-			lp_re[0] = chebyshev_lpf_2pole(re, lp_re);
-			lp_im[0] = chebyshev_lpf_2pole(im, lp_im);
-			// decimation
-			if(++cnt == v->oversample) {
-				cnt = 0;
+// Squelch.
+// Most of the time a VDL2 channel is idle, so computing sample phases and
+// searching for the preamble is a waste of CPU. While the squelch is closed,
+// only the noise floor estimate is updated and the samples are stored in
+// the look-behind buffer. When the signal level exceeds the noise floor by
+// Config.squelch_ratio, phases of the buffered samples are computed, so that
+// the preamble search sees the same history as if the squelch was not there.
+//
+// Processes the samples of the block starting from the first one until the
+// squelch opens. Returns the index of the first unprocessed sample.
+static uint32_t squelch_block(vdl2_channel_t *v, demod_buffers_t const *b, uint32_t n) {
+	float const threshold = v->mag_nf * Config.squelch_ratio;
+	for(uint32_t i = 0; i < n; i++) {
 #ifdef DEBUG
-				v->samplenum++;
+		v->samplenum++;
 #endif
-				demod(v, lp_re[0], lp_im[0]);
+		float const re = b->out_re[i], im = b->out_im[i];
+		v->syncbufidx++; v->syncbufidx %= SYNC_BUFLEN;
+		v->sq_hist_re[v->syncbufidx] = re;
+		v->sq_hist_im[v->syncbufidx] = im;
+		if(++v->nfclk < NF_SKIP) {
+			continue;
+		}
+		v->nfclk = 0;
+		noise_floor_update(v, sqrtf(re * re + im * im));
+		if(v->mag_lp > threshold) {
+			float mag[SYNC_BUFLEN];
+			dsp.phase_mag(v->sq_hist_re, v->sq_hist_im, v->syncbuf, mag, SYNC_BUFLEN);
+			memcpy(v->syncbuf + SYNC_BUFLEN, v->syncbuf, SYNC_BUFLEN * sizeof(float));
+			sync_reset(v);
+			v->squelch_closed = false;
+			v->squelch_gated += i + 1;
+			statsd_increment_per_channel(v->freq, "demod.squelch.opened");
+			debug_print(D_DEMOD_DETAIL, "%u: squelch open (mag_lp: %f mag_nf: %f)\n", v->freq, v->mag_lp, v->mag_nf);
+			return i + 1;
+		}
+	}
+	v->squelch_gated += n;
+	return n;
+}
+
+static void squelch_stats_update(vdl2_channel_t *v, uint32_t n) {
+	v->squelch_total += n;
+	if(v->squelch_total >= SQUELCH_STATS_SAMPLES) {
+		statsd_add_per_channel(v->freq, "demod.squelch.samples_gated", v->squelch_gated);
+		statsd_add_per_channel(v->freq, "demod.squelch.samples_total", v->squelch_total);
+		debug_print(D_DEMOD, "%u: squelch was closed for %.1f%% of samples\n", v->freq,
+				100.0f * (float)v->squelch_gated / (float)v->squelch_total);
+		v->squelch_gated = v->squelch_total = 0;
+	}
+}
+
+// Compute phases and magnitudes of n channel samples and run the demodulator over them
+static void demod_block(vdl2_channel_t *v, demod_buffers_t *b, uint32_t n) {
+	uint32_t i = 0;
+	bool const squelch = Config.squelch_ratio > 0.0f;
+	if(squelch && v->squelch_closed) {
+		i = squelch_block(v, b, n);
+	}
+	if(i < n) {
+		dsp.phase_mag(b->out_re + i, b->out_im + i, b->phase + i, b->mag + i, n - i);
+		for(; i < n; i++) {
+#ifdef DEBUG
+			v->samplenum++;
+#endif
+			demod(v, b->out_re[i], b->out_im[i], b->phase[i], b->mag[i]);
+			if(squelch) {
+				v->sq_hist_re[v->syncbufidx] = b->out_re[i];
+				v->sq_hist_im[v->syncbufidx] = b->out_im[i];
 			}
 		}
+		// Close the squelch only between bursts and not while a sync
+		// candidate is in holdoff (reopening would discard it)
+		if(squelch && v->nf_settled && v->demod_state == DM_INIT && v->sync_age < 0 &&
+				v->mag_lp <= v->mag_nf * Config.squelch_ratio) {
+			v->squelch_closed = true;
+		}
+	}
+	if(squelch) {
+		squelch_stats_update(v, n);
+	}
+}
+
+// Lowpass filter the samples with 2-pole IIR and decimate.
+// Returns the number of samples stored in out_re and out_im.
+static uint32_t iir_decimate(iir_state_t *s, float const *re, float const *im, uint32_t n,
+		float *out_re, float *out_im, int oversample) {
+	float const a0 = A[0], a1 = A[1], a2 = A[2], b1 = B[1], b2 = B[2];
+	float x1_re = s->x1_re, x2_re = s->x2_re, y1_re = s->y1_re, y2_re = s->y2_re;
+	float x1_im = s->x1_im, x2_im = s->x2_im, y1_im = s->y1_im, y2_im = s->y2_im;
+	int cnt = s->cnt;
+	uint32_t k = 0;
+	for(uint32_t i = 0; i < n; i++) {
+		float const y_re = a0 * re[i] + a1 * x1_re + a2 * x2_re + b1 * y1_re + b2 * y2_re;
+		float const y_im = a0 * im[i] + a1 * x1_im + a2 * x2_im + b1 * y1_im + b2 * y2_im;
+		x2_re = x1_re; x1_re = re[i]; y2_re = y1_re; y1_re = y_re;
+		x2_im = x1_im; x1_im = im[i]; y2_im = y1_im; y1_im = y_im;
+		if(++cnt == oversample) {
+			cnt = 0;
+			out_re[k] = y_re;
+			out_im[k] = y_im;
+			k++;
+		}
+	}
+	s->x1_re = x1_re; s->x2_re = x2_re; s->y1_re = y1_re; s->y2_re = y2_re;
+	s->x1_im = x1_im; s->x2_im = x2_im; s->y1_im = y1_im; s->y2_im = y2_im;
+	s->cnt = cnt;
+	return k;
+}
+
+static uint64_t cic_comb(uint64_t x, uint64_t *delay) {
+	for(int k = 0; k < CIC_ORDER; k++) {
+		uint64_t const prev = delay[k];
+		delay[k] = x;
+		x -= prev;
+	}
+	return x;
+}
+
+// Run integrators on each input sample, and combs plus a short compensating
+// FIR only on samples kept after decimation.
+// Returns the number of samples stored in out_re and out_im.
+static uint32_t cic_decimate(cic_state_t *s, float const *re, float const *im, uint32_t n,
+		float *out_re, float *out_im, int oversample) {
+	uint32_t k = 0;
+	for(uint32_t i = 0; i < n; i++) {
+		s->integ_re[0] += (uint64_t)(int64_t)(re[i] * CIC_INPUT_SCALE);
+		s->integ_im[0] += (uint64_t)(int64_t)(im[i] * CIC_INPUT_SCALE);
+		for(int j = 1; j < CIC_ORDER; j++) {
+			s->integ_re[j] += s->integ_re[j-1];
+			s->integ_im[j] += s->integ_im[j-1];
+		}
+		if(++s->cnt < oversample) {
+			continue;
+		}
+		s->cnt = 0;
+		float const cic_re = (float)(int64_t)cic_comb(s->integ_re[CIC_ORDER-1], s->comb_re) * cic_scale;
+		float const cic_im = (float)(int64_t)cic_comb(s->integ_im[CIC_ORDER-1], s->comb_im) * cic_scale;
+		if(--s->fir_pos < 0) {
+			s->fir_pos = CIC_FIR_LEN - 1;
+		}
+		s->fir_re[s->fir_pos] = s->fir_re[s->fir_pos + CIC_FIR_LEN] = cic_re;
+		s->fir_im[s->fir_pos] = s->fir_im[s->fir_pos + CIC_FIR_LEN] = cic_im;
+		float const *fr = s->fir_re + s->fir_pos, *fi = s->fir_im + s->fir_pos;
+		float acc_re = 0.0f, acc_im = 0.0f;
+		for(int j = 0; j < CIC_FIR_LEN; j++) {
+			acc_re += cic_fir[j] * fr[j];
+			acc_im += cic_fir[j] * fi[j];
+		}
+		out_re[k] = acc_re;
+		out_im[k] = acc_im;
+		k++;
+	}
+	return k;
+}
+
+// Splits n interleaved I/Q samples into separate I and Q arrays
+static void deinterleave(float const *iq, float *re, float *im, uint32_t n) {
+	for(uint32_t i = 0; i < n; i++) {
+		re[i] = iq[2*i];
+		im[i] = iq[2*i+1];
+	}
+}
+
+// Per-channel front ends (IIR and CIC): downmix the whole input buffer,
+// then filter and decimate it.
+static void process_samples_downmix(vdl2_channel_t *v, demod_buffers_t *b,
+		sample_block_t const *block, iir_state_t *iir, cic_state_t *cic) {
+	uint32_t const num_samples = block->len / 2;
+	for(uint32_t i = 0; i < num_samples; i += DEMOD_CHUNK_LEN) {
+		uint32_t const len = num_samples - i < DEMOD_CHUNK_LEN ? num_samples - i : DEMOD_CHUNK_LEN;
+		// No need to downmix if the channel is at the center frequency
+		if(v->offset_tuning) {
+			dsp.nco_mix(block->samples + 2 * i, b->re, b->im, len, &v->downmix_phi, v->downmix_dphi);
+		} else {
+			deinterleave(block->samples + 2 * i, b->re, b->im, len);
+		}
+		uint32_t n;
+		if(Config.frontend == FRONTEND_CIC) {
+			n = cic_decimate(cic, b->re, b->im, len, b->out_re, b->out_im, v->oversample);
+		} else {
+			n = iir_decimate(iir, b->re, b->im, len, b->out_re, b->out_im, v->oversample);
+		}
+		demod_block(v, b, n);
+	}
+}
+
+// Channelizer front end: the input signal has already been transformed
+// by the input thread. Pick up this channel's samples from each block and
+// remove the residual frequency offset.
+static void process_samples_fft(vdl2_channel_t *v, demod_buffers_t *b, sample_block_t const *block) {
+	channelizer_channel_t *c = v->chan;
+	for(uint32_t i = 0; i < block->num_spectra; i++) {
+		cfloat_t const *samples = channelizer_channel_get_block(c, block, i);
+		uint32_t phi = v->downmix_phi;
+		dsp.nco_mix(&samples[0].re, b->out_re, b->out_im, CHANNELIZER_HOP, &phi, c->dphi);
+		demod_block(v, b, CHANNELIZER_HOP);
+		v->downmix_phi = (v->downmix_phi + c->block_dphi) & 0xffffff;
+	}
+}
+
+// Processes all sample blocks published so far which the channel has not
+// seen yet. Returns false if there was nothing to do or if the channel is
+// currently being processed by another worker.
+bool demod_channel_process(vdl2_channel_t *v) {
+	struct demod_frontend *f = v->frontend;
+	if(atomic_load_explicit(&f->busy, memory_order_relaxed) || atomic_exchange(&f->busy, true)) {
+		return false;
+	}
+	uint64_t const head = sample_ring_head(input_ring);
+	bool const did_work = f->input_seq < head;
+	for(; f->input_seq < head; f->input_seq++) {
+		sample_block_t *block = sample_ring_get(input_ring, f->input_seq);
+		if(v->chan != NULL) {
+			process_samples_fft(v, &f->buf, block);
+		} else {
+			process_samples_downmix(v, &f->buf, block, &f->iir, &f->cic);
+		}
+		sample_ring_release(input_ring, block);
 #ifdef DEBUG
 		if(++v->bufnum == 10) {
 			v->bufnum = 0;
@@ -334,16 +594,62 @@ void *process_samples(void *arg) {
 		}
 #endif
 	}
+	atomic_store(&f->busy, false);
+	return did_work;
+}
+
+static void input_block_dropped() {
+	static time_t last_warning = 0;
+	input_blocks_dropped++;
+	statsd_increment("demod.input.blocks_dropped");
+	time_t const now = time(NULL);
+	if(now - last_warning >= INPUT_DROP_WARN_INTERVAL) {
+		fprintf(stderr, "Warning: demodulators are not keeping up with the input, "
+				"%" PRIu64 " sample blocks dropped so far\n", input_blocks_dropped);
+		last_warning = now;
+	}
+}
+
+// Reserves a ring slot for len converted samples. Returns the buffer
+// where the samples shall be stored or NULL if the ring is full.
+static float *input_block_start(uint32_t len, sample_block_t **block) {
+	sample_block_t *b = sample_ring_reserve(input_ring);
+	if(b == NULL) {
+		input_block_dropped();
+		return NULL;
+	}
+	*block = b;
+	if(Config.frontend == FRONTEND_FFT) {
+		if(len > sbuf_capacity) {
+			sbuf = XREALLOC(sbuf, len * sizeof(float));
+			sbuf_capacity = len;
+		}
+		return sbuf;
+	}
+	if(len > b->capacity) {
+		b->samples = XREALLOC(b->samples, len * sizeof(float));
+		b->capacity = len;
+	}
+	b->len = len;
+	return b->samples;
+}
+
+static void input_block_finish(sample_block_t *block, float const *samples, uint32_t len) {
+	if(Config.frontend == FRONTEND_FFT) {
+		channelizer_put_samples(samples, len, block);
+	}
+	sample_ring_publish(input_ring);
 }
 
 void process_buf_uchar(unsigned char *buf, uint32_t len, void *ctx) {
 	UNUSED(ctx);
 	if(len == 0) return;
-	pthread_barrier_wait(&demods_ready);
-	sbuf_len = len;
-	for(uint32_t i = 0; i < sbuf_len; i++)
-		sbuf[i] = levels[buf[i]];
-	pthread_barrier_wait(&samples_ready);
+	sample_block_t *block = NULL;
+	float *samples = input_block_start(len, &block);
+	if(samples == NULL) return;
+	for(uint32_t i = 0; i < len; i++)
+		samples[i] = levels[buf[i]];
+	input_block_finish(block, samples, len);
 }
 
 void process_buf_uchar_init() {
@@ -357,29 +663,98 @@ void process_buf_short(unsigned char *buf, uint32_t len, void *ctx) {
 	UNUSED(ctx);
 	if(len == 0) return;
 	int16_t *bbuf = (int16_t *)buf;
-	pthread_barrier_wait(&demods_ready);
-	sbuf_len = len / 2;
-	for(uint32_t i = 0; i < sbuf_len; i++)
-		sbuf[i] = (float)bbuf[i] / 32768.0f;
-	pthread_barrier_wait(&samples_ready);
+	uint32_t const num_samples = len / 2;
+	sample_block_t *block = NULL;
+	float *samples = input_block_start(num_samples, &block);
+	if(samples == NULL) return;
+	for(uint32_t i = 0; i < num_samples; i++)
+		samples[i] = (float)bbuf[i] / 32768.0f;
+	input_block_finish(block, samples, num_samples);
 }
 
-void input_lpf_init(uint32_t sample_rate) {
-	assert(sample_rate != 0);
-	chebyshev_lpf_init((float)INP_LPF_CUTOFF_FREQ / (float)sample_rate, INP_LPF_RIPPLE_PERCENT, INP_LPF_NPOLES, &A, &B);
+#ifdef WITH_STATSD
+static char *demod_input_counters[] = {
+	"demod.input.blocks_dropped",
+	NULL
+};
+#endif
+
+// Must be called before starting demodulator workers.
+// When wait_when_full is set, the input thread waits for demodulators
+// to catch up instead of dropping sample blocks.
+void demod_input_init(int num_channels, bool wait_when_full) {
+	input_ring = sample_ring_new(num_channels, wait_when_full);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(demod_input_counters);
+#endif
+}
+
+// Waits until demodulators have processed all input samples
+void demod_input_drain() {
+	sample_ring_drain(input_ring);
+}
+
+// Wakes up demodulators waiting for input samples. They won't wait anymore.
+void demod_input_stop() {
+	sample_ring_stop(input_ring);
 }
 
-void sincosf_lut_init() {
-	for(uint32_t i = 0; i < 256; i++)
-		SINCOSF(2.0f * M_PI * (float)i / 256.0f, sin_lut + i, cos_lut + i);
-	sin_lut[256] = sin_lut[0];
-	cos_lut[256] = cos_lut[0];
+uint64_t demod_input_head() {
+	return sample_ring_head(input_ring);
+}
+
+// Waits until there are more than num_blocks sample blocks published
+void demod_input_wait(uint64_t num_blocks) {
+	sample_ring_wait(input_ring, num_blocks);
+}
+
+// Design the FIR filter which follows the CIC decimator. It is the same
+// lowpass filter as the one used by the IIR front end, but running at the
+// decimated rate, convolved with a 3-tap inverse-sinc filter which flattens
+// the CIC passband droop up to the filter cutoff frequency.
+static void cic_fir_init(uint32_t sample_rate, uint32_t oversample) {
+	float const out_rate = (float)sample_rate / (float)oversample;
+	float *a = NULL, *b = NULL;
+	float lpf[CIC_LPF_TAPS];
+	chebyshev_lpf_init((float)INP_LPF_CUTOFF_FREQ / out_rate, INP_LPF_RIPPLE_PERCENT, INP_LPF_NPOLES, &a, &b);
+	lpf_2pole_impulse_response(a, b, lpf, CIC_LPF_TAPS);
+	XFREE(a);
+	XFREE(b);
+
+	float const x = M_PI * (float)INP_LPF_CUTOFF_FREQ / (float)sample_rate;
+	float const droop = powf(sinf(x * oversample) / (oversample * sinf(x)), CIC_ORDER);
+	float const w = 2.0f * M_PI * (float)INP_LPF_CUTOFF_FREQ / out_rate;
+	float const c = (1.0f / droop - 1.0f) / (2.0f * (1.0f - cosf(w)));
+	float const comp[3] = { -c, 1.0f + 2.0f * c, -c };
+	memset(cic_fir, 0, sizeof(cic_fir));
+	for(int i = 0; i < CIC_LPF_TAPS; i++) {
+		for(int j = 0; j < 3; j++) {
+			cic_fir[i + j] += lpf[i] * comp[j];
+		}
+	}
+	cic_scale = 1.0f / (CIC_INPUT_SCALE * powf((float)oversample, CIC_ORDER));
+	debug_print(D_DEMOD, "CIC droop at cutoff: %f compensator coeff: %f\n", droop, c);
+}
+
+void input_lpf_init(uint32_t sample_rate, uint32_t oversample) {
+	assert(sample_rate != 0);
+	chebyshev_lpf_init((float)INP_LPF_CUTOFF_FREQ / (float)sample_rate, INP_LPF_RIPPLE_PERCENT, INP_LPF_NPOLES, &A, &B);
+	if(Config.frontend == FRONTEND_FFT) {
+		// The channelizer applies the same lowpass filter in the frequency domain.
+		// Use its impulse response, truncated to the length supported by the channelizer.
+		uint32_t const num_taps = channelizer_filter_len(oversample);
+		float *taps = XCALLOC(num_taps, sizeof(float));
+		lpf_2pole_impulse_response(A, B, taps, num_taps);
+		channelizer_init(oversample, taps, num_taps);
+		XFREE(taps);
+	} else if(Config.frontend == FRONTEND_CIC) {
+		cic_fir_init(sample_rate, oversample);
+	}
 }
 
 vdl2_channel_t *vdl2_channel_init(uint32_t centerfreq, uint32_t freq, uint32_t source_rate, uint32_t oversample) {
 	NEW(vdl2_channel_t, v);
 	v->bs = bitstream_init(BSLEN);
-	v->frame_bs = bitstream_init(BSLEN);
 	v->mag_nf = 2.0f;
 	// Cast to signed first, because casting negative float to uint is not portable
 	v->downmix_dphi = (uint32_t)(int)(((float)centerfreq - (float)freq) / (float)source_rate * 256.0f * 65536.0f);
@@ -387,6 +762,13 @@ vdl2_channel_t *vdl2_channel_init(uint32_t centerfreq, uint32_t freq, uint32_t s
 	v->offset_tuning = (centerfreq != freq);
 	v->oversample = oversample;
 	v->freq = freq;
+	if(Config.frontend == FRONTEND_FFT) {
+		v->chan = channelizer_channel_new((int32_t)freq - (int32_t)centerfreq, source_rate, oversample);
+	}
+	NEW(struct demod_frontend, f);
+	atomic_init(&f->busy, false);
+	v->frontend = f;
+	v->samplenum = -1;
 	demod_reset(v);
 	return v;
 }
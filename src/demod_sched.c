@@ -0,0 +1,195 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Demodulator worker pool.
+//
+// Channels are distributed among a fixed number of worker threads in
+// a round-robin fashion. A worker processes all pending sample blocks of
+// its channels in turn and sleeps when there is nothing left to do.
+// With work stealing enabled, a worker which has run out of work picks
+// up pending blocks of channels assigned to other workers. A channel is
+// processed by at most one worker at a time (see demod_channel_process).
+
+#include "config.h"
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#define _GNU_SOURCE             // pthread_setaffinity_np, CPU_SET
+#include <sched.h>
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>             // strtol
+#include <string.h>             // strerror
+#include <unistd.h>             // sysconf
+#include "demod_sched.h"
+#include "dumpvdl2.h"           // NEW, XCALLOC, demod_channel_process, demod_input_*
+
+#define DEMOD_MAX_CPUS 1024
+
+typedef struct {
+	vdl2_state_t *ctx;
+	int id;
+	int cpu;                    // -1 == no CPU affinity
+	pthread_t thread;
+} demod_worker_t;
+
+static demod_worker_t **workers;
+static int num_workers;
+static bool work_stealing;
+static atomic_bool stopping;
+static int *cpus;
+static int num_cpus;
+
+// Parse a list of CPU numbers and ranges, eg. "0,2-3"
+int demod_sched_set_cpus(char const *cpu_list) {
+	int *list = XCALLOC(DEMOD_MAX_CPUS, sizeof(int));
+	int cnt = 0;
+	char const *p = cpu_list;
+	while(*p != '\0') {
+		char *end;
+		long first = strtol(p, &end, 10), last;
+		if(end == p || first < 0 || first >= DEMOD_MAX_CPUS) {
+			goto fail;
+		}
+		last = first;
+		if(*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if(end == p || last < first || last >= DEMOD_MAX_CPUS) {
+				goto fail;
+			}
+		}
+		for(long i = first; i <= last; i++) {
+			if(cnt == DEMOD_MAX_CPUS) {
+				goto fail;
+			}
+			list[cnt++] = (int)i;
+		}
+		if(*end == ',') {
+			end++;
+		} else if(*end != '\0') {
+			goto fail;
+		}
+		p = end;
+	}
+	if(cnt == 0) {
+		goto fail;
+	}
+	XFREE(cpus);
+	cpus = list;
+	num_cpus = cnt;
+	return 0;
+fail:
+	XFREE(list);
+	return -1;
+}
+
+static void demod_worker_set_affinity(demod_worker_t *w) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(ret != 0) {
+		fprintf(stderr, "Warning: could not bind demodulator thread %d to CPU %d: %s\n",
+				w->id, w->cpu, strerror(ret));
+	}
+#else
+	fprintf(stderr, "Warning: CPU affinity is not supported on this platform\n");
+#endif
+}
+
+static bool demod_worker_run_channels(demod_worker_t *w, bool own) {
+	vdl2_state_t *ctx = w->ctx;
+	bool did_work = false;
+	for(int i = 0; i < ctx->num_channels; i++) {
+		if((i % num_workers == w->id) == own) {
+			did_work |= demod_channel_process(ctx->channels[i]);
+		}
+	}
+	return did_work;
+}
+
+static void *demod_worker_thread(void *arg) {
+	demod_worker_t *w = arg;
+	if(w->cpu >= 0) {
+		demod_worker_set_affinity(w);
+	}
+	while(1) {
+		// Blocks published after this point will wake us up
+		uint64_t const head = demod_input_head();
+		bool did_work = demod_worker_run_channels(w, true);
+		if(!did_work && work_stealing) {
+			did_work = demod_worker_run_channels(w, false);
+		}
+		if(!did_work) {
+			// Exit only when all published blocks have been processed
+			if(atomic_load(&stopping)) {
+				break;
+			}
+			demod_input_wait(head);
+		}
+	}
+	return NULL;
+}
+
+// Starts num_workers demodulator threads (0 == number of online CPUs)
+void demod_sched_start(vdl2_state_t *ctx, int num_workers_requested, bool stealing) {
+	ASSERT(ctx != NULL);
+	ASSERT(ctx->num_channels > 0);
+	num_workers = num_workers_requested;
+	if(num_workers <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = ncpu > 0 ? (int)ncpu : 1;
+	}
+	// Idle workers would have nothing to steal anyway
+	if(num_workers > ctx->num_channels) {
+		num_workers = ctx->num_channels;
+	}
+	work_stealing = stealing;
+	fprintf(stderr, "Using %d demodulator thread(s)%s\n", num_workers,
+			work_stealing ? " with work stealing" : "");
+	atomic_store(&stopping, false);
+	workers = XCALLOC(num_workers, sizeof(demod_worker_t *));
+	for(int i = 0; i < num_workers; i++) {
+		NEW(demod_worker_t, w);
+		w->ctx = ctx;
+		w->id = i;
+		w->cpu = num_cpus > 0 ? cpus[i % num_cpus] : -1;
+		start_thread(&w->thread, demod_worker_thread, w);
+		workers[i] = w;
+	}
+}
+
+// Stops demodulator threads after they have processed all published sample
+// blocks. Must be called after the input has stopped producing samples.
+// Does nothing if the workers have not been started.
+void demod_sched_stop() {
+	if(workers == NULL) {
+		return;
+	}
+	atomic_store(&stopping, true);
+	demod_input_stop();
+	for(int i = 0; i < num_workers; i++) {
+		pthread_join(workers[i]->thread, NULL);
+		XFREE(workers[i]);
+	}
+	XFREE(workers);
+}
@@ -0,0 +1,29 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DEMOD_SCHED_H
+#define _DEMOD_SCHED_H 1
+#include <stdbool.h>
+#include "dumpvdl2.h"           // vdl2_state_t
+
+int demod_sched_set_cpus(char const *cpu_list);
+void demod_sched_start(vdl2_state_t *ctx, int num_workers, bool work_stealing);
+void demod_sched_stop();
+
+#endif // !_DEMOD_SCHED_H
@@ -0,0 +1,456 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Segment files are named after their sequence numbers (16 hex digits with
+// a .seg suffix). Records are appended to the newest segment until it
+// reaches segment_size; then a new segment is started. Segments are deleted
+// once all their records have been committed. The position of the first
+// uncommitted record is saved in the "cursor" file.
+//
+// Data and the cursor are synced to disk at most every sync_interval
+// milliseconds, so that a burst of appends costs a single fsync. After
+// a crash some records may therefore be delivered again and the most
+// recent ones may be lost. A torn record at the end of the last segment is
+// truncated when the queue is reopened; corrupted records elsewhere cause
+// the rest of their segment to be skipped.
+
+#include <dirent.h>                     // opendir, readdir
+#include <errno.h>
+#include <fcntl.h>                      // open, O_* constants
+#include <inttypes.h>                   // PRIx64, SCNu64
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>                      // snprintf
+#include <stdlib.h>                     // strtoull
+#include <string.h>                     // strlen, strspn
+#include <time.h>                       // clock_gettime
+#include <unistd.h>                     // pread, fsync, ftruncate, unlink
+#include <sys/file.h>                   // flock
+#include <sys/stat.h>                   // mkdir, fstat
+#include <sys/uio.h>                    // writev
+#include "disk-queue.h"
+#include "dumpvdl2.h"                   // NEW, XFREE, crc16_ccitt
+
+#define DISK_QUEUE_REC_MAGIC    0x5144  // "DQ"
+#define DISK_QUEUE_SEG_SUFFIX   ".seg"
+#define DISK_QUEUE_SEG_NAME_LEN 16      // hex digits
+
+typedef struct {
+	uint32_t len;                   // length of data following the header
+	uint16_t magic;
+	uint16_t crc;                   // CRC of len and data
+} disk_queue_rec_t;
+
+struct disk_queue {
+	char *dir;
+	int dir_fd;
+	int lock_fd;
+	uint64_t max_size;
+	uint64_t segment_size;
+	int sync_interval;              // milliseconds, 0 = sync after every append
+	uint64_t usage;                 // total size of segment files
+	uint64_t first_seg;             // oldest segment which may still exist
+	// write side
+	uint64_t wseg;                  // segment being appended to
+	uint64_t wsize;                 // its current size
+	int wfd;                        // -1 = the segment has not been created yet
+	bool data_dirty, dir_dirty, cursor_dirty;
+	int64_t last_sync;
+	// read side
+	uint64_t cseg, coff;            // position of the first uncommitted record
+	uint64_t rseg, roff;            // position of the next record to read
+	int rfd;
+	uint64_t rfd_seg;               // segment which rfd refers to
+	uint8_t *buf;
+	size_t buf_len;
+};
+
+static int64_t disk_queue_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void disk_queue_seg_name(char *name, size_t len, uint64_t seg) {
+	snprintf(name, len, "%016" PRIx64 DISK_QUEUE_SEG_SUFFIX, seg);
+}
+
+static uint16_t disk_queue_rec_crc(uint32_t len, void const *buf) {
+	uint16_t crc = crc16_ccitt((uint8_t const *)&len, sizeof(len), FCS_INIT);
+	return crc16_ccitt(buf, len, crc);
+}
+
+// Returns true if the record at off in fd is valid. On success, its header
+// is stored in *rec and the data in dq->buf.
+static bool disk_queue_rec_read(disk_queue_t *dq, int fd, uint64_t off, uint64_t seg_size, disk_queue_rec_t *rec) {
+	if(off + sizeof(*rec) > seg_size ||
+			pread(fd, rec, sizeof(*rec), off) != sizeof(*rec) ||
+			rec->magic != DISK_QUEUE_REC_MAGIC ||
+			off + sizeof(*rec) + rec->len > seg_size) {
+		return false;
+	}
+	if(rec->len > dq->buf_len) {
+		dq->buf = XREALLOC(dq->buf, rec->len);
+		dq->buf_len = rec->len;
+	}
+	return pread(fd, dq->buf, rec->len, off + sizeof(*rec)) == (ssize_t)rec->len &&
+		disk_queue_rec_crc(rec->len, dq->buf) == rec->crc;
+}
+
+static uint64_t disk_queue_seg_size(disk_queue_t const *dq, uint64_t seg) {
+	struct stat st;
+	char name[DISK_QUEUE_SEG_NAME_LEN + sizeof(DISK_QUEUE_SEG_SUFFIX)];
+	disk_queue_seg_name(name, sizeof(name), seg);
+	return fstatat(dq->dir_fd, name, &st, 0) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+static void disk_queue_seg_remove(disk_queue_t *dq, uint64_t seg) {
+	char name[DISK_QUEUE_SEG_NAME_LEN + sizeof(DISK_QUEUE_SEG_SUFFIX)];
+	disk_queue_seg_name(name, sizeof(name), seg);
+	uint64_t const size = seg == dq->wseg ? dq->wsize : disk_queue_seg_size(dq, seg);
+	if(unlinkat(dq->dir_fd, name, 0) == 0) {
+		dq->usage -= size < dq->usage ? size : dq->usage;
+		dq->dir_dirty = true;
+	}
+}
+
+// Truncates the segment after its last valid record
+static void disk_queue_seg_recover(disk_queue_t *dq, uint64_t seg) {
+	char name[DISK_QUEUE_SEG_NAME_LEN + sizeof(DISK_QUEUE_SEG_SUFFIX)];
+	disk_queue_seg_name(name, sizeof(name), seg);
+	int fd = openat(dq->dir_fd, name, O_RDWR);
+	if(fd < 0) {
+		return;
+	}
+	struct stat st;
+	if(fstat(fd, &st) == 0) {
+		uint64_t const size = st.st_size;
+		uint64_t off = 0;
+		disk_queue_rec_t rec;
+		while(disk_queue_rec_read(dq, fd, off, size, &rec)) {
+			off += sizeof(rec) + rec.len;
+		}
+		if(off < size && ftruncate(fd, off) == 0) {
+			fprintf(stderr, "%s: %s: discarded %" PRIu64 " bytes of incomplete data\n",
+					dq->dir, name, size - off);
+			dq->usage -= size - off;
+			fsync(fd);
+		}
+	}
+	close(fd);
+}
+
+static void disk_queue_cursor_load(disk_queue_t *dq, uint64_t last_seg) {
+	dq->cseg = dq->first_seg;
+	dq->coff = 0;
+	int fd = openat(dq->dir_fd, "cursor", O_RDONLY);
+	if(fd < 0) {
+		return;
+	}
+	char buf[64] = { 0 };
+	uint64_t seg, off;
+	if(read(fd, buf, sizeof(buf) - 1) > 0 && sscanf(buf, "%" SCNu64 " %" SCNu64, &seg, &off) == 2 &&
+			seg >= dq->first_seg && seg <= last_seg) {
+		dq->cseg = seg;
+		dq->coff = off;
+	}
+	close(fd);
+}
+
+static void disk_queue_cursor_save(disk_queue_t *dq) {
+	int fd = openat(dq->dir_fd, "cursor.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		return;
+	}
+	char buf[64];
+	int len = snprintf(buf, sizeof(buf), "%" PRIu64 " %" PRIu64 "\n", dq->cseg, dq->coff);
+	bool ok = write(fd, buf, len) == len;
+	close(fd);
+	if(ok && renameat(dq->dir_fd, "cursor.tmp", dq->dir_fd, "cursor") == 0) {
+		dq->cursor_dirty = false;
+	}
+}
+
+// Opens the queue in the given directory (creating it if necessary).
+// The total size of segment files is limited to max_size. Returns NULL
+// on error (with errno set; EBUSY means that the directory is in use by
+// another queue).
+disk_queue_t *disk_queue_open(char const *dir, uint64_t max_size, uint64_t segment_size, int sync_interval) {
+	if(dir == NULL || segment_size <= sizeof(disk_queue_rec_t) || segment_size > max_size ||
+			segment_size > UINT32_MAX || sync_interval < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		return NULL;
+	}
+	int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if(dir_fd < 0) {
+		return NULL;
+	}
+	int lock_fd = openat(dir_fd, "lock", O_RDWR | O_CREAT, 0644);
+	if(lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
+		int err = errno == EWOULDBLOCK ? EBUSY : errno;
+		if(lock_fd >= 0) {
+			close(lock_fd);
+		}
+		close(dir_fd);
+		errno = err;
+		return NULL;
+	}
+	NEW(disk_queue_t, dq);
+	dq->dir = strdup(dir);
+	dq->dir_fd = dir_fd;
+	dq->lock_fd = lock_fd;
+	dq->max_size = max_size;
+	dq->segment_size = segment_size;
+	dq->sync_interval = sync_interval;
+	dq->wfd = dq->rfd = -1;
+	dq->last_sync = disk_queue_now();
+
+	// Find existing segments
+	DIR *d = fdopendir(dup(dir_fd));
+	bool found = false;
+	uint64_t last_seg = 0;
+	if(d != NULL) {
+		struct dirent *de;
+		while((de = readdir(d)) != NULL) {
+			if(strlen(de->d_name) != DISK_QUEUE_SEG_NAME_LEN + strlen(DISK_QUEUE_SEG_SUFFIX) ||
+					strspn(de->d_name, "0123456789abcdef") != DISK_QUEUE_SEG_NAME_LEN ||
+					strcmp(de->d_name + DISK_QUEUE_SEG_NAME_LEN, DISK_QUEUE_SEG_SUFFIX) != 0) {
+				continue;
+			}
+			uint64_t seg = strtoull(de->d_name, NULL, 16);
+			if(!found || seg < dq->first_seg) {
+				dq->first_seg = seg;
+			}
+			if(!found || seg > last_seg) {
+				last_seg = seg;
+			}
+			found = true;
+			dq->usage += disk_queue_seg_size(dq, seg);
+		}
+		closedir(d);
+	}
+	if(found) {
+		disk_queue_seg_recover(dq, last_seg);
+		disk_queue_cursor_load(dq, last_seg);
+		// Never append to segments written by a previous instance
+		dq->wseg = last_seg + 1;
+	} else {
+		dq->cseg = dq->wseg = dq->first_seg = 0;
+	}
+	dq->rseg = dq->cseg;
+	dq->roff = dq->coff;
+	return dq;
+}
+
+// Appends a record. Returns 0 on success or -1 on error (errno is ENOSPC
+// if the queue is full).
+int disk_queue_append(disk_queue_t *dq, void const *buf, size_t len) {
+	uint64_t const rec_len = sizeof(disk_queue_rec_t) + len;
+	if(rec_len > dq->segment_size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if(dq->usage + rec_len > dq->max_size) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if(dq->wfd >= 0 && dq->wsize + rec_len > dq->segment_size) {
+		fsync(dq->wfd);
+		close(dq->wfd);
+		dq->wfd = -1;
+		dq->wseg++;
+		dq->wsize = 0;
+	}
+	if(dq->wfd < 0) {
+		char name[DISK_QUEUE_SEG_NAME_LEN + sizeof(DISK_QUEUE_SEG_SUFFIX)];
+		disk_queue_seg_name(name, sizeof(name), dq->wseg);
+		if((dq->wfd = openat(dq->dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+			return -1;
+		}
+		dq->dir_dirty = true;
+	}
+	disk_queue_rec_t rec = {
+		.len = len,
+		.magic = DISK_QUEUE_REC_MAGIC,
+		.crc = disk_queue_rec_crc(len, buf)
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = &rec, .iov_len = sizeof(rec) },
+		{ .iov_base = (void *)buf, .iov_len = len }
+	};
+	ssize_t ret;
+	while((ret = writev(dq->wfd, iov, 2)) < 0 && errno == EINTR)
+		;
+	if(ret != (ssize_t)rec_len) {
+		// Don't leave a partial record behind
+		int err = ret < 0 ? errno : ENOSPC;
+		if(ftruncate(dq->wfd, dq->wsize) < 0) {
+			// The record will be skipped as corrupted when read
+			dq->wsize += ret > 0 ? ret : 0;
+			dq->usage += ret > 0 ? ret : 0;
+		}
+		errno = err;
+		return -1;
+	}
+	dq->wsize += rec_len;
+	dq->usage += rec_len;
+	dq->data_dirty = true;
+	if(dq->sync_interval == 0 || disk_queue_now() - dq->last_sync >= dq->sync_interval) {
+		disk_queue_sync(dq);
+	}
+	return 0;
+}
+
+// Returns the next record in *buf and *len. The buffer is valid until the next
+// call. Returns 1 if a record has been read or 0 if there are no more records.
+int disk_queue_read(disk_queue_t *dq, uint8_t const **buf, size_t *len) {
+	while(dq->rseg < dq->wseg || dq->roff < dq->wsize) {
+		if(dq->rfd < 0 || dq->rfd_seg != dq->rseg) {
+			if(dq->rfd >= 0) {
+				close(dq->rfd);
+			}
+			char name[DISK_QUEUE_SEG_NAME_LEN + sizeof(DISK_QUEUE_SEG_SUFFIX)];
+			disk_queue_seg_name(name, sizeof(name), dq->rseg);
+			dq->rfd = openat(dq->dir_fd, name, O_RDONLY);
+			dq->rfd_seg = dq->rseg;
+			if(dq->rfd < 0) {
+				if(dq->rseg == dq->wseg) {
+					return 0;
+				}
+				dq->rseg++;
+				dq->roff = 0;
+				continue;
+			}
+		}
+		uint64_t size = dq->wsize;
+		struct stat st;
+		if(dq->rseg != dq->wseg) {
+			size = fstat(dq->rfd, &st) == 0 ? (uint64_t)st.st_size : 0;
+		}
+		if(dq->roff >= size) {
+			if(dq->rseg == dq->wseg) {
+				return 0;
+			}
+			dq->rseg++;
+			dq->roff = 0;
+			continue;
+		}
+		disk_queue_rec_t rec;
+		if(!disk_queue_rec_read(dq, dq->rfd, dq->roff, size, &rec)) {
+			fprintf(stderr, "%s: corrupted record in segment %016" PRIx64 " at offset %" PRIu64
+					", skipping %" PRIu64 " bytes\n", dq->dir, dq->rseg, dq->roff, size - dq->roff);
+			dq->roff = size;
+			continue;
+		}
+		dq->roff += sizeof(rec) + rec.len;
+		*buf = dq->buf;
+		*len = rec.len;
+		return 1;
+	}
+	return 0;
+}
+
+// Removes all records read so far from the queue
+void disk_queue_commit(disk_queue_t *dq) {
+	if(dq->cseg == dq->rseg && dq->coff == dq->roff) {
+		// Nothing has been read - don't rewrite the cursor
+		return;
+	}
+	dq->cseg = dq->rseg;
+	dq->coff = dq->roff;
+	while(dq->first_seg < dq->cseg) {
+		if(dq->rfd >= 0 && dq->rfd_seg == dq->first_seg) {
+			close(dq->rfd);
+			dq->rfd = -1;
+		}
+		disk_queue_seg_remove(dq, dq->first_seg);
+		dq->first_seg++;
+	}
+	if(dq->cseg == dq->wseg && dq->coff >= dq->wsize && dq->wfd >= 0) {
+		// Everything has been consumed - continue in a new segment
+		if(dq->rfd >= 0) {
+			close(dq->rfd);
+			dq->rfd = -1;
+		}
+		close(dq->wfd);
+		dq->wfd = -1;
+		disk_queue_seg_remove(dq, dq->wseg);
+		dq->wseg++;
+		dq->wsize = 0;
+		dq->first_seg = dq->cseg = dq->rseg = dq->wseg;
+		dq->coff = dq->roff = 0;
+		dq->data_dirty = false;
+	}
+	dq->cursor_dirty = true;
+	if(dq->sync_interval == 0 || disk_queue_now() - dq->last_sync >= dq->sync_interval) {
+		disk_queue_sync(dq);
+	}
+}
+
+// Goes back to the first uncommitted record
+void disk_queue_rewind(disk_queue_t *dq) {
+	dq->rseg = dq->cseg;
+	dq->roff = dq->coff;
+}
+
+bool disk_queue_is_empty(disk_queue_t const *dq) {
+	return dq->cseg == dq->wseg && dq->coff >= dq->wsize;
+}
+
+// Returns the total size of segment files
+uint64_t disk_queue_size(disk_queue_t const *dq) {
+	return dq->usage;
+}
+
+// Flushes appended data and the read position to disk
+void disk_queue_sync(disk_queue_t *dq) {
+	if(dq->data_dirty && dq->wfd >= 0) {
+		fsync(dq->wfd);
+	}
+	if(dq->cursor_dirty) {
+		disk_queue_cursor_save(dq);
+	}
+	if(dq->dir_dirty) {
+		fsync(dq->dir_fd);
+	}
+	dq->data_dirty = dq->dir_dirty = false;
+	dq->last_sync = disk_queue_now();
+}
+
+void disk_queue_close(disk_queue_t *dq) {
+	if(dq == NULL) {
+		return;
+	}
+	dq->cursor_dirty = true;
+	disk_queue_sync(dq);
+	if(dq->wfd >= 0) {
+		close(dq->wfd);
+	}
+	if(dq->rfd >= 0) {
+		close(dq->rfd);
+	}
+	close(dq->lock_fd);
+	close(dq->dir_fd);
+	XFREE(dq->buf);
+	XFREE(dq->dir);
+	XFREE(dq);
+}
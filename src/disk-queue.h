@@ -0,0 +1,49 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// FIFO queue of variable length records stored in a directory as a series
+// of append-only segment files. Records survive program restarts - the
+// queue is reopened with all unconsumed records in place.
+//
+// Reading is done in two steps: disk_queue_read() returns subsequent
+// records without removing them and disk_queue_commit() removes all
+// records read so far. disk_queue_rewind() goes back to the first
+// uncommitted record, so that it can be read again.
+//
+// The queue is not thread safe - callers must serialize access to it.
+
+#ifndef _DISK_QUEUE_H
+#define _DISK_QUEUE_H 1
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct disk_queue disk_queue_t;
+
+disk_queue_t *disk_queue_open(char const *dir, uint64_t max_size, uint64_t segment_size, int sync_interval);
+int disk_queue_append(disk_queue_t *dq, void const *buf, size_t len);
+int disk_queue_read(disk_queue_t *dq, uint8_t const **buf, size_t *len);
+void disk_queue_commit(disk_queue_t *dq);
+void disk_queue_rewind(disk_queue_t *dq);
+bool disk_queue_is_empty(disk_queue_t const *dq);
+uint64_t disk_queue_size(disk_queue_t const *dq);
+void disk_queue_sync(disk_queue_t *dq);
+void disk_queue_close(disk_queue_t *dq);
+
+#endif // !_DISK_QUEUE_H
@@ -0,0 +1,417 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Vectorized signal processing kernels.
+// On x86 the SSE2 or AVX2 variant is chosen at runtime, depending on CPU
+// capabilities. On ARM the NEON variant is used when the compiler targets
+// a NEON-capable CPU (always true for AArch64). Everything else falls back
+// to generic C code.
+
+#define _GNU_SOURCE             // for sincosf
+#include <float.h>              // FLT_MIN
+#include <math.h>               // M_PI, fabsf, sqrtf
+#include <stdint.h>
+#include "config.h"             // SINCOSF
+#include "dsp.h"
+#include "dumpvdl2.h"           // debug_print
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define PHASE_MASK 0xffffff
+// SIMD oscillators are advanced by complex multiplication. To prevent
+// rounding errors from accumulating, they are reinitialized from the phase
+// accumulator every NCO_RENORM_LEN samples.
+#define NCO_RENORM_LEN 256
+
+// Polynomial approximation of arctangent in <0;1> range, max error 1.2e-5 rad
+// (Abramowitz & Stegun, Handbook of Mathematical Functions, 4.4.49)
+#define ATAN_C1  0.9998660f
+#define ATAN_C3 -0.3302995f
+#define ATAN_C5  0.1801410f
+#define ATAN_C7 -0.0851330f
+#define ATAN_C9  0.0208351f
+
+static float sin_lut[257], cos_lut[257];
+
+void sincosf_lut_init() {
+	for(uint32_t i = 0; i < 256; i++)
+		SINCOSF(2.0f * M_PI * (float)i / 256.0f, sin_lut + i, cos_lut + i);
+	sin_lut[256] = sin_lut[0];
+	cos_lut[256] = cos_lut[0];
+}
+
+// phi range must be (0..1), rescaled to 0x0-0xFFFFFF
+void sincosf_lut(uint32_t phi, float *sine, float *cosine) {
+	float v1, v2, fract;
+	uint32_t idx;
+	// get LUT index
+	idx = phi >> 16;
+	// cast fixed point fraction to float
+	fract = (float)(phi & 0xffff) / 65536.0f;
+	// get two adjacent values from LUT and interpolate
+	v1 = sin_lut[idx];
+	v2 = sin_lut[idx+1];
+	*sine = v1 + (v2 - v1) * fract;
+	v1 = cos_lut[idx];
+	v2 = cos_lut[idx+1];
+	*cosine = v1 + (v2 - v1) * fract;
+}
+
+static float atan2_approx(float y, float x) {
+	float const ax = fabsf(x), ay = fabsf(y);
+	float const a = fminf(ax, ay) / fmaxf(fmaxf(ax, ay), FLT_MIN);
+	float const s = a * a;
+	float r = a * (ATAN_C1 + s * (ATAN_C3 + s * (ATAN_C5 + s * (ATAN_C7 + s * ATAN_C9))));
+	if(ay > ax) r = M_PI_2 - r;
+	if(x < 0.0f) r = M_PI - r;
+	return copysignf(r, y);
+}
+
+// Compute initial oscillator values for num_lanes consecutive samples
+// and a phasor which advances each lane by num_lanes samples.
+// The phasor is applied repeatedly, so it is computed without the LUT
+// to avoid accumulating interpolation errors.
+static void nco_lanes_init(uint32_t phi, uint32_t dphi, uint32_t num_lanes,
+		float *lo_re, float *lo_im, float *rot_re, float *rot_im) {
+	for(uint32_t k = 0; k < num_lanes; k++) {
+		sincosf_lut((phi + k * dphi) & PHASE_MASK, lo_im + k, lo_re + k);
+	}
+	SINCOSF(2.0f * M_PI * (float)((num_lanes * dphi) & PHASE_MASK) / 16777216.0f, rot_im, rot_re);
+}
+
+/*********************
+ * Generic C kernels
+ *********************/
+
+static void nco_mix_generic(float const *iq, float *re, float *im, uint32_t n, uint32_t *phi, uint32_t dphi) {
+	uint32_t p = *phi;
+	float s, c;
+	for(uint32_t i = 0; i < n; i++) {
+		float const x = iq[2*i], y = iq[2*i+1];
+		sincosf_lut(p, &s, &c);
+		re[i] = x * c - y * s;
+		im[i] = y * c + x * s;
+		p = (p + dphi) & PHASE_MASK;
+	}
+	*phi = p;
+}
+
+static void cmul_generic(cfloat_t *out, cfloat_t const *a, cfloat_t const *b, uint32_t n) {
+	for(uint32_t i = 0; i < n; i++) {
+		cfloat_t const x = a[i], y = b[i];
+		out[i].re = x.re * y.re - x.im * y.im;
+		out[i].im = x.re * y.im + x.im * y.re;
+	}
+}
+
+static void phase_mag_generic(float const *re, float const *im, float *phase, float *mag, uint32_t n) {
+	for(uint32_t i = 0; i < n; i++) {
+		phase[i] = atan2_approx(im[i], re[i]);
+		mag[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+	}
+}
+
+#ifdef DSP_X86
+
+/*********************
+ * SSE2 kernels
+ *********************/
+
+__attribute__((target("sse2")))
+static void nco_mix_sse2(float const *iq, float *re, float *im, uint32_t n, uint32_t *phi, uint32_t dphi) {
+	uint32_t i = 0;
+	while(n - i >= 4) {
+		uint32_t const len = (n - i < NCO_RENORM_LEN ? n - i : NCO_RENORM_LEN) & ~3u;
+		float l_re[4], l_im[4], r_re, r_im;
+		nco_lanes_init(*phi, dphi, 4, l_re, l_im, &r_re, &r_im);
+		__m128 lo_re = _mm_loadu_ps(l_re), lo_im = _mm_loadu_ps(l_im);
+		__m128 const rot_re = _mm_set1_ps(r_re), rot_im = _mm_set1_ps(r_im);
+		for(uint32_t j = i; j < i + len; j += 4) {
+			__m128 const a = _mm_loadu_ps(iq + 2 * j), b = _mm_loadu_ps(iq + 2 * j + 4);
+			__m128 const x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 const y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(re + j, _mm_sub_ps(_mm_mul_ps(x, lo_re), _mm_mul_ps(y, lo_im)));
+			_mm_storeu_ps(im + j, _mm_add_ps(_mm_mul_ps(y, lo_re), _mm_mul_ps(x, lo_im)));
+			__m128 const t = _mm_sub_ps(_mm_mul_ps(lo_re, rot_re), _mm_mul_ps(lo_im, rot_im));
+			lo_im = _mm_add_ps(_mm_mul_ps(lo_re, rot_im), _mm_mul_ps(lo_im, rot_re));
+			lo_re = t;
+		}
+		*phi = (*phi + len * dphi) & PHASE_MASK;
+		i += len;
+	}
+	nco_mix_generic(iq + 2 * i, re + i, im + i, n - i, phi, dphi);
+}
+
+__attribute__((target("sse2")))
+static void cmul_sse2(cfloat_t *out, cfloat_t const *a, cfloat_t const *b, uint32_t n) {
+	__m128 const neg_even = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+	uint32_t i = 0;
+	for(; i + 2 <= n; i += 2) {
+		__m128 const x = _mm_loadu_ps(&a[i].re), y = _mm_loadu_ps(&b[i].re);
+		__m128 const y_re = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 const y_im = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 const x_swap = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1));
+		__m128 const t = _mm_xor_ps(_mm_mul_ps(x_swap, y_im), neg_even);
+		_mm_storeu_ps(&out[i].re, _mm_add_ps(_mm_mul_ps(x, y_re), t));
+	}
+	cmul_generic(out + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void phase_mag_sse2(float const *re, float const *im, float *phase, float *mag, uint32_t n) {
+	__m128 const sign = _mm_set1_ps(-0.0f), zero = _mm_setzero_ps(), flt_min = _mm_set1_ps(FLT_MIN);
+	__m128 const pi = _mm_set1_ps(M_PI), pi_2 = _mm_set1_ps(M_PI_2);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m128 const x = _mm_loadu_ps(re + i), y = _mm_loadu_ps(im + i);
+		__m128 const ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+		__m128 const a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), flt_min));
+		__m128 const s = _mm_mul_ps(a, a);
+		__m128 r = _mm_set1_ps(ATAN_C9);
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C7));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C5));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C3));
+		r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(ATAN_C1));
+		r = _mm_mul_ps(r, a);
+		__m128 mask = _mm_cmpgt_ps(ay, ax);
+		r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(pi_2, r)), _mm_andnot_ps(mask, r));
+		mask = _mm_cmplt_ps(x, zero);
+		r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(pi, r)), _mm_andnot_ps(mask, r));
+		// r is non-negative here, so copying the sign of y is a bitwise OR
+		_mm_storeu_ps(phase + i, _mm_or_ps(r, _mm_and_ps(y, sign)));
+		_mm_storeu_ps(mag + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y))));
+	}
+	phase_mag_generic(re + i, im + i, phase + i, mag + i, n - i);
+}
+
+static dsp_kernels_t const dsp_sse2 = {
+	.name = "SSE2",
+	.nco_mix = nco_mix_sse2,
+	.cmul = cmul_sse2,
+	.phase_mag = phase_mag_sse2
+};
+
+/*********************
+ * AVX2 kernels
+ *********************/
+
+__attribute__((target("avx2,fma")))
+static void nco_mix_avx2(float const *iq, float *re, float *im, uint32_t n, uint32_t *phi, uint32_t dphi) {
+	uint32_t i = 0;
+	while(n - i >= 8) {
+		uint32_t const len = (n - i < NCO_RENORM_LEN ? n - i : NCO_RENORM_LEN) & ~7u;
+		float l_re[8], l_im[8], r_re, r_im;
+		nco_lanes_init(*phi, dphi, 8, l_re, l_im, &r_re, &r_im);
+		__m256 lo_re = _mm256_loadu_ps(l_re), lo_im = _mm256_loadu_ps(l_im);
+		__m256 const rot_re = _mm256_set1_ps(r_re), rot_im = _mm256_set1_ps(r_im);
+		for(uint32_t j = i; j < i + len; j += 8) {
+			__m256 const a = _mm256_loadu_ps(iq + 2 * j), b = _mm256_loadu_ps(iq + 2 * j + 8);
+			// shuffle works within 128-bit lanes, so the result needs reordering
+			// from (0 1 4 5 2 3 6 7) to (0 1 2 3 4 5 6 7)
+			__m256 x = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m256 y = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			x = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(x), _MM_SHUFFLE(3, 1, 2, 0)));
+			y = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(y), _MM_SHUFFLE(3, 1, 2, 0)));
+			_mm256_storeu_ps(re + j, _mm256_fmsub_ps(x, lo_re, _mm256_mul_ps(y, lo_im)));
+			_mm256_storeu_ps(im + j, _mm256_fmadd_ps(y, lo_re, _mm256_mul_ps(x, lo_im)));
+			__m256 const t = _mm256_fmsub_ps(lo_re, rot_re, _mm256_mul_ps(lo_im, rot_im));
+			lo_im = _mm256_fmadd_ps(lo_re, rot_im, _mm256_mul_ps(lo_im, rot_re));
+			lo_re = t;
+		}
+		*phi = (*phi + len * dphi) & PHASE_MASK;
+		i += len;
+	}
+	nco_mix_sse2(iq + 2 * i, re + i, im + i, n - i, phi, dphi);
+}
+
+__attribute__((target("avx2,fma")))
+static void cmul_avx2(cfloat_t *out, cfloat_t const *a, cfloat_t const *b, uint32_t n) {
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256 const x = _mm256_loadu_ps(&a[i].re), y = _mm256_loadu_ps(&b[i].re);
+		__m256 const y_re = _mm256_moveldup_ps(y), y_im = _mm256_movehdup_ps(y);
+		__m256 const x_swap = _mm256_permute_ps(x, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm256_storeu_ps(&out[i].re, _mm256_fmaddsub_ps(x, y_re, _mm256_mul_ps(x_swap, y_im)));
+	}
+	cmul_sse2(out + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void phase_mag_avx2(float const *re, float const *im, float *phase, float *mag, uint32_t n) {
+	__m256 const sign = _mm256_set1_ps(-0.0f), zero = _mm256_setzero_ps(), flt_min = _mm256_set1_ps(FLT_MIN);
+	__m256 const pi = _mm256_set1_ps(M_PI), pi_2 = _mm256_set1_ps(M_PI_2);
+	uint32_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		__m256 const x = _mm256_loadu_ps(re + i), y = _mm256_loadu_ps(im + i);
+		__m256 const ax = _mm256_andnot_ps(sign, x), ay = _mm256_andnot_ps(sign, y);
+		__m256 const a = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), flt_min));
+		__m256 const s = _mm256_mul_ps(a, a);
+		__m256 r = _mm256_set1_ps(ATAN_C9);
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(ATAN_C7));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(ATAN_C5));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(ATAN_C3));
+		r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(ATAN_C1));
+		r = _mm256_mul_ps(r, a);
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(pi_2, r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(pi, r), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+		_mm256_storeu_ps(phase + i, _mm256_or_ps(r, _mm256_and_ps(y, sign)));
+		_mm256_storeu_ps(mag + i, _mm256_sqrt_ps(_mm256_fmadd_ps(x, x, _mm256_mul_ps(y, y))));
+	}
+	phase_mag_sse2(re + i, im + i, phase + i, mag + i, n - i);
+}
+
+static dsp_kernels_t const dsp_avx2 = {
+	.name = "AVX2",
+	.nco_mix = nco_mix_avx2,
+	.cmul = cmul_avx2,
+	.phase_mag = phase_mag_avx2
+};
+
+#endif // DSP_X86
+
+#ifdef DSP_NEON
+
+/*********************
+ * NEON kernels
+ *********************/
+
+// ARMv7 NEON has no vector division and square root instructions.
+// Use reciprocal estimates refined with Newton-Raphson steps instead.
+static inline float32x4_t neon_div(float32x4_t a, float32x4_t b) {
+#ifdef __aarch64__
+	return vdivq_f32(a, b);
+#else
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+#endif
+}
+
+static inline float32x4_t neon_sqrt(float32x4_t x) {
+#ifdef __aarch64__
+	return vsqrtq_f32(x);
+#else
+	float32x4_t r = vrsqrteq_f32(x);
+	r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, r), r), r);
+	r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(x, r), r), r);
+	// rsqrt(0) is infinite, so zeros have to be handled separately
+	float32x4_t const zero = vdupq_n_f32(0.0f);
+	return vbslq_f32(vceqq_f32(x, zero), zero, vmulq_f32(x, r));
+#endif
+}
+
+static void nco_mix_neon(float const *iq, float *re, float *im, uint32_t n, uint32_t *phi, uint32_t dphi) {
+	uint32_t i = 0;
+	while(n - i >= 4) {
+		uint32_t const len = (n - i < NCO_RENORM_LEN ? n - i : NCO_RENORM_LEN) & ~3u;
+		float l_re[4], l_im[4], r_re, r_im;
+		nco_lanes_init(*phi, dphi, 4, l_re, l_im, &r_re, &r_im);
+		float32x4_t lo_re = vld1q_f32(l_re), lo_im = vld1q_f32(l_im);
+		float32x4_t const rot_re = vdupq_n_f32(r_re), rot_im = vdupq_n_f32(r_im);
+		for(uint32_t j = i; j < i + len; j += 4) {
+			float32x4x2_t const s = vld2q_f32(iq + 2 * j);
+			vst1q_f32(re + j, vmlsq_f32(vmulq_f32(s.val[0], lo_re), s.val[1], lo_im));
+			vst1q_f32(im + j, vmlaq_f32(vmulq_f32(s.val[1], lo_re), s.val[0], lo_im));
+			float32x4_t const t = vmlsq_f32(vmulq_f32(lo_re, rot_re), lo_im, rot_im);
+			lo_im = vmlaq_f32(vmulq_f32(lo_re, rot_im), lo_im, rot_re);
+			lo_re = t;
+		}
+		*phi = (*phi + len * dphi) & PHASE_MASK;
+		i += len;
+	}
+	nco_mix_generic(iq + 2 * i, re + i, im + i, n - i, phi, dphi);
+}
+
+static void cmul_neon(cfloat_t *out, cfloat_t const *a, cfloat_t const *b, uint32_t n) {
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		float32x4x2_t const x = vld2q_f32(&a[i].re), y = vld2q_f32(&b[i].re);
+		float32x4x2_t r;
+		r.val[0] = vmlsq_f32(vmulq_f32(x.val[0], y.val[0]), x.val[1], y.val[1]);
+		r.val[1] = vmlaq_f32(vmulq_f32(x.val[0], y.val[1]), x.val[1], y.val[0]);
+		vst2q_f32(&out[i].re, r);
+	}
+	cmul_generic(out + i, a + i, b + i, n - i);
+}
+
+static void phase_mag_neon(float const *re, float const *im, float *phase, float *mag, uint32_t n) {
+	float32x4_t const zero = vdupq_n_f32(0.0f), flt_min = vdupq_n_f32(FLT_MIN);
+	float32x4_t const pi = vdupq_n_f32(M_PI), pi_2 = vdupq_n_f32(M_PI_2);
+	uint32x4_t const sign = vdupq_n_u32(0x80000000);
+	uint32_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		float32x4_t const x = vld1q_f32(re + i), y = vld1q_f32(im + i);
+		float32x4_t const ax = vabsq_f32(x), ay = vabsq_f32(y);
+		float32x4_t const a = neon_div(vminq_f32(ax, ay), vmaxq_f32(vmaxq_f32(ax, ay), flt_min));
+		float32x4_t const s = vmulq_f32(a, a);
+		float32x4_t r = vdupq_n_f32(ATAN_C9);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C7), r, s);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C5), r, s);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C3), r, s);
+		r = vmlaq_f32(vdupq_n_f32(ATAN_C1), r, s);
+		r = vmulq_f32(r, a);
+		r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(pi_2, r), r);
+		r = vbslq_f32(vcltq_f32(x, zero), vsubq_f32(pi, r), r);
+		uint32x4_t const ur = vorrq_u32(vreinterpretq_u32_f32(r), vandq_u32(vreinterpretq_u32_f32(y), sign));
+		vst1q_f32(phase + i, vreinterpretq_f32_u32(ur));
+		vst1q_f32(mag + i, neon_sqrt(vmlaq_f32(vmulq_f32(x, x), y, y)));
+	}
+	phase_mag_generic(re + i, im + i, phase + i, mag + i, n - i);
+}
+
+static dsp_kernels_t const dsp_neon = {
+	.name = "NEON",
+	.nco_mix = nco_mix_neon,
+	.cmul = cmul_neon,
+	.phase_mag = phase_mag_neon
+};
+
+#endif // DSP_NEON
+
+// generic kernels are used until dsp_init() is called
+dsp_kernels_t dsp = {
+	.name = "generic",
+	.nco_mix = nco_mix_generic,
+	.cmul = cmul_generic,
+	.phase_mag = phase_mag_generic
+};
+
+void dsp_init() {
+#ifdef DSP_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		dsp = dsp_avx2;
+	} else if(__builtin_cpu_supports("sse2")) {
+		dsp = dsp_sse2;
+	}
+#endif
+#ifdef DSP_NEON
+	dsp = dsp_neon;
+#endif
+	fprintf(stderr, "Using %s DSP routines\n", dsp.name);
+}
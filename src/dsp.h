@@ -0,0 +1,46 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DSP_H
+#define _DSP_H 1
+#include <stdint.h>
+#include "fft.h"                // cfloat_t
+
+// Block processing kernels. Each one has a generic implementation and
+// vectorized variants which are selected at runtime by dsp_init().
+typedef struct {
+	char const *name;
+	// Multiply n interleaved I/Q samples by a complex oscillator and store
+	// the result in separate I and Q arrays. phi is the oscillator phase
+	// (0x0-0xFFFFFF == 0..2*pi), dphi is the phase increment per sample.
+	// phi is advanced by n * dphi on return.
+	void (*nco_mix)(float const *iq, float *re, float *im, uint32_t n, uint32_t *phi, uint32_t dphi);
+	// out[i] = a[i] * b[i]
+	void (*cmul)(cfloat_t *out, cfloat_t const *a, cfloat_t const *b, uint32_t n);
+	// Complex argument (-pi..pi) and magnitude of n samples
+	void (*phase_mag)(float const *re, float const *im, float *phase, float *mag, uint32_t n);
+} dsp_kernels_t;
+
+extern dsp_kernels_t dsp;
+
+void dsp_init();
+void sincosf_lut_init();
+void sincosf_lut(uint32_t phi, float *sine, float *cosine);
+
+#endif // !_DSP_H
@@ -33,10 +33,9 @@
 #include "config.h"
 #include "kvargs.h"
 #include "output-common.h"
-#include "decode.h"             // avlc_decoder_thread, avlc_decoder_shutdown, avlc_decoder_init
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
+#include "decode.h"             // avlc_decoder_*, burst_decoder_*
+#include "dsp.h"                // dsp_init, sincosf_lut_init
+#include "demod_sched.h"        // demod_sched_start, demod_sched_stop, demod_sched_set_cpus
 #ifdef WITH_PROFILING
 #include <gperftools/profiler.h>
 #endif
@@ -64,8 +63,6 @@
 int do_exit = 0;
 dumpvdl2_config_t Config;
 
-pthread_barrier_t demods_ready, samples_ready;
-
 void sighandler(int sig) {
 	fprintf(stderr, "Got signal %d, ", sig);
 	if(do_exit == 0) {
@@ -105,20 +102,6 @@ static void setup_signals() {
 	sigaction(SIGTERM, &sigact, NULL);
 }
 
-static void pthread_barrier_new(pthread_barrier_t *barrier, unsigned count) {
-	int ret;
-	if((ret = pthread_barrier_init(barrier, NULL, count)) != 0) {
-		errno = ret;
-		perror("pthread_barrier_init failed");
-		_exit(2);
-	}
-}
-
-static void setup_barriers(vdl2_state_t *ctx) {
-	pthread_barrier_new(&demods_ready, ctx->num_channels+1);
-	pthread_barrier_new(&samples_ready, ctx->num_channels+1);
-}
-
 void start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_ctx) {
 	int ret;
 	if((ret = pthread_create(pth, NULL, start_routine, thread_ctx) != 0)) {
@@ -128,12 +111,6 @@ void start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_c
 	}
 }
 
-static void start_demod_threads(vdl2_state_t *ctx) {
-	for(int i = 0; i < ctx->num_channels; i++) {
-		start_thread(&ctx->channels[i]->demod_thread, &process_samples, ctx->channels[i]);
-	}
-}
-
 void start_output_thread(void *p, void *ctx) {
 	UNUSED(ctx);
 	ASSERT(p != NULL);
@@ -309,6 +286,11 @@ la_list *setup_output(la_list *fmtr_list, char *output_spec) {
 
 	output_instance_t *output = output_instance_new(otd, outfmt, output_cfg);
 	ASSERT(output != NULL);
+	if(output_configure_batching(output, oparams.outopts) < 0 ||
+			output_configure_queue(output, oparams.outopts) < 0) {
+		fprintf(stderr, "Invalid output configuration\n");
+		_exit(1);
+	}
 	fmtr->outputs = la_list_append(fmtr->outputs, output);
 
 	// oparams is no longer needed after this point.
@@ -339,11 +321,9 @@ void process_iq_file(vdl2_state_t *ctx, char *path, enum sample_formats sfmt) {
 	switch(sfmt) {
 		case SFMT_U8:
 			process_buf_uchar_init();
-			sbuf = XCALLOC(FILE_BUFSIZE / sizeof(uint8_t), sizeof(float));
 			process_buf = &process_buf_uchar;
 			break;
 		case SFMT_S16_LE:
-			sbuf = XCALLOC(FILE_BUFSIZE / sizeof(int16_t), sizeof(float));
 			process_buf = &process_buf_short;
 			break;
 		default:
@@ -413,6 +393,17 @@ void usage() {
 #endif
 	fprintf(stderr, "common options:\n");
 	describe_option("--max-ppm <max_ppm>", "Set maximum allowable absolute PPM deviation for valid messages (default: 0 == unlimited)", 1);
+	describe_option("--frontend fft|iir|cic", "Channel filtering method (default: fft)", 1);
+	describe_option("fft", "Shared FFT channelizer (lower CPU usage with many channels)", 2);
+	describe_option("iir", "Per-channel downmixer and IIR lowpass filter", 2);
+	describe_option("cic", "Per-channel downmixer, CIC decimator and compensating FIR filter", 2);
+	describe_option("--squelch <dB>", "Search for VDL2 bursts only when the signal exceeds the noise floor by this margin (default: 0 = disabled)", 1);
+	describe_option("--demod-threads <num_threads>", "Number of demodulator threads (default: number of online CPUs)", 1);
+	describe_option("--demod-cpus <cpu_list>", "Bind demodulator threads to these CPUs (comma-separated numbers or ranges, eg. 0,2-3)", 1);
+	describe_option("--demod-work-stealing", "Let idle demodulator threads process channels assigned to busy ones", 1);
+	describe_option("--decode-threads <num_threads>", "Number of threads performing FEC decoding of VDL2 bursts (default: 1)", 1);
+	describe_option("--avlc-decoder-threads <num_threads>", "Number of threads decoding AVLC frames, split by aircraft (default: 1)", 1);
+	describe_option("--ordered-output", "Output messages in the order of reception when using multiple AVLC decoder threads", 1);
 	describe_option("<freq_1> [<freq_2> [...]]", "VDL2 channel frequencies", 1);
 	fprintf(stderr, "If channel frequencies are omitted, VDL2 Common Signalling Channel (%u Hz) will be used as default.\n\n", CSC_FREQ);
 
@@ -704,7 +695,12 @@ int main(int argc, char **argv) {
 	enum sample_formats sample_fmt = SFMT_UNDEF;
 	la_list *fmtr_list = NULL;
 	bool input_is_iq = true;
-	pthread_t decoder_thread;
+	int demod_threads = 0;
+	float squelch_db = 0.0f;
+	bool demod_work_stealing = false;
+	int decode_threads = 1;
+	int avlc_decoder_threads = 1;
+	bool ordered_output = false;
 #if defined WITH_RTLSDR || defined WITH_MIRISDR || defined WITH_SDRPLAY || defined WITH_SDRPLAY3 || defined WITH_SOAPYSDR
 	char *device = NULL;
 	float gain = SDR_AUTO_GAIN;
@@ -759,6 +755,14 @@ int main(int argc, char **argv) {
 		{ "sample-format",      required_argument,  NULL,   __OPT_SAMPLE_FORMAT },
 		{ "msg-filter",         required_argument,  NULL,   __OPT_MSG_FILTER },
 		{ "max-ppm",            required_argument,  NULL,   __OPT_MAX_PPM },
+		{ "frontend",           required_argument,  NULL,   __OPT_FRONTEND },
+		{ "squelch",            required_argument,  NULL,   __OPT_SQUELCH },
+		{ "demod-threads",      required_argument,  NULL,   __OPT_DEMOD_THREADS },
+		{ "demod-cpus",         required_argument,  NULL,   __OPT_DEMOD_CPUS },
+		{ "demod-work-stealing", no_argument,       NULL,   __OPT_DEMOD_WORK_STEALING },
+		{ "decode-threads",     required_argument,  NULL,   __OPT_DECODE_THREADS },
+		{ "avlc-decoder-threads", required_argument, NULL,  __OPT_AVLC_DECODER_THREADS },
+		{ "ordered-output",     no_argument,        NULL,   __OPT_ORDERED_OUTPUT },
 #ifdef WITH_MIRISDR
 		{ "mirisdr",            required_argument,  NULL,   __OPT_MIRISDR },
 		{ "hw-type",            required_argument,  NULL,   __OPT_HW_TYPE },
@@ -826,6 +830,7 @@ int main(int argc, char **argv) {
 	Config.addrinfo_verbosity = ADDRINFO_NORMAL;
 	Config.msg_filter = MSGFLT_ALL;
 	Config.output_queue_hwm = OUTPUT_QUEUE_HWM_DEFAULT;
+	Config.frontend = FRONTEND_FFT;
 
 	print_version();
 	while((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
@@ -885,6 +890,65 @@ int main(int argc, char **argv) {
 			case __OPT_MAX_PPM:
 				Config.max_ppm = fabsf(strtof(optarg, NULL));
 				break;
+			case __OPT_FRONTEND:
+				if(!strcmp(optarg, "fft")) {
+					Config.frontend = FRONTEND_FFT;
+				} else if(!strcmp(optarg, "iir")) {
+					Config.frontend = FRONTEND_IIR;
+				} else if(!strcmp(optarg, "cic")) {
+					Config.frontend = FRONTEND_CIC;
+				} else {
+					fprintf(stderr, "Invalid value for option --frontend\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				break;
+			case __OPT_SQUELCH:
+				squelch_db = strtof(optarg, NULL);
+				if(squelch_db < 0.0f) {
+					fprintf(stderr, "Invalid value for option --squelch\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				Config.squelch_ratio = squelch_db > 0.0f ? powf(10.0f, squelch_db / 20.0f) : 0.0f;
+				break;
+			case __OPT_DEMOD_THREADS:
+				demod_threads = atoi(optarg);
+				if(demod_threads < 1) {
+					fprintf(stderr, "Invalid value for option --demod-threads\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				break;
+			case __OPT_DEMOD_CPUS:
+				if(demod_sched_set_cpus(optarg) < 0) {
+					fprintf(stderr, "Invalid value for option --demod-cpus\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				break;
+			case __OPT_DEMOD_WORK_STEALING:
+				demod_work_stealing = true;
+				break;
+			case __OPT_DECODE_THREADS:
+				decode_threads = atoi(optarg);
+				if(decode_threads < 1) {
+					fprintf(stderr, "Invalid value for option --decode-threads\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				break;
+			case __OPT_AVLC_DECODER_THREADS:
+				avlc_decoder_threads = atoi(optarg);
+				if(avlc_decoder_threads < 1) {
+					fprintf(stderr, "Invalid value for option --avlc-decoder-threads\n");
+					fprintf(stderr, "Use --help for help\n");
+					_exit(1);
+				}
+				break;
+			case __OPT_ORDERED_OUTPUT:
+				ordered_output = true;
+				break;
 #ifdef WITH_SQLITE
 			case __OPT_BS_DB:
 				bs_db_file = optarg;
@@ -1142,15 +1206,17 @@ int main(int argc, char **argv) {
 
 	setup_signals();
 	start_all_output_threads(fmtr_list);
-	avlc_decoder_init();
-	start_thread(&decoder_thread, avlc_decoder_thread, fmtr_list);
+	avlc_decoder_init(fmtr_list, avlc_decoder_threads, ordered_output);
 
 	if(input_is_iq) {
 		sincosf_lut_init();
-		input_lpf_init(sample_rate);
+		dsp_init();
+		input_lpf_init(sample_rate, oversample);
 		demod_sync_init();
-		setup_barriers(&ctx);
-		start_demod_threads(&ctx);
+		// Demodulators must not miss any samples when reading from a file
+		burst_decoder_init(&ctx, decode_threads);
+		demod_input_init(ctx.num_channels, input == INPUT_IQ_FILE);
+		demod_sched_start(&ctx, demod_threads, demod_work_stealing);
 	}
 
 #ifdef WITH_PROFILING
@@ -1167,7 +1233,7 @@ int main(int argc, char **argv) {
 		case INPUT_IQ_FILE:
 			Config.output_queue_hwm = OUTPUT_QUEUE_HWM_NONE;
 			process_iq_file(&ctx, infile, sample_fmt);
-			pthread_barrier_wait(&demods_ready);
+			demod_input_drain();
 			break;
 #ifdef WITH_RTLSDR
 		case INPUT_RTLSDR:
@@ -1202,6 +1268,9 @@ int main(int argc, char **argv) {
 			exit_code = 5;
 			break;
 	}
+	// Demodulators must not produce any bursts after burst decoders are gone
+	demod_sched_stop();
+	burst_decoder_shutdown();
 	avlc_decoder_shutdown();
 
 	fprintf(stderr, "Waiting for output threads to finish\n");
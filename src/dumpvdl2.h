@@ -25,20 +25,18 @@
 #include <stdint.h>
 #include <stdlib.h>             // abort()
 #include <sys/time.h>
-#include <pthread.h>            // pthread_t, pthread_barrier_t
+#include <pthread.h>            // pthread_t
 #include <libacars/libacars.h>  // la_proto_node
 #include <libacars/vstring.h>   // la_vstring
 #include <libacars/dict.h>      // la_dict
 #include "config.h"
-#ifndef HAVE_PTHREAD_BARRIERS
-#include "pthread_barrier.h"
-#endif
 
 #define RS_K 249                // Reed-Solomon vector length (bytes)
 #define RS_N 255                // Reed-Solomon codeword length (bytes)
 #define TRLEN 17                // transmission length field length (bits)
 #define HDRFECLEN 5             // CRC field length (bits)
 #define HEADER_LEN (3 + TRLEN + HDRFECLEN)
+#define BSLEN 32768UL           // bit stream buffer length (bits)
 #define PREAMBLE_SYMS 16
 #define SYNC_BUFLEN (PREAMBLE_SYMS * SPS)    // length of look-behind buffer used for frame syncing
 #define SPS 10
@@ -98,6 +96,14 @@
 #define __OPT_MILLISECONDS           26
 #define __OPT_PRETTIFY_JSON          27
 #define __OPT_MAX_PPM                 28
+#define __OPT_FRONTEND               29
+#define __OPT_DEMOD_THREADS          30
+#define __OPT_DEMOD_CPUS             31
+#define __OPT_DEMOD_WORK_STEALING    32
+#define __OPT_SQUELCH                33
+#define __OPT_DECODE_THREADS         34
+#define __OPT_AVLC_DECODER_THREADS   35
+#define __OPT_ORDERED_OUTPUT         36
 
 #ifdef WITH_SDRPLAY3
 #define __OPT_SDRPLAY3               70
@@ -201,6 +207,12 @@ typedef enum {
 	ADDRINFO_VERBOSE = 2
 } addrinfo_verbosity_t;
 
+typedef enum {
+	FRONTEND_FFT = 0,
+	FRONTEND_IIR = 1,
+	FRONTEND_CIC = 2
+} frontend_t;
+
 // global config
 typedef struct {
 #ifdef DEBUG
@@ -215,6 +227,8 @@ typedef struct {
 	bool ac_addrinfo_db_available;
 	bool gs_addrinfo_db_available;
 	addrinfo_verbosity_t addrinfo_verbosity;
+	frontend_t frontend;
+	float squelch_ratio;                // signal to noise floor magnitude ratio opening the squelch (0 = disabled)
 } dumpvdl2_config_t;
 
 #define nop() do {} while (0)
@@ -288,8 +302,8 @@ typedef struct {
 	} while(0)
 
 typedef struct {
-	uint8_t *buf;
-	uint32_t start, end, len, descrambler_pos;
+	uint64_t *buf;                      // packed bits, see bitstream.c
+	uint32_t start, end, len, descrambler_pos;  // positions and length in bits
 } bitstream_t;
 
 enum demod_states { DM_INIT, DM_SYNC };
@@ -320,11 +334,14 @@ enum sample_formats { SFMT_U8, SFMT_S16_LE, SFMT_UNDEF };
 
 typedef struct {
 	long long unsigned samplenum;
-	bitstream_t *bs, *frame_bs;
-	float syncbuf[SYNC_BUFLEN];
+	bitstream_t *bs;
+	float syncbuf[2 * SYNC_BUFLEN];     // look-behind buffer stored twice to avoid wrapping the index
+	float sq_hist_re[SYNC_BUFLEN], sq_hist_im[SYNC_BUFLEN];    // samples matching syncbuf, used while squelch is closed
 	float prev_phi;
-	float prev_dphi, dphi;
-	float pherr[3];
+	float dphi;
+	float pherr[2];                     // current and previous frame sync error
+	float pherr_min[3];                 // frame sync error around its minimum (previous, minimum, next)
+	float sync_dphi;                    // frequency error estimate at the minimum
 	float ppm_error;
 	float mag_lp;
 	float mag_nf;
@@ -334,8 +351,12 @@ typedef struct {
 	int syncbufidx;
 	int frame_pwr_cnt;
 	int sclk;
+	int sync_age;                       // frame sync attempts since the minimum (-1 = no candidate)
+	int nfclk;
 	int offset_tuning;
-	int num_fec_corrections;
+	bool nf_settled;                    // noise floor estimate has converged
+	bool squelch_closed;
+	uint32_t squelch_gated, squelch_total;  // sample counts for statistics
 	enum demod_states demod_state;
 	enum decoder_states decoder_state;
 	uint32_t freq;
@@ -344,11 +365,12 @@ typedef struct {
 	uint32_t datalen, datalen_octets, last_block_len_octets, fec_octets;
 	uint32_t num_blocks;
 	uint32_t syndrome;
-	uint16_t lfsr;
+	uint32_t lfsr_pos;                  // position in the scrambler sequence
 	uint16_t oversample;
-	struct timeval tstart;
+	int burst_decoder;                  // index of the burst decoder thread serving this channel
 	struct timeval burst_timestamp;
-	pthread_t demod_thread;
+	struct channelizer_channel *chan;   // NULL when using IIR front end
+	struct demod_frontend *frontend;
 } vdl2_channel_t;
 
 typedef struct {
@@ -362,30 +384,39 @@ int bitstream_append_msbfirst(bitstream_t *bs, uint8_t const *bytes, uint32_t nu
 int bitstream_append_lsbfirst(bitstream_t *bs, uint8_t const *bytes, uint32_t numbytes, uint32_t numbits);
 int bitstream_read_lsbfirst(bitstream_t *bs, uint8_t *bytes, uint32_t numbytes, uint32_t numbits);
 int bitstream_read_word_msbfirst(bitstream_t *bs, uint32_t *ret, uint32_t numbits);
-int bitstream_copy_next_frame(bitstream_t *src, bitstream_t *dst);
-void bitstream_descramble(bitstream_t *bs, uint16_t *lfsr);
+void bitstream_unstuffer_init();
+int bitstream_unstuff_next_frame(bitstream_t *src, uint8_t *dst, uint32_t dst_len,
+		uint32_t *num_bits, uint16_t *fcs);
+void bitstream_descrambler_init(uint16_t iv);
+void bitstream_descramble(bitstream_t *bs, uint32_t *pos);
 void bitstream_reset(bitstream_t *bs);
 void bitstream_destroy(bitstream_t *bs);
 uint32_t reverse(uint32_t v, int numbits);
 
 // demod.c
-extern float *sbuf;
 vdl2_channel_t *vdl2_channel_init(uint32_t centerfreq, uint32_t freq, uint32_t source_rate, uint32_t oversample);
-void sincosf_lut_init();
-void input_lpf_init(uint32_t sample_rate);
+void input_lpf_init(uint32_t sample_rate, uint32_t oversample);
 void demod_sync_init();
 void process_buf_uchar_init();
 void process_buf_uchar(unsigned char *buf, uint32_t len, void *ctx);
 void process_buf_short_init();
 void process_buf_short(unsigned char *buf, uint32_t len, void *ctx);
-void *process_samples(void *arg);
+bool demod_channel_process(vdl2_channel_t *v);
+void demod_input_init(int num_channels, bool wait_when_full);
+void demod_input_drain();
+void demod_input_stop();
+uint64_t demod_input_head();
+void demod_input_wait(uint64_t num_blocks);
 
 // crc.c
-uint16_t crc16_ccitt(uint8_t *data, uint32_t len, uint16_t crc_init);
+#define FCS_INIT        0xFFFFu     // initial CRC value for AVLC frame check sequence
+#define GOOD_FCS        0xF0B8u     // CRC of a frame including its correct FCS
+uint16_t crc16_ccitt(uint8_t const *data, uint32_t len, uint16_t crc_init);
 
 // rs.c
 int rs_init();
-int rs_verify(uint8_t *data, int fec_octets);
+void rs_verify_blocks(uint8_t (*blocks)[RS_N], uint32_t num_blocks,
+		uint32_t last_len, int last_fec, int *ret);
 
 // input-raw_frame_file.c
 #ifdef WITH_PROTOBUF_C
@@ -401,20 +432,26 @@ void statsd_initialize_counter_set(char **counter_set);
 // Can't have char const * pointers here, because statsd-c-client
 // may potentially modify their contents :/
 void statsd_counter_per_channel_increment(uint32_t freq, char *counter);
+void statsd_counter_per_channel_add(uint32_t freq, char *counter, size_t value);
 void statsd_timing_delta_per_channel_send(uint32_t freq, char *timer, struct timeval ts);
 void statsd_counter_per_msgdir_increment(la_msg_dir msg_dir, char *counter);
 void statsd_counter_increment(char *counter);
+void statsd_counter_add(char *counter, size_t value);
 void statsd_gauge_set(char *gauge, size_t value);
 #define statsd_increment_per_channel(freq, counter) statsd_counter_per_channel_increment(freq, counter)
+#define statsd_add_per_channel(freq, counter, value) statsd_counter_per_channel_add(freq, counter, value)
 #define statsd_timing_delta_per_channel(freq, timer, start) statsd_timing_delta_per_channel_send(freq, timer, start)
 #define statsd_increment_per_msgdir(counter, msgdir) statsd_counter_per_msgdir_increment(counter, msgdir)
 #define statsd_increment(counter) statsd_counter_increment(counter)
+#define statsd_add(counter, value) statsd_counter_add(counter, value)
 #define statsd_set(gauge, value) statsd_gauge_set(gauge, value)
 #else
 #define statsd_increment_per_channel(freq, counter) nop()
+#define statsd_add_per_channel(freq, counter, value) nop()
 #define statsd_timing_delta_per_channel(freq, timer, start) nop()
 #define statsd_increment_per_msgdir(counter, msgdir) nop()
 #define statsd_increment(counter) nop()
+#define statsd_add(counter, value) nop()
 #define statsd_set(gauge, value) nop()
 #endif
 
@@ -449,7 +486,7 @@ la_proto_node *unknown_proto_pdu_new(void *buf, size_t len);
 // dumpvdl2.c
 extern int do_exit;
 extern dumpvdl2_config_t Config;
-extern pthread_barrier_t demods_ready, samples_ready;
+void start_thread(pthread_t *pth, void *(*start_routine)(void *), void *thread_ctx);
 void describe_option(char const *name, char const *description, int indent);
 
 // version.c
@@ -0,0 +1,250 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Mixed-radix decimation-in-time FFT.
+// The structure follows KISS FFT by Mark Borgerding: the transform length
+// is factored into radix-4, 2, 3, 5 and (if necessary) larger prime stages.
+// Transform lengths used by the channelizer are multiples of the oversampling
+// factor, which may be any integer, hence radix-2 alone is not enough.
+
+#include <math.h>               // cos, sin, M_PI
+#include <stdint.h>
+#include "fft.h"
+#include "dumpvdl2.h"           // NEW, XCALLOC, XFREE, ASSERT
+
+#define C_MUL(m, a, b) \
+	do { \
+		(m).re = (a).re * (b).re - (a).im * (b).im; \
+		(m).im = (a).re * (b).im + (a).im * (b).re; \
+	} while(0)
+#define C_ADD(res, a, b) do { (res).re = (a).re + (b).re; (res).im = (a).im + (b).im; } while(0)
+#define C_SUB(res, a, b) do { (res).re = (a).re - (b).re; (res).im = (a).im - (b).im; } while(0)
+#define C_ADDTO(res, a) do { (res).re += (a).re; (res).im += (a).im; } while(0)
+
+static void bfly2(cfloat_t *Fout, uint32_t fstride, fft_plan_t const *p, uint32_t m) {
+	cfloat_t *Fout2 = Fout + m;
+	cfloat_t const *tw = p->twiddles;
+	cfloat_t t;
+	for(uint32_t k = 0; k < m; k++) {
+		C_MUL(t, Fout2[k], *tw);
+		tw += fstride;
+		C_SUB(Fout2[k], Fout[k], t);
+		C_ADDTO(Fout[k], t);
+	}
+}
+
+static void bfly3(cfloat_t *Fout, uint32_t fstride, fft_plan_t const *p, uint32_t m) {
+	uint32_t const m2 = 2 * m;
+	cfloat_t const *tw1 = p->twiddles, *tw2 = p->twiddles;
+	float const epi3 = p->twiddles[fstride * m].im;
+	cfloat_t s0, s1, s2, s3;
+	for(uint32_t k = 0; k < m; k++, Fout++) {
+		C_MUL(s1, Fout[m], *tw1);
+		C_MUL(s2, Fout[m2], *tw2);
+		C_ADD(s3, s1, s2);
+		C_SUB(s0, s1, s2);
+		tw1 += fstride;
+		tw2 += 2 * fstride;
+		Fout[m].re = Fout->re - 0.5f * s3.re;
+		Fout[m].im = Fout->im - 0.5f * s3.im;
+		s0.re *= epi3;
+		s0.im *= epi3;
+		C_ADDTO(*Fout, s3);
+		Fout[m2].re = Fout[m].re + s0.im;
+		Fout[m2].im = Fout[m].im - s0.re;
+		Fout[m].re -= s0.im;
+		Fout[m].im += s0.re;
+	}
+}
+
+static void bfly4(cfloat_t *Fout, uint32_t fstride, fft_plan_t const *p, uint32_t m) {
+	uint32_t const m2 = 2 * m, m3 = 3 * m;
+	cfloat_t const *tw1 = p->twiddles, *tw2 = p->twiddles, *tw3 = p->twiddles;
+	cfloat_t s0, s1, s2, s3, s4, s5;
+	for(uint32_t k = 0; k < m; k++, Fout++) {
+		C_MUL(s0, Fout[m], *tw1);
+		C_MUL(s1, Fout[m2], *tw2);
+		C_MUL(s2, Fout[m3], *tw3);
+		C_SUB(s5, *Fout, s1);
+		C_ADDTO(*Fout, s1);
+		C_ADD(s3, s0, s2);
+		C_SUB(s4, s0, s2);
+		C_SUB(Fout[m2], *Fout, s3);
+		tw1 += fstride;
+		tw2 += 2 * fstride;
+		tw3 += 3 * fstride;
+		C_ADDTO(*Fout, s3);
+		if(p->inverse) {
+			Fout[m].re = s5.re - s4.im;
+			Fout[m].im = s5.im + s4.re;
+			Fout[m3].re = s5.re + s4.im;
+			Fout[m3].im = s5.im - s4.re;
+		} else {
+			Fout[m].re = s5.re + s4.im;
+			Fout[m].im = s5.im - s4.re;
+			Fout[m3].re = s5.re - s4.im;
+			Fout[m3].im = s5.im + s4.re;
+		}
+	}
+}
+
+static void bfly5(cfloat_t *Fout, uint32_t fstride, fft_plan_t const *p, uint32_t m) {
+	cfloat_t const *tw = p->twiddles;
+	cfloat_t const ya = tw[fstride * m];
+	cfloat_t const yb = tw[fstride * 2 * m];
+	cfloat_t *F0 = Fout, *F1 = F0 + m, *F2 = F0 + 2 * m, *F3 = F0 + 3 * m, *F4 = F0 + 4 * m;
+	cfloat_t s[13];
+	for(uint32_t u = 0; u < m; u++) {
+		s[0] = *F0;
+		C_MUL(s[1], *F1, tw[u * fstride]);
+		C_MUL(s[2], *F2, tw[2 * u * fstride]);
+		C_MUL(s[3], *F3, tw[3 * u * fstride]);
+		C_MUL(s[4], *F4, tw[4 * u * fstride]);
+		C_ADD(s[7], s[1], s[4]);
+		C_SUB(s[10], s[1], s[4]);
+		C_ADD(s[8], s[2], s[3]);
+		C_SUB(s[9], s[2], s[3]);
+		F0->re += s[7].re + s[8].re;
+		F0->im += s[7].im + s[8].im;
+		s[5].re = s[0].re + s[7].re * ya.re + s[8].re * yb.re;
+		s[5].im = s[0].im + s[7].im * ya.re + s[8].im * yb.re;
+		s[6].re = s[10].im * ya.im + s[9].im * yb.im;
+		s[6].im = -s[10].re * ya.im - s[9].re * yb.im;
+		C_SUB(*F1, s[5], s[6]);
+		C_ADD(*F4, s[5], s[6]);
+		s[11].re = s[0].re + s[7].re * yb.re + s[8].re * ya.re;
+		s[11].im = s[0].im + s[7].im * yb.re + s[8].im * ya.re;
+		s[12].re = -s[10].im * yb.im + s[9].im * ya.im;
+		s[12].im = s[10].re * yb.im - s[9].re * ya.im;
+		C_ADD(*F2, s[11], s[12]);
+		C_SUB(*F3, s[11], s[12]);
+		F0++; F1++; F2++; F3++; F4++;
+	}
+}
+
+static void bfly_generic(cfloat_t *Fout, uint32_t fstride, fft_plan_t const *p, uint32_t m, uint32_t radix) {
+	cfloat_t const *tw = p->twiddles;
+	cfloat_t scratch[radix];
+	cfloat_t t;
+	for(uint32_t u = 0; u < m; u++) {
+		uint32_t k = u;
+		for(uint32_t q1 = 0; q1 < radix; q1++, k += m) {
+			scratch[q1] = Fout[k];
+		}
+		k = u;
+		for(uint32_t q1 = 0; q1 < radix; q1++, k += m) {
+			uint32_t twidx = 0;
+			Fout[k] = scratch[0];
+			for(uint32_t q = 1; q < radix; q++) {
+				twidx += fstride * k;
+				if(twidx >= p->n) twidx -= p->n;
+				C_MUL(t, scratch[q], tw[twidx]);
+				C_ADDTO(Fout[k], t);
+			}
+		}
+	}
+}
+
+static void fft_work(cfloat_t *Fout, cfloat_t const *f, uint32_t fstride,
+		uint32_t const *factors, fft_plan_t const *p) {
+	cfloat_t * const Fout_beg = Fout;
+	uint32_t const radix = factors[0];
+	uint32_t const m = factors[1];
+	cfloat_t const * const Fout_end = Fout + radix * m;
+
+	if(m == 1) {
+		do {
+			*Fout = *f;
+			f += fstride;
+		} while(++Fout != Fout_end);
+	} else {
+		do {
+			fft_work(Fout, f, fstride * radix, factors + 2, p);
+			f += fstride;
+		} while((Fout += m) != Fout_end);
+	}
+	Fout = Fout_beg;
+	switch(radix) {
+		case 2: bfly2(Fout, fstride, p, m); break;
+		case 3: bfly3(Fout, fstride, p, m); break;
+		case 4: bfly4(Fout, fstride, p, m); break;
+		case 5: bfly5(Fout, fstride, p, m); break;
+		default: bfly_generic(Fout, fstride, p, m, radix); break;
+	}
+}
+
+// Factor n into radix stages, preferring radix-4, then 2, 3, 5
+// and odd numbers upwards. Stores (radix, remaining length) pairs.
+static void fft_factor(uint32_t n, uint32_t *factors) {
+	uint32_t radix = 4;
+	uint32_t const floor_sqrt = (uint32_t)floor(sqrt((double)n));
+	int cnt = 0;
+	do {
+		while(n % radix) {
+			switch(radix) {
+				case 4: radix = 2; break;
+				case 2: radix = 3; break;
+				default: radix += 2; break;
+			}
+			if(radix > floor_sqrt) {
+				radix = n;
+			}
+		}
+		n /= radix;
+		ASSERT(cnt < FFT_MAX_FACTORS);
+		factors[2 * cnt] = radix;
+		factors[2 * cnt + 1] = n;
+		cnt++;
+	} while(n > 1);
+}
+
+fft_plan_t *fft_plan_new(uint32_t n, bool inverse) {
+	if(n < 2) {
+		return NULL;
+	}
+	NEW(fft_plan_t, p);
+	p->n = n;
+	p->inverse = inverse;
+	p->twiddles = XCALLOC(n, sizeof(cfloat_t));
+	for(uint32_t i = 0; i < n; i++) {
+		double phase = -2.0 * M_PI * (double)i / (double)n;
+		if(inverse) {
+			phase = -phase;
+		}
+		p->twiddles[i].re = (float)cos(phase);
+		p->twiddles[i].im = (float)sin(phase);
+	}
+	fft_factor(n, p->factors);
+	return p;
+}
+
+// Out-of-place transform; in and out must not overlap.
+// The inverse transform is not normalized.
+void fft_execute(fft_plan_t const *p, cfloat_t const *in, cfloat_t *out) {
+	ASSERT(p != NULL);
+	ASSERT(in != out);
+	fft_work(out, in, 1, p->factors, p);
+}
+
+void fft_plan_destroy(fft_plan_t *p) {
+	if(p != NULL) {
+		XFREE(p->twiddles);
+	}
+	XFREE(p);
+}
@@ -0,0 +1,44 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FFT_H
+#define _FFT_H 1
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FFT_MAX_FACTORS 32
+
+typedef struct {
+	float re, im;
+} cfloat_t;
+
+// Mixed-radix FFT plan. Plans are read-only after creation, so a single
+// plan may be executed concurrently from multiple threads.
+typedef struct {
+	uint32_t n;
+	bool inverse;
+	uint32_t factors[2 * FFT_MAX_FACTORS];
+	cfloat_t *twiddles;
+} fft_plan_t;
+
+fft_plan_t *fft_plan_new(uint32_t n, bool inverse);
+void fft_execute(fft_plan_t const *p, cfloat_t const *in, cfloat_t *out);
+void fft_plan_destroy(fft_plan_t *p);
+
+#endif // !_FFT_H
@@ -0,0 +1,476 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// CBOR (RFC 8949) encoding of decoded messages. The structure of the
+// result is the same as of the JSON formatter output.
+// Protocol nodes only know how to serialize themselves to text and JSON
+// (via la_type_descriptor), so the protocol tree is formatted to JSON first
+// and then converted to CBOR in a single pass. Metadata are encoded directly.
+// Objects and arrays are encoded as indefinite length maps and arrays.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>                     // strtod, strtoll
+#include <string.h>                     // memcpy, memmove
+#include <errno.h>                      // errno
+#include <float.h>                      // FLT_MIN
+#include <math.h>                       // fabs
+#include <libacars/libacars.h>          // la_proto_node, la_proto_tree_format_json
+#include <libacars/vstring.h>           // la_vstring
+#include "fmtr-cbor.h"
+#include "output-common.h"              // fmtr_descriptor_t
+#include "dumpvdl2.h"                   // octet_string_t, DUMPVDL2_VERSION
+
+#define CBOR_UINT           0
+#define CBOR_NEGINT         1
+#define CBOR_TEXT           3
+#define CBOR_FALSE          0xf4
+#define CBOR_TRUE           0xf5
+#define CBOR_NULL           0xf6
+#define CBOR_FLOAT32        0xfa
+#define CBOR_FLOAT64        0xfb
+#define CBOR_ARRAY_INDEF    0x9f
+#define CBOR_MAP_INDEF      0xbf
+#define CBOR_BREAK          0xff
+#define CBOR_HEAD_MAX_LEN   9
+
+// Max nesting level of JSON input
+#define JSON_DEPTH_MAX      64
+
+typedef struct {
+	uint8_t *buf;
+	size_t len;
+	size_t allocated;
+} cbor_buf_t;
+
+static void cbor_reserve(cbor_buf_t *b, size_t n) {
+	if(b->len + n <= b->allocated) {
+		return;
+	}
+	while(b->len + n > b->allocated) {
+		b->allocated *= 2;
+	}
+	b->buf = XREALLOC(b->buf, b->allocated);
+}
+
+static void cbor_put_byte(cbor_buf_t *b, uint8_t val) {
+	cbor_reserve(b, 1);
+	b->buf[b->len++] = val;
+}
+
+static void cbor_put_be(cbor_buf_t *b, uint64_t val, int octets) {
+	for(int i = octets - 1; i >= 0; i--) {
+		b->buf[b->len++] = (val >> (8 * i)) & 0xff;
+	}
+}
+
+// Writes the initial byte of a data item and its argument
+static void cbor_put_head(cbor_buf_t *b, uint8_t major, uint64_t val) {
+	cbor_reserve(b, CBOR_HEAD_MAX_LEN);
+	uint8_t const m = major << 5;
+	if(val < 24) {
+		b->buf[b->len++] = m | val;
+	} else if(val <= UINT8_MAX) {
+		b->buf[b->len++] = m | 24;
+		cbor_put_be(b, val, 1);
+	} else if(val <= UINT16_MAX) {
+		b->buf[b->len++] = m | 25;
+		cbor_put_be(b, val, 2);
+	} else if(val <= UINT32_MAX) {
+		b->buf[b->len++] = m | 26;
+		cbor_put_be(b, val, 4);
+	} else {
+		b->buf[b->len++] = m | 27;
+		cbor_put_be(b, val, 8);
+	}
+}
+
+static void cbor_put_string(cbor_buf_t *b, char const *str, size_t len) {
+	cbor_put_head(b, CBOR_TEXT, len);
+	cbor_reserve(b, len);
+	memcpy(b->buf + b->len, str, len);
+	b->len += len;
+}
+
+static void cbor_put_key(cbor_buf_t *b, char const *key) {
+	cbor_put_string(b, key, strlen(key));
+}
+
+static void cbor_put_int64(cbor_buf_t *b, int64_t val) {
+	if(val >= 0) {
+		cbor_put_head(b, CBOR_UINT, val);
+	} else {
+		cbor_put_head(b, CBOR_NEGINT, -1 - val);
+	}
+}
+
+static void cbor_put_float(cbor_buf_t *b, float val) {
+	uint32_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	cbor_reserve(b, 5);
+	b->buf[b->len++] = CBOR_FLOAT32;
+	cbor_put_be(b, bits, 4);
+}
+
+static void cbor_put_double(cbor_buf_t *b, double val) {
+	uint64_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	cbor_reserve(b, 9);
+	b->buf[b->len++] = CBOR_FLOAT64;
+	cbor_put_be(b, bits, 8);
+}
+
+static void cbor_put_utf8(uint8_t **out, uint32_t cp) {
+	uint8_t *o = *out;
+	if(cp < 0x80) {
+		*o++ = cp;
+	} else if(cp < 0x800) {
+		*o++ = 0xc0 | (cp >> 6);
+		*o++ = 0x80 | (cp & 0x3f);
+	} else if(cp < 0x10000) {
+		*o++ = 0xe0 | (cp >> 12);
+		*o++ = 0x80 | ((cp >> 6) & 0x3f);
+		*o++ = 0x80 | (cp & 0x3f);
+	} else {
+		*o++ = 0xf0 | (cp >> 18);
+		*o++ = 0x80 | ((cp >> 12) & 0x3f);
+		*o++ = 0x80 | ((cp >> 6) & 0x3f);
+		*o++ = 0x80 | (cp & 0x3f);
+	}
+	*out = o;
+}
+
+static int hex4(char const *p, char const *end, uint32_t *result) {
+	if(end - p < 4) {
+		return -1;
+	}
+	uint32_t val = 0;
+	for(int i = 0; i < 4; i++) {
+		char c = p[i];
+		val <<= 4;
+		if(c >= '0' && c <= '9') {
+			val |= c - '0';
+		} else if(c >= 'a' && c <= 'f') {
+			val |= c - 'a' + 10;
+		} else if(c >= 'A' && c <= 'F') {
+			val |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	*result = val;
+	return 0;
+}
+
+// Converts a JSON string. p points past the opening quote.
+// Returns a pointer past the closing quote or NULL on error.
+static char const *json2cbor_string(cbor_buf_t *b, char const *p, char const *end) {
+	char const *start = p;
+	bool escaped = false;
+	while(p < end && *p != '"') {
+		if(*p == '\\') {
+			escaped = true;
+			p++;
+		}
+		p++;
+	}
+	if(p >= end) {
+		return NULL;
+	}
+	if(!escaped) {
+		cbor_put_string(b, start, p - start);
+		return p + 1;
+	}
+	// The unescaped string is never longer than the escaped one. Decode
+	// it after the space reserved for the head and move it in place later.
+	cbor_reserve(b, CBOR_HEAD_MAX_LEN + (p - start));
+	uint8_t *const dst = b->buf + b->len + CBOR_HEAD_MAX_LEN;
+	uint8_t *o = dst;
+	for(char const *s = start; s < p; s++) {
+		if(*s != '\\') {
+			*o++ = *s;
+			continue;
+		}
+		s++;
+		switch(*s) {
+			case 'b': *o++ = '\b'; break;
+			case 'f': *o++ = '\f'; break;
+			case 'n': *o++ = '\n'; break;
+			case 'r': *o++ = '\r'; break;
+			case 't': *o++ = '\t'; break;
+			case 'u': {
+				uint32_t cp, lo;
+				if(hex4(s + 1, p, &cp) < 0) {
+					return NULL;
+				}
+				s += 4;
+				if(cp >= 0xd800 && cp <= 0xdbff && p - s > 6 && s[1] == '\\' && s[2] == 'u' &&
+						hex4(s + 3, p, &lo) == 0 && lo >= 0xdc00 && lo <= 0xdfff) {
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+					s += 6;
+				} else if(cp >= 0xd800 && cp <= 0xdfff) {
+					cp = 0xfffd;        // unpaired surrogate
+				}
+				cbor_put_utf8(&o, cp);
+				break;
+			}
+			default:                    // '"', '\\', '/'
+				*o++ = *s;
+				break;
+		}
+	}
+	size_t const len = o - dst;
+	cbor_put_head(b, CBOR_TEXT, len);
+	memmove(b->buf + b->len, dst, len);
+	b->len += len;
+	return p + 1;
+}
+
+static char const *json2cbor_number(cbor_buf_t *b, char const *p, char const *end) {
+	char const *start = p;
+	bool is_float = false;
+	int digits = 0;                     // significant digits of the mantissa
+	bool leading = true, exponent = false;
+	while(p < end) {
+		char c = *p;
+		if(c >= '0' && c <= '9') {
+			if(!exponent && (c != '0' || !leading)) {
+				leading = false;
+				digits++;
+			}
+		} else if(c == '.') {
+			is_float = true;
+		} else if(c == 'e' || c == 'E') {
+			is_float = exponent = true;
+		} else if(c != '-' && c != '+') {
+			break;
+		}
+		p++;
+	}
+	if(p == start) {
+		return NULL;
+	}
+	char *endptr = NULL;
+	if(!is_float) {
+		errno = 0;
+		long long val = strtoll(start, &endptr, 10);
+		if(endptr == p && errno == 0) {
+			cbor_put_int64(b, val);
+			return p;
+		}
+	}
+	double val = strtod(start, &endptr);
+	if(endptr != p) {
+		return NULL;
+	}
+	// Single precision is enough for up to 6 significant digits, as long as
+	// the value is within the range of normal floats. Range is checked
+	// explicitly, because isfinite() is unreliable with -ffast-math.
+	float const fval = (float)val;
+	bool const in_range = fabs(val) <= FLT_MAX && (val == 0.0 || fabs(val) >= FLT_MIN);
+	if((double)fval == val || (digits <= 6 && in_range)) {
+		cbor_put_float(b, val);
+	} else {
+		cbor_put_double(b, val);
+	}
+	return p;
+}
+
+static char const *json2cbor_value(cbor_buf_t *b, char const *p, char const *end, int depth);
+
+static char const *json_skip_ws(char const *p, char const *end) {
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+// Converts members of a JSON object up to and including the closing brace.
+// p points past the opening brace.
+static char const *json2cbor_members(cbor_buf_t *b, char const *p, char const *end, int depth) {
+	p = json_skip_ws(p, end);
+	if(p < end && *p == '}') {
+		return p + 1;
+	}
+	while(p != NULL && p < end) {
+		if(*p != '"' || (p = json2cbor_string(b, p + 1, end)) == NULL) {
+			return NULL;
+		}
+		p = json_skip_ws(p, end);
+		if(p >= end || *p != ':') {
+			return NULL;
+		}
+		if((p = json2cbor_value(b, p + 1, end, depth)) == NULL) {
+			return NULL;
+		}
+		p = json_skip_ws(p, end);
+		if(p < end && *p == ',') {
+			p = json_skip_ws(p + 1, end);
+		} else if(p < end && *p == '}') {
+			return p + 1;
+		} else {
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+static char const *json2cbor_elements(cbor_buf_t *b, char const *p, char const *end, int depth) {
+	p = json_skip_ws(p, end);
+	if(p < end && *p == ']') {
+		return p + 1;
+	}
+	while(p != NULL && p < end) {
+		if((p = json2cbor_value(b, p, end, depth)) == NULL) {
+			return NULL;
+		}
+		p = json_skip_ws(p, end);
+		if(p < end && *p == ',') {
+			p++;
+		} else if(p < end && *p == ']') {
+			return p + 1;
+		} else {
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+static char const *json2cbor_value(cbor_buf_t *b, char const *p, char const *end, int depth) {
+	p = json_skip_ws(p, end);
+	if(p >= end || depth > JSON_DEPTH_MAX) {
+		return NULL;
+	}
+	switch(*p) {
+		case '{':
+			cbor_put_byte(b, CBOR_MAP_INDEF);
+			if((p = json2cbor_members(b, p + 1, end, depth + 1)) != NULL) {
+				cbor_put_byte(b, CBOR_BREAK);
+			}
+			return p;
+		case '[':
+			cbor_put_byte(b, CBOR_ARRAY_INDEF);
+			if((p = json2cbor_elements(b, p + 1, end, depth + 1)) != NULL) {
+				cbor_put_byte(b, CBOR_BREAK);
+			}
+			return p;
+		case '"':
+			return json2cbor_string(b, p + 1, end);
+		case 't':
+			if(end - p >= 4 && !memcmp(p, "true", 4)) {
+				cbor_put_byte(b, CBOR_TRUE);
+				return p + 4;
+			}
+			return NULL;
+		case 'f':
+			if(end - p >= 5 && !memcmp(p, "false", 5)) {
+				cbor_put_byte(b, CBOR_FALSE);
+				return p + 5;
+			}
+			return NULL;
+		case 'n':
+			if(end - p >= 4 && !memcmp(p, "null", 4)) {
+				cbor_put_byte(b, CBOR_NULL);
+				return p + 4;
+			}
+			return NULL;
+		default:
+			return json2cbor_number(b, p, end);
+	}
+}
+
+static void cbor_put_metadata(cbor_buf_t *b, vdl2_msg_metadata const *m) {
+	// Same keys as in la_vdl2_format_json()
+	cbor_put_key(b, "app");
+	cbor_put_byte(b, CBOR_MAP_INDEF);
+	cbor_put_key(b, "name");
+	cbor_put_key(b, "dumpvdl2");
+	cbor_put_key(b, "ver");
+	cbor_put_key(b, DUMPVDL2_VERSION);
+	cbor_put_byte(b, CBOR_BREAK);
+	if(m->station_id != NULL) {
+		cbor_put_key(b, "station");
+		cbor_put_key(b, m->station_id);
+	}
+	cbor_put_key(b, "t");
+	cbor_put_byte(b, CBOR_MAP_INDEF);
+	cbor_put_key(b, "sec");
+	cbor_put_int64(b, m->burst_timestamp.tv_sec);
+	cbor_put_key(b, "usec");
+	cbor_put_int64(b, m->burst_timestamp.tv_usec);
+	cbor_put_byte(b, CBOR_BREAK);
+	cbor_put_key(b, "freq");
+	cbor_put_int64(b, m->freq);
+	cbor_put_key(b, "burst_len_octets");
+	cbor_put_int64(b, m->datalen_octets);
+	cbor_put_key(b, "hdr_bits_fixed");
+	cbor_put_int64(b, m->synd_weight);
+	cbor_put_key(b, "octets_corrected_by_fec");
+	cbor_put_int64(b, m->num_fec_corrections);
+	cbor_put_key(b, "idx");
+	cbor_put_int64(b, m->idx);
+	cbor_put_key(b, "sig_level");
+	cbor_put_float(b, m->frame_pwr_dbfs);
+	cbor_put_key(b, "noise_level");
+	cbor_put_float(b, m->nf_pwr_dbfs);
+	cbor_put_key(b, "freq_skew");
+	cbor_put_float(b, m->ppm_error);
+}
+
+static bool fmtr_cbor_supports_data_type(fmtr_input_type_t type) {
+	return(type == FMTR_INTYPE_DECODED_FRAME);
+}
+
+static octet_string_t *fmtr_cbor_format_decoded_msg(vdl2_msg_metadata *metadata, la_proto_node *root) {
+	ASSERT(metadata != NULL);
+	ASSERT(root != NULL);
+
+	la_vstring *vstr = la_proto_tree_format_json(NULL, root);
+	cbor_buf_t b = {
+		.allocated = vstr->len + 256
+	};
+	b.buf = XCALLOC(b.allocated, sizeof(uint8_t));
+
+	// {"vdl2": {<metadata>, <protocol tree>}}
+	cbor_put_byte(&b, CBOR_MAP_INDEF);
+	cbor_put_key(&b, "vdl2");
+	cbor_put_byte(&b, CBOR_MAP_INDEF);
+	cbor_put_metadata(&b, metadata);
+	char const *end = vstr->str + vstr->len;
+	char const *p = json_skip_ws(vstr->str, end);
+	if(p >= end || *p != '{' || (p = json2cbor_members(&b, p + 1, end, 1)) == NULL) {
+		debug_print(D_OUTPUT, "malformed JSON input: %s\n", vstr->str);
+		la_vstring_destroy(vstr, true);
+		XFREE(b.buf);
+		return NULL;
+	}
+	la_vstring_destroy(vstr, true);
+	cbor_put_byte(&b, CBOR_BREAK);
+	cbor_put_byte(&b, CBOR_BREAK);
+	return octet_string_new(b.buf, b.len);
+}
+
+fmtr_descriptor_t fmtr_DEF_cbor = {
+	.name = "cbor",
+	.description = "Concise Binary Object Representation (same content as JSON)",
+	.format_decoded_msg = fmtr_cbor_format_decoded_msg,
+	.format_raw_msg = NULL,
+	.supports_data_type = fmtr_cbor_supports_data_type,
+	.output_format = OFMT_CBOR
+};
@@ -0,0 +1,26 @@
+/*
+ *  dumpvdl2 - a VDL Mode 2 message decoder and protocol analyzer
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FMTR_CBOR_H
+#define _FMTR_CBOR_H
+#include "output-common.h"              // fmtr_descriptor_t
+
+extern fmtr_descriptor_t fmtr_DEF_cbor;
+
+#endif // ! _FMTR_CBOR_H
@@ -19,7 +19,7 @@
 
 #include <stdbool.h>
 #include <math.h>                       // round
-#include <time.h>                       // strftime, gmtime, localtime
+#include <time.h>                       // strftime, gmtime_r, localtime_r
 #include <libacars/libacars.h>          // la_proto_node
 #include <libacars/vstring.h>           // la_vstring
 #include "fmtr-text.h"
@@ -31,11 +31,16 @@ static bool fmtr_text_supports_data_type(fmtr_input_type_t type) {
 }
 
 static la_vstring *format_timestamp(struct timeval tv) {
-	struct tm *tmstruct = (Config.utc == true ? gmtime(&tv.tv_sec) : localtime(&tv.tv_sec));
+	struct tm tmstruct;
+	if(Config.utc == true) {
+		gmtime_r(&tv.tv_sec, &tmstruct);
+	} else {
+		localtime_r(&tv.tv_sec, &tmstruct);
+	}
 
 	char tbuf[30], tzbuf[8];
-	strftime(tbuf, sizeof(tbuf), "%F %T", tmstruct);
-	strftime(tzbuf, sizeof(tzbuf), "%Z", tmstruct);
+	strftime(tbuf, sizeof(tbuf), "%F %T", &tmstruct);
+	strftime(tzbuf, sizeof(tzbuf), "%Z", &tmstruct);
 
 	la_vstring *vstr = la_vstring_new();
 	la_vstring_append_sprintf(vstr, "%s", tbuf);
@@ -200,7 +200,6 @@ void mirisdr_init(vdl2_state_t *ctx, char *dev, int flavour, uint32_t sample_rat
 	}
 	mirisdr_reset_buffer(mirisdr);
 	fprintf(stderr, "Device %d started\n", device);
-	sbuf = XCALLOC(MIRISDR_BUFSIZE / sizeof(int16_t), sizeof(float));
 	if(mirisdr_read_async(mirisdr, process_buf_short, NULL, MIRISDR_BUFCNT, MIRISDR_BUFSIZE) < 0) {
 		fprintf(stderr, "Device #%d: async read failed\n", device);
 		_exit(1);
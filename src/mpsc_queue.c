@@ -0,0 +1,144 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Bounded lock-free queue with multiple producers and a single consumer,
+// based on Dmitry Vyukov's bounded MPMC queue. Each cell carries a sequence
+// number: cell i is free for the producer claiming position p when
+// seq == p and holds data for the consumer when seq == p + 1.
+// Producers claim positions with a CAS on tail. The consumer owns head and
+// pops as many ready cells as it can in one go.
+// Like in sample_ring.c, the mutex and condition variable are only used
+// to put the consumer to sleep when the queue is empty or producers when
+// it is full, and wakeups are skipped when nobody sleeps.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "mpsc_queue.h"
+#include "dumpvdl2.h"           // NEW, XCALLOC, ASSERT
+
+// capacity must be a power of 2
+mpsc_queue_t *mpsc_queue_new(size_t capacity) {
+	ASSERT(capacity > 1 && (capacity & (capacity - 1)) == 0);
+	NEW(mpsc_queue_t, q);
+	q->cells = XCALLOC(capacity, sizeof(mpsc_cell_t));
+	q->mask = capacity - 1;
+	for(size_t i = 0; i < capacity; i++) {
+		atomic_init(&q->cells[i].seq, i);
+	}
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->high_water, 0);
+	atomic_init(&q->sleepers, 0);
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	return q;
+}
+
+static void mpsc_queue_wake(mpsc_queue_t *q) {
+	// orders cell updates done before the call with the load of sleepers
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load(&q->sleepers) > 0) {
+		pthread_mutex_lock(&q->mutex);
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+// Waits until the cell at position pos reaches at least sequence number seq
+static void mpsc_queue_wait(mpsc_queue_t *q, size_t pos, size_t seq) {
+	mpsc_cell_t *c = &q->cells[pos & q->mask];
+	pthread_mutex_lock(&q->mutex);
+	atomic_fetch_add(&q->sleepers, 1);
+	while((intptr_t)(atomic_load(&c->seq) - seq) < 0) {
+		pthread_cond_wait(&q->cond, &q->mutex);
+	}
+	atomic_fetch_sub(&q->sleepers, 1);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+// Appends data to the queue. Waits if the queue is full.
+void mpsc_queue_push(mpsc_queue_t *q, void *data) {
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	mpsc_cell_t *c;
+	while(true) {
+		c = &q->cells[pos & q->mask];
+		size_t const seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+		intptr_t const diff = (intptr_t)seq - (intptr_t)pos;
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+						memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if(diff < 0) {
+			// The cell still holds an entry from the previous lap - queue is full
+			mpsc_queue_wait(q, pos, pos);
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		} else {
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+	c->data = data;
+	atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+
+	// The consumer may have already popped this entry and more, so that
+	// head is past pos + 1 - don't let the difference wrap around then
+	intptr_t const depth = (intptr_t)(pos + 1 - atomic_load_explicit(&q->head, memory_order_relaxed));
+	size_t hw = atomic_load_explicit(&q->high_water, memory_order_relaxed);
+	while(depth > 0 && (size_t)depth > hw && !atomic_compare_exchange_weak_explicit(&q->high_water, &hw, depth,
+				memory_order_relaxed, memory_order_relaxed))
+		;
+	mpsc_queue_wake(q);
+}
+
+// Removes up to max entries from the queue and stores them in out.
+// Waits until at least one entry is available. Returns the number of entries.
+// Must be called from one thread only.
+size_t mpsc_queue_pop_batch(mpsc_queue_t *q, void **out, size_t max) {
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t n = 0;
+	while(n < max) {
+		mpsc_cell_t *c = &q->cells[head & q->mask];
+		if(atomic_load_explicit(&c->seq, memory_order_acquire) != head + 1) {
+			if(n > 0) {
+				break;
+			}
+			mpsc_queue_wait(q, head, head + 1);
+		}
+		out[n++] = c->data;
+		atomic_store_explicit(&c->seq, head + q->mask + 1, memory_order_release);
+		head++;
+	}
+	atomic_store_explicit(&q->head, head, memory_order_relaxed);
+	mpsc_queue_wake(q);
+	return n;
+}
+
+// Returns the number of entries waiting in the queue (approximate when
+// called concurrently with push or pop)
+size_t mpsc_queue_depth(mpsc_queue_t *q) {
+	size_t const head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t const tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	return tail > head ? tail - head : 0;
+}
+
+size_t mpsc_queue_high_water(mpsc_queue_t *q) {
+	return atomic_load_explicit(&q->high_water, memory_order_relaxed);
+}
@@ -0,0 +1,50 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MPSC_QUEUE_H
+#define _MPSC_QUEUE_H 1
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	atomic_size_t seq;              // position this cell is ready for (see mpsc_queue.c)
+	void *data;
+} mpsc_cell_t;
+
+// Bounded multiple producer, single consumer queue of pointers
+typedef struct {
+	mpsc_cell_t *cells;
+	size_t mask;                    // capacity - 1
+	atomic_size_t tail;             // next position to be claimed by a producer
+	atomic_size_t head;             // next position to be consumed
+	atomic_size_t high_water;       // maximum depth seen so far
+	atomic_int sleepers;            // number of threads waiting on cond
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} mpsc_queue_t;
+
+mpsc_queue_t *mpsc_queue_new(size_t capacity);
+void mpsc_queue_push(mpsc_queue_t *q, void *data);
+size_t mpsc_queue_pop_batch(mpsc_queue_t *q, void **out, size_t max);
+size_t mpsc_queue_depth(mpsc_queue_t *q);
+size_t mpsc_queue_high_water(mpsc_queue_t *q);
+
+#endif // !_MPSC_QUEUE_H
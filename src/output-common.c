@@ -17,7 +17,12 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>              // errno
+#include <inttypes.h>           // PRIu64
+#include <stdio.h>              // fprintf
+#include <stdlib.h>             // strtol
 #include <string.h>             // memset, strcmp, strdup
+#include <unistd.h>             // usleep
 #include <glib.h>               // g_async_queue_new
 #include <libacars/dict.h>      // la_dict
 #include "config.h"             // WITH_*
@@ -30,12 +35,19 @@
 #include "fmtr-binary.h"        // fmtr_DEF_binary
 #endif
 #include "fmtr-json.h"          // fmtr_DEF_json
+#include "fmtr-cbor.h"          // fmtr_DEF_cbor
 
 #include "output-file.h"        // out_DEF_file
 #include "output-udp.h"         // out_DEF_udp
 #ifdef WITH_ZMQ
 #include "output-zmq.h"         // out_DEF_zmq
 #endif
+#ifdef WITH_TCP_SERVER
+#include "output-tcp.h"         // out_DEF_tcp
+#endif
+#ifdef WITH_SHM
+#include "output-shm.h"         // out_DEF_shm
+#endif
 
 static la_dict const fmtr_intype_names[] = {
 	{
@@ -65,6 +77,7 @@ static la_dict const fmtr_descriptors[] = {
 	{ .id = OFMT_BINARY,                .val = &fmtr_DEF_binary },
 #endif
 	{ .id = OFMT_JSON,                  .val = &fmtr_DEF_json },
+	{ .id = OFMT_CBOR,                  .val = &fmtr_DEF_cbor },
 	{ .id = OFMT_UNKNOWN,               .val = NULL }
 };
 
@@ -73,6 +86,12 @@ static output_descriptor_t * output_descriptors[] = {
 	&out_DEF_udp,
 #ifdef WITH_ZMQ
 	&out_DEF_zmq,
+#endif
+#ifdef WITH_TCP_SERVER
+	&out_DEF_tcp,
+#endif
+#ifdef WITH_SHM
+	&out_DEF_shm,
 #endif
 	NULL
 };
@@ -120,12 +139,101 @@ output_descriptor_t *output_descriptor_get(char const *output_name) {
 	return NULL;
 }
 
+#define OUTPUT_BLOCK_TIMEOUT_DEFAULT 1000
+#define OUTPUT_BLOCK_TIMEOUT_MAX 60000
+#define OUTPUT_QUEUE_REPORT_INTERVAL 1  // seconds
+#define OUTPUT_QUEUE_LOG_INTERVAL 10    // seconds
+#define OUTPUT_SPILL_MAX_SIZE_DEFAULT (1LL << 30)
+#define OUTPUT_SPILL_MAX_SIZE_MIN (1LL << 20)
+#define OUTPUT_SPILL_SEGMENT_SIZE (16 << 20)
+#define OUTPUT_SPILL_SYNC_INTERVAL_DEFAULT 1000
+#define OUTPUT_SPILL_SYNC_INTERVAL_MAX 60000
+#define OUTPUT_RETRY_INTERVAL 1000      // milliseconds
+
+static la_dict const output_overflow_policy_names[] = {
+	{ .id = OUTPUT_OVERFLOW_DROP_NEWEST,    .val = "drop_newest" },
+	{ .id = OUTPUT_OVERFLOW_DROP_OLDEST,    .val = "drop_oldest" },
+	{ .id = OUTPUT_OVERFLOW_BLOCK,          .val = "block" },
+	{ .id = OUTPUT_OVERFLOW_SPILL,          .val = "spill" },
+	{ .id = 0,                              .val = NULL }
+};
+
+static const option_descr_t output_queue_options[] = {
+	{
+		.name = "queue_overflow",
+		.description = "What to do with new messages when the output queue is full: "
+			"drop_newest (default), drop_oldest, block (wait for space) or spill (store them on disk)"
+	},
+	{
+		.name = "queue_block_timeout",
+		.description = "How long to wait for space in the queue when queue_overflow=block, in milliseconds (default: 1000)"
+	},
+	{
+		.name = "spill_dir",
+		.description = "Directory where messages are stored when queue_overflow=spill (required for spill, one per output)"
+	},
+	{
+		.name = "spill_max_size",
+		.description = "Max disk space used in spill_dir, in bytes (default: 1073741824)"
+	},
+	{
+		.name = "spill_sync_interval",
+		.description = "How often to flush spilled messages to disk, in milliseconds, 0 = after every message (default: 1000)"
+	},
+	{
+		.name = NULL,
+		.description = NULL
+	}
+};
+
+#ifdef WITH_STATSD
+// Returns the number of output instances of the given type created so far
+static int output_instance_count(output_descriptor_t const *outtd) {
+	static struct {
+		output_descriptor_t const *td;
+		int count;
+	} counts[sizeof(output_descriptors) / sizeof(output_descriptors[0])];
+	for(size_t i = 0; ; i++) {
+		if(counts[i].td == outtd || counts[i].td == NULL) {
+			counts[i].td = outtd;
+			return ++counts[i].count;
+		}
+	}
+}
+
+// Queue metrics of the n-th instance of an output type are named
+// output.<type>.<n>.queue.*
+static void output_queue_stats_init(output_queue_stats_t *stats, output_descriptor_t *outtd) {
+	static char const *counter_names[] = { "enqueued", "dequeued", "dropped", "spilled", "replayed" };
+	int const n = output_instance_count(outtd);
+	char metric[256];
+	for(size_t i = 0; i < sizeof(counter_names) / sizeof(counter_names[0]); i++) {
+		snprintf(metric, sizeof(metric), "output.%s.%d.queue.%s", outtd->name, n, counter_names[i]);
+		stats->counters[i] = strdup(metric);
+	}
+	snprintf(metric, sizeof(metric), "output.%s.%d.queue.depth", outtd->name, n);
+	stats->depth_gauge = strdup(metric);
+	snprintf(metric, sizeof(metric), "output.%s.%d.queue.spill_bytes", outtd->name, n);
+	stats->spill_size_gauge = strdup(metric);
+}
+#endif
+
 output_instance_t *output_instance_new(output_descriptor_t *outtd, output_format_t format, void *priv) {
 	ASSERT(outtd != NULL);
 	NEW(output_ctx_t, ctx);
 	ctx->q = g_async_queue_new();
 	ctx->format = format;
 	ctx->priv = priv;
+	ctx->batch_size = 1;
+	ctx->batch_latency = 0;
+	ctx->overflow_policy = OUTPUT_OVERFLOW_DROP_NEWEST;
+	ctx->block_timeout = OUTPUT_BLOCK_TIMEOUT_DEFAULT;
+	g_mutex_init(&ctx->space_mutex);
+	g_cond_init(&ctx->space_cond);
+	g_mutex_init(&ctx->spill_mutex);
+#ifdef WITH_STATSD
+	output_queue_stats_init(&ctx->stats, outtd);
+#endif
 	ctx->active = true;
 	NEW(output_instance_t, output);
 	output->td = outtd;
@@ -134,36 +242,409 @@ output_instance_t *output_instance_new(output_descriptor_t *outtd, output_format
 	return output;
 }
 
-output_qentry_t *output_qentry_copy(output_qentry_t const *q) {
-	ASSERT(q != NULL);
+#define OUTPUT_BATCH_SIZE_DEFAULT 64
+#define OUTPUT_BATCH_SIZE_MAX 1024
 
-	NEW(output_qentry_t, copy);
-	if(q->msg != NULL) {
-		copy->msg = octet_string_copy(q->msg);
+// Reads batching parameters of outputs which support it
+int output_configure_batching(output_instance_t *output, kvargs *kv) {
+	ASSERT(output != NULL);
+	ASSERT(kv != NULL);
+	if(output->td->produce_batch == NULL) {
+		return 0;
+	}
+	output_ctx_t *ctx = output->ctx;
+	ctx->batch_size = OUTPUT_BATCH_SIZE_DEFAULT;
+	char *val = NULL, *endptr = NULL;
+	if((val = kvargs_get(kv, "batch_size")) != NULL) {
+		long batch_size = strtol(val, &endptr, 10);
+		if(*endptr != '\0' || batch_size < 1 || batch_size > OUTPUT_BATCH_SIZE_MAX) {
+			fprintf(stderr, "%s: invalid batch_size value: %s (must be 1-%d)\n",
+					output->td->name, val, OUTPUT_BATCH_SIZE_MAX);
+			return -1;
+		}
+		ctx->batch_size = batch_size;
 	}
-	if(q->metadata != NULL) {
-		copy->metadata = vdl2_msg_metadata_copy(q->metadata);
+	if((val = kvargs_get(kv, "batch_latency")) != NULL) {
+		long batch_latency = strtol(val, &endptr, 10);
+		if(*endptr != '\0' || batch_latency < 0 || batch_latency > 10000) {
+			fprintf(stderr, "%s: invalid batch_latency value: %s (must be 0-10000)\n",
+					output->td->name, val);
+			return -1;
+		}
+		ctx->batch_latency = batch_latency;
 	}
-	copy->format = q->format;
-	copy->flags = q->flags;
-	return copy;
+	return 0;
 }
 
-void output_qentry_destroy(output_qentry_t *q) {
+// Opens the spill queue of the output
+static int output_configure_spill(output_instance_t *output, kvargs *kv) {
+	output_ctx_t *ctx = output->ctx;
+	char *dir = NULL, *val = NULL, *endptr = NULL;
+	if((dir = kvargs_get(kv, "spill_dir")) == NULL) {
+		fprintf(stderr, "%s: spill_dir is required when queue_overflow=spill\n", output->td->name);
+		return -1;
+	}
+	long long max_size = OUTPUT_SPILL_MAX_SIZE_DEFAULT;
+	if((val = kvargs_get(kv, "spill_max_size")) != NULL) {
+		max_size = strtoll(val, &endptr, 10);
+		if(*endptr != '\0' || max_size < OUTPUT_SPILL_MAX_SIZE_MIN) {
+			fprintf(stderr, "%s: invalid spill_max_size value: %s (must be at least %lld)\n",
+					output->td->name, val, OUTPUT_SPILL_MAX_SIZE_MIN);
+			return -1;
+		}
+	}
+	long sync_interval = OUTPUT_SPILL_SYNC_INTERVAL_DEFAULT;
+	if((val = kvargs_get(kv, "spill_sync_interval")) != NULL) {
+		sync_interval = strtol(val, &endptr, 10);
+		if(*endptr != '\0' || sync_interval < 0 || sync_interval > OUTPUT_SPILL_SYNC_INTERVAL_MAX) {
+			fprintf(stderr, "%s: invalid spill_sync_interval value: %s (must be 0-%d)\n",
+					output->td->name, val, OUTPUT_SPILL_SYNC_INTERVAL_MAX);
+			return -1;
+		}
+	}
+	long long segment_size = max_size / 4 < OUTPUT_SPILL_SEGMENT_SIZE ? max_size / 4 : OUTPUT_SPILL_SEGMENT_SIZE;
+	if((ctx->spill = disk_queue_open(dir, max_size, segment_size, sync_interval)) == NULL) {
+		fprintf(stderr, "%s: could not open spill directory %s: %s\n", output->td->name, dir,
+				errno == EBUSY ? "already in use" : strerror(errno));
+		return -1;
+	}
+	if(!disk_queue_is_empty(ctx->spill)) {
+		fprintf(stderr, "%s: %s contains messages which have not been sent yet, they will be sent first\n",
+				output->td->name, dir);
+		ctx->spilling = true;
+	}
+	return 0;
+}
+
+// Reads the output queue overflow policy (common to all output types)
+int output_configure_queue(output_instance_t *output, kvargs *kv) {
+	ASSERT(output != NULL);
+	ASSERT(kv != NULL);
+	output_ctx_t *ctx = output->ctx;
+	char *val = NULL, *endptr = NULL;
+	if((val = kvargs_get(kv, "queue_overflow")) != NULL) {
+		la_dict const *d = output_overflow_policy_names;
+		while(d->val != NULL && strcmp(val, d->val) != 0) {
+			d++;
+		}
+		if(d->val == NULL) {
+			fprintf(stderr, "%s: invalid queue_overflow value: %s\n", output->td->name, val);
+			return -1;
+		}
+		ctx->overflow_policy = d->id;
+	}
+	if((val = kvargs_get(kv, "queue_block_timeout")) != NULL) {
+		long block_timeout = strtol(val, &endptr, 10);
+		if(*endptr != '\0' || block_timeout < 1 || block_timeout > OUTPUT_BLOCK_TIMEOUT_MAX) {
+			fprintf(stderr, "%s: invalid queue_block_timeout value: %s (must be 1-%d)\n",
+					output->td->name, val, OUTPUT_BLOCK_TIMEOUT_MAX);
+			return -1;
+		}
+		ctx->block_timeout = block_timeout;
+	}
+	if(ctx->overflow_policy == OUTPUT_OVERFLOW_SPILL) {
+		return output_configure_spill(output, kv);
+	}
+	return 0;
+}
+
+// Creates a queue entry holding a single reference, which belongs to the
+// caller. The entry takes ownership of msg, while metadata is copied.
+output_qentry_t *output_qentry_new(octet_string_t *msg, vdl2_msg_metadata const *metadata,
+		output_format_t format, uint32_t flags) {
+	NEW(output_qentry_t, q);
+	q->msg = msg;
+	if(metadata != NULL) {
+		q->metadata = vdl2_msg_metadata_copy(metadata);
+	}
+	q->format = format;
+	q->flags = flags;
+	q->refcount = 1;
+	return q;
+}
+
+output_qentry_t *output_qentry_ref(output_qentry_t *q) {
+	ASSERT(q != NULL);
+	__atomic_add_fetch(&q->refcount, 1, __ATOMIC_RELAXED);
+	return q;
+}
+
+// Drops a reference. The entry is freed when the last one is gone.
+void output_qentry_release(output_qentry_t *q) {
 	if(q == NULL) {
 		return;
 	}
+	if(__atomic_sub_fetch(&q->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
 	octet_string_destroy(q->msg);
 	vdl2_msg_metadata_destroy(q->metadata);
 	XFREE(q);
 }
 
+// Sends queue statistics to statsd and logs dropped and spilled messages (not more often
+// than every OUTPUT_QUEUE_LOG_INTERVAL seconds, unless final is true)
+static void output_queue_report(output_instance_t *output, gint64 now, bool final) {
+	output_queue_stats_t *stats = &output->ctx->stats;
+	uint64_t const dropped = __atomic_load_n(&stats->dropped, __ATOMIC_RELAXED);
+	uint64_t const spilled = __atomic_load_n(&stats->spilled, __ATOMIC_RELAXED);
+#ifdef WITH_STATSD
+	uint64_t const enqueued = __atomic_load_n(&stats->enqueued, __ATOMIC_RELAXED);
+	uint64_t const dequeued = __atomic_load_n(&stats->dequeued, __ATOMIC_RELAXED);
+	if(enqueued > stats->enqueued_reported) {
+		statsd_add(stats->counters[0], enqueued - stats->enqueued_reported);
+	}
+	if(dequeued > stats->dequeued_reported) {
+		statsd_add(stats->counters[1], dequeued - stats->dequeued_reported);
+	}
+	if(dropped > stats->dropped_reported) {
+		statsd_add(stats->counters[2], dropped - stats->dropped_reported);
+	}
+	if(spilled > stats->spilled_reported) {
+		statsd_add(stats->counters[3], spilled - stats->spilled_reported);
+	}
+	uint64_t const replayed = __atomic_load_n(&stats->replayed, __ATOMIC_RELAXED);
+	if(replayed > stats->replayed_reported) {
+		statsd_add(stats->counters[4], replayed - stats->replayed_reported);
+	}
+	gint const depth = g_async_queue_length(output->ctx->q);
+	statsd_set(stats->depth_gauge, depth > 0 ? depth : 0);
+	if(output->ctx->overflow_policy == OUTPUT_OVERFLOW_SPILL) {
+		uint64_t spill_size = 0;
+		g_mutex_lock(&output->ctx->spill_mutex);
+		if(output->ctx->spill != NULL) {
+			spill_size = disk_queue_size(output->ctx->spill);
+		}
+		g_mutex_unlock(&output->ctx->spill_mutex);
+		statsd_set(stats->spill_size_gauge, spill_size);
+	}
+	stats->enqueued_reported = enqueued;
+	stats->dequeued_reported = dequeued;
+	stats->dropped_reported = dropped;
+	stats->spilled_reported = spilled;
+	stats->replayed_reported = replayed;
+#endif
+	if((dropped > stats->dropped_logged || spilled > stats->spilled_logged) &&
+			(final || now >= stats->next_log)) {
+		if(dropped > stats->dropped_logged) {
+			fprintf(stderr, "%s output queue overflow, %" PRIu64 " message(s) dropped\n",
+					output->td->name, dropped - stats->dropped_logged);
+		}
+		if(spilled > stats->spilled_logged) {
+			fprintf(stderr, "%s output queue overflow, %" PRIu64 " message(s) stored on disk\n",
+					output->td->name, spilled - stats->spilled_logged);
+		}
+		stats->dropped_logged = dropped;
+		stats->spilled_logged = spilled;
+		stats->next_log = now + OUTPUT_QUEUE_LOG_INTERVAL * G_USEC_PER_SEC;
+	}
+	stats->next_report = now + OUTPUT_QUEUE_REPORT_INTERVAL * G_USEC_PER_SEC;
+}
+
+// Reports queue statistics if it's time to do so (or unconditionally, if force
+// is true) and no other thread is doing it
+static void output_queue_report_if_due(output_instance_t *output, bool force) {
+	output_queue_stats_t *stats = &output->ctx->stats;
+	gint64 const now = g_get_monotonic_time();
+	if((force || now >= __atomic_load_n(&stats->next_report, __ATOMIC_RELAXED)) &&
+			!__atomic_exchange_n(&stats->reporting, true, __ATOMIC_ACQUIRE)) {
+		output_queue_report(output, now, force);
+		__atomic_store_n(&stats->reporting, false, __ATOMIC_RELEASE);
+	}
+}
+
+// Waits until the queue length drops below hwm. Returns false on timeout
+// or when the output has stopped.
+static bool output_queue_wait_for_space(output_ctx_t *ctx, int hwm) {
+	gint64 const deadline = g_get_monotonic_time() + ctx->block_timeout * 1000LL;
+	bool has_space = false;
+	g_mutex_lock(&ctx->space_mutex);
+	__atomic_add_fetch(&ctx->space_waiters, 1, __ATOMIC_SEQ_CST);
+	while(!(has_space = g_async_queue_length(ctx->q) < hwm) && ctx->active) {
+		if(!g_cond_wait_until(&ctx->space_cond, &ctx->space_mutex, deadline)) {
+			has_space = g_async_queue_length(ctx->q) < hwm;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&ctx->space_waiters, 1, __ATOMIC_SEQ_CST);
+	g_mutex_unlock(&ctx->space_mutex);
+	return has_space && ctx->active;
+}
+
+// Accounts for n messages taken off the queue and wakes up producers
+// waiting for space, if any
+static void output_queue_consumed(output_ctx_t *ctx, size_t n) {
+	__atomic_add_fetch(&ctx->stats.dequeued, n, __ATOMIC_RELAXED);
+	// Pairs with the increment of space_waiters in output_queue_wait_for_space()
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ctx->space_waiters, __ATOMIC_RELAXED) > 0) {
+		g_mutex_lock(&ctx->space_mutex);
+		g_cond_broadcast(&ctx->space_cond);
+		g_mutex_unlock(&ctx->space_mutex);
+	}
+}
+
+// Spill queue record header. It's followed by the metadata structure (if
+// metadata_len > 0), station_id and the message. Records are read back by the
+// same program, so host byte order and struct layout are fine here.
+// Records written by a build with a different layout are discarded.
+typedef struct {
+	uint8_t version;
+	uint8_t format;
+	uint16_t metadata_len;
+	uint16_t station_id_len;
+} output_spill_hdr_t;
+
+#define OUTPUT_SPILL_RECORD_VERSION 1
+
+// Stores the entry in the spill queue. Returns 0 on success, -1 on error.
+// Must be called with spill_mutex held.
+static int output_spill_append(output_ctx_t *ctx, output_qentry_t const *q) {
+	ASSERT(q->msg != NULL);
+	vdl2_msg_metadata const *m = q->metadata;
+	size_t const station_id_len = (m != NULL && m->station_id != NULL) ? strlen(m->station_id) : 0;
+	output_spill_hdr_t const hdr = {
+		.version = OUTPUT_SPILL_RECORD_VERSION,
+		.format = q->format,
+		.metadata_len = m != NULL ? sizeof(vdl2_msg_metadata) : 0,
+		.station_id_len = station_id_len
+	};
+	size_t const len = sizeof(hdr) + hdr.metadata_len + station_id_len + q->msg->len;
+	uint8_t *buf = XCALLOC(len, sizeof(uint8_t));
+	uint8_t *ptr = buf;
+	memcpy(ptr, &hdr, sizeof(hdr));
+	ptr += sizeof(hdr);
+	if(m != NULL) {
+		memcpy(ptr, m, sizeof(vdl2_msg_metadata));
+		ptr += sizeof(vdl2_msg_metadata);
+		memcpy(ptr, m->station_id, station_id_len);
+		ptr += station_id_len;
+	}
+	memcpy(ptr, q->msg->buf, q->msg->len);
+	int const result = disk_queue_append(ctx->spill, buf, len);
+	XFREE(buf);
+	return result;
+}
+
+// Recreates a queue entry from a spill queue record. Returns NULL if the
+// record is invalid.
+static output_qentry_t *output_spill_record_parse(uint8_t const *buf, size_t len) {
+	output_spill_hdr_t hdr;
+	if(len < sizeof(hdr)) {
+		return NULL;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	if(hdr.version != OUTPUT_SPILL_RECORD_VERSION ||
+			(hdr.metadata_len != 0 && hdr.metadata_len != sizeof(vdl2_msg_metadata)) ||
+			(hdr.metadata_len == 0 && hdr.station_id_len != 0) ||
+			len < sizeof(hdr) + hdr.metadata_len + hdr.station_id_len) {
+		return NULL;
+	}
+	buf += sizeof(hdr);
+	len -= sizeof(hdr);
+	vdl2_msg_metadata *metadata = NULL;
+	if(hdr.metadata_len > 0) {
+		metadata = XCALLOC(1, sizeof(vdl2_msg_metadata));
+		memcpy(metadata, buf, sizeof(vdl2_msg_metadata));
+		metadata->station_id = NULL;
+		if(hdr.station_id_len > 0) {
+			metadata->station_id = XCALLOC(hdr.station_id_len + 1, sizeof(char));
+			memcpy(metadata->station_id, buf + hdr.metadata_len, hdr.station_id_len);
+		}
+		buf += hdr.metadata_len + hdr.station_id_len;
+		len -= hdr.metadata_len + hdr.station_id_len;
+	}
+	// Text formats are expected to be NUL-terminated
+	uint8_t *msgbuf = XCALLOC(len + 1, sizeof(uint8_t));
+	memcpy(msgbuf, buf, len);
+	NEW(output_qentry_t, q);
+	q->msg = octet_string_new(msgbuf, len);
+	q->metadata = metadata;
+	q->format = hdr.format;
+	q->refcount = 1;
+	return q;
+}
+
+// Spill policy: the entry goes to the memory queue only if there's space in
+// it and there are no spilled messages waiting to be sent (otherwise they
+// would be sent out of order). Returns false if the entry has been dropped.
+static bool output_queue_push_or_spill(output_ctx_t *ctx, output_qentry_t *qentry, int hwm) {
+	bool result = true;
+	g_mutex_lock(&ctx->spill_mutex);
+	if(!ctx->spilling && (hwm == OUTPUT_QUEUE_HWM_NONE || g_async_queue_length(ctx->q) < hwm)) {
+		g_async_queue_push(ctx->q, output_qentry_ref(qentry));
+		__atomic_add_fetch(&ctx->stats.enqueued, 1, __ATOMIC_RELAXED);
+	} else if(ctx->spill != NULL && output_spill_append(ctx, qentry) == 0) {
+		ctx->spilling = true;
+		__atomic_add_fetch(&ctx->stats.spilled, 1, __ATOMIC_RELAXED);
+	} else {
+		result = false;
+	}
+	g_mutex_unlock(&ctx->spill_mutex);
+	return result;
+}
+
+// Passes the entry to the output, applying the overflow policy of the output
+// if its queue is full. Can be used as a la_list_foreach callback.
+void output_queue_push(void *data, void *ctx) {
+	ASSERT(data != NULL);
+	ASSERT(ctx != NULL);
+	output_instance_t *output = data;
+	output_qentry_t *qentry = ctx;
+	output_ctx_t *octx = output->ctx;
+
+	if(qentry->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+		__atomic_store_n(&octx->shutdown_requested, true, __ATOMIC_RELAXED);
+		g_async_queue_push(octx->q, output_qentry_ref(qentry));
+		return;
+	}
+	if(!octx->active) {
+		debug_print(D_OUTPUT, "%s output %p is inactive, skipping\n", output->td->name, output);
+		return;
+	}
+	int const hwm = Config.output_queue_hwm;
+	bool pushed = true;
+	uint64_t dropped = 0;
+	if(octx->overflow_policy == OUTPUT_OVERFLOW_SPILL) {
+		pushed = false;     // counted in output_queue_push_or_spill
+		dropped = output_queue_push_or_spill(octx, qentry, hwm) ? 0 : 1;
+	} else if(hwm == OUTPUT_QUEUE_HWM_NONE) {
+		g_async_queue_push(octx->q, output_qentry_ref(qentry));
+	} else if(octx->overflow_policy == OUTPUT_OVERFLOW_DROP_OLDEST) {
+		g_async_queue_lock(octx->q);
+		while(g_async_queue_length_unlocked(octx->q) >= hwm) {
+			output_qentry_t *oldest = g_async_queue_try_pop_unlocked(octx->q);
+			if(oldest == NULL) {
+				break;
+			}
+			output_qentry_release(oldest);
+			dropped++;
+		}
+		g_async_queue_push_unlocked(octx->q, output_qentry_ref(qentry));
+		g_async_queue_unlock(octx->q);
+	} else if(g_async_queue_length(octx->q) < hwm ||
+			(octx->overflow_policy == OUTPUT_OVERFLOW_BLOCK && output_queue_wait_for_space(octx, hwm))) {
+		g_async_queue_push(octx->q, output_qentry_ref(qentry));
+	} else {
+		pushed = false;
+		dropped = 1;
+	}
+	if(pushed) {
+		__atomic_add_fetch(&octx->stats.enqueued, 1, __ATOMIC_RELAXED);
+		debug_print(D_OUTPUT, "dispatched %s output %p\n", output->td->name, output);
+	}
+	if(dropped > 0) {
+		__atomic_add_fetch(&octx->stats.dropped, dropped, __ATOMIC_RELAXED);
+	}
+	output_queue_report_if_due(output, false);
+}
+
 void output_queue_drain(GAsyncQueue *q) {
 	ASSERT(q != NULL);
 	g_async_queue_lock(q);
 	while(g_async_queue_length_unlocked(q) > 0) {
 		output_qentry_t *qentry = g_async_queue_pop_unlocked(q);
-		output_qentry_destroy(qentry);
+		output_qentry_release(qentry);
 	}
 	g_async_queue_unlock(q);
 }
@@ -208,6 +689,10 @@ void output_usage() {
 			"\n%*s<output_parameters> - specifies detailed output options with a syntax of: param1=value1,param2=value2,...\n",
 			IND(1), ""
 		   );
+	fprintf(stderr, "\nParameters common to all output types:\n\n");
+	for(option_descr_t const *opt = output_queue_options; opt->name != NULL; opt++) {
+		describe_option(opt->name, opt->description, 2);
+	}
 	for(output_descriptor_t **od = output_descriptors; *od != NULL; od++) {
 		fprintf(stderr, "\nParameters for output type '%s':\n\n", (*od)->name);
 		if((*od)->options != NULL) {
@@ -219,6 +704,220 @@ void output_usage() {
 	fprintf(stderr, "\n");
 }
 
+// Collects messages following the first one into a batch, as long as they
+// are available within the latency budget. Returns the number of messages.
+// A shutdown request ends the batch and is returned in *shutdown.
+static size_t output_batch_collect(output_ctx_t *ctx, output_qentry_t **batch, output_qentry_t **shutdown) {
+	size_t n = 1;
+	gint64 const deadline = g_get_monotonic_time() + ctx->batch_latency * 1000LL;
+	while(n < ctx->batch_size) {
+		output_qentry_t *q = g_async_queue_try_pop(ctx->q);
+		if(q == NULL && ctx->batch_latency > 0) {
+			gint64 const remaining = deadline - g_get_monotonic_time();
+			if(remaining > 0) {
+				q = g_async_queue_timeout_pop(ctx->q, remaining);
+			}
+		}
+		if(q == NULL) {
+			break;
+		}
+		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			*shutdown = q;
+			break;
+		}
+		batch[n++] = q;
+	}
+	return n;
+}
+
+// Passes n messages to the output. Returns the number of messages at the end
+// of the batch which could not be delivered or a negative value on error.
+static int output_produce(output_instance_t *oi, output_qentry_t **batch, size_t n) {
+	output_ctx_t *ctx = oi->ctx;
+	if(oi->td->produce_batch != NULL) {
+		int const result = oi->td->produce_batch(ctx->priv, batch, n);
+		return result > (int)n ? (int)n : result;
+	}
+	for(size_t i = 0; i < n; i++) {
+		int const result = oi->td->produce(ctx->priv, batch[i]->format, batch[i]->metadata, batch[i]->msg);
+		if(result != 0) {
+			return result < 0 ? result : (int)(n - i);
+		}
+	}
+	return 0;
+}
+
+// Returns true if the output should stop retrying and finish its work
+static bool output_exiting(output_ctx_t *ctx) {
+	return do_exit || __atomic_load_n(&ctx->shutdown_requested, __ATOMIC_RELAXED);
+}
+
+// Waits before retrying delivery of messages to an unreachable destination.
+// Returns false if the program is exiting.
+static bool output_retry_wait(output_ctx_t *ctx) {
+	// Make sure that whatever has been spilled so far is on disk while we wait
+	g_mutex_lock(&ctx->spill_mutex);
+	disk_queue_sync(ctx->spill);
+	g_mutex_unlock(&ctx->spill_mutex);
+	for(int t = 0; t < OUTPUT_RETRY_INTERVAL && !output_exiting(ctx); t += 100) {
+		usleep(100000);
+	}
+	return !output_exiting(ctx);
+}
+
+// Stores n undelivered messages in the spill queue, followed by all messages
+// waiting in the memory queue, so that they are retried from there in the
+// original order. Must be called with spill_mutex held.
+static void output_spill_move(output_ctx_t *ctx, output_qentry_t **batch, size_t n) {
+	uint64_t spilled = 0, dropped = 0;
+	for(size_t i = 0; i < n; i++) {
+		if(output_spill_append(ctx, batch[i]) == 0) {
+			spilled++;
+		} else {
+			dropped++;
+		}
+	}
+	output_qentry_t *q = NULL, *shutdown = NULL;
+	size_t consumed = 0;
+	while((q = g_async_queue_try_pop(ctx->q)) != NULL) {
+		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			shutdown = q;
+			continue;
+		}
+		if(output_spill_append(ctx, q) == 0) {
+			spilled++;
+		} else {
+			dropped++;
+		}
+		output_qentry_release(q);
+		consumed++;
+	}
+	if(shutdown != NULL) {
+		g_async_queue_push(ctx->q, shutdown);
+	}
+	ctx->spilling = true;
+	__atomic_add_fetch(&ctx->stats.spilled, spilled, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->stats.dropped, dropped, __ATOMIC_RELAXED);
+	output_queue_consumed(ctx, consumed);
+}
+
+// Passes messages taken off the memory queue to the output. If the output
+// has a spill queue, undelivered messages are moved there and retried later.
+// Otherwise they are dropped. Returns a negative value on error.
+static int output_deliver(output_instance_t *oi, output_qentry_t **batch, size_t n) {
+	output_ctx_t *ctx = oi->ctx;
+	size_t done = 0;
+	while(done < n) {
+		int const result = output_produce(oi, batch + done, n - done);
+		if(result <= 0) {
+			return result;
+		}
+		done = n - result;
+		if(ctx->spill == NULL) {
+			__atomic_add_fetch(&ctx->stats.dropped, result, __ATOMIC_RELAXED);
+			return 0;
+		}
+		g_mutex_lock(&ctx->spill_mutex);
+		bool const spilling = ctx->spilling;
+		if(!spilling) {
+			output_spill_move(ctx, batch + done, n - done);
+		}
+		g_mutex_unlock(&ctx->spill_mutex);
+		if(!spilling) {
+			return 0;
+		}
+		// Spilled messages are newer than these ones, so these must
+		// be retried in place, unless the program is exiting
+		if(!output_retry_wait(ctx)) {
+			g_mutex_lock(&ctx->spill_mutex);
+			output_spill_move(ctx, batch + done, n - done);
+			g_mutex_unlock(&ctx->spill_mutex);
+			return 0;
+		}
+	}
+	return 0;
+}
+
+// Reads up to max messages from the spill queue into batch. Invalid records
+// are skipped (and counted as dropped, unless count_dropped is false).
+// Must be called with spill_mutex held.
+static size_t output_spill_read(output_ctx_t *ctx, output_qentry_t **batch, size_t max, bool count_dropped) {
+	size_t n = 0;
+	uint8_t const *buf = NULL;
+	size_t len = 0;
+	while(n < max && disk_queue_read(ctx->spill, &buf, &len) == 1) {
+		if((batch[n] = output_spill_record_parse(buf, len)) != NULL) {
+			n++;
+		} else if(count_dropped) {
+			debug_print(D_OUTPUT, "skipping invalid spill queue record (%zu bytes)\n", len);
+			__atomic_add_fetch(&ctx->stats.dropped, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return n;
+}
+
+// Sends a batch of messages from the spill queue. Returns 1 if there are more
+// messages to send, 0 if the spill queue is empty, negative value on error.
+static int output_spill_replay(output_instance_t *oi, output_qentry_t **batch) {
+	output_ctx_t *ctx = oi->ctx;
+	g_mutex_lock(&ctx->spill_mutex);
+	if(!ctx->spilling) {
+		// The spill queue is empty
+		g_mutex_unlock(&ctx->spill_mutex);
+		return 0;
+	}
+	size_t const n = output_spill_read(ctx, batch, ctx->batch_size, true);
+	if(n == 0) {
+		// Remove invalid records skipped by output_spill_read, if any
+		disk_queue_commit(ctx->spill);
+		// New messages may go to the memory queue from now on
+		ctx->spilling = !disk_queue_is_empty(ctx->spill);
+		int const more = ctx->spilling;
+		g_mutex_unlock(&ctx->spill_mutex);
+		return more;
+	}
+	g_mutex_unlock(&ctx->spill_mutex);
+
+	int const result = output_produce(oi, batch, n);
+	for(size_t i = 0; i < n; i++) {
+		output_qentry_release(batch[i]);
+	}
+	size_t const delivered = result > 0 ? n - result : n;
+
+	g_mutex_lock(&ctx->spill_mutex);
+	if(delivered < n) {
+		// Remove only the delivered messages from the spill queue
+		disk_queue_rewind(ctx->spill);
+		size_t const m = output_spill_read(ctx, batch, delivered, false);
+		for(size_t i = 0; i < m; i++) {
+			output_qentry_release(batch[i]);
+		}
+	}
+	disk_queue_commit(ctx->spill);
+	g_mutex_unlock(&ctx->spill_mutex);
+	// These were counted as spilled, not enqueued
+	__atomic_add_fetch(&ctx->stats.replayed, delivered, __ATOMIC_RELAXED);
+
+	if(result < 0) {
+		return result;
+	}
+	if(result > 0) {
+		output_retry_wait(ctx);
+	}
+	return 1;
+}
+
+// Closes the spill queue. Undelivered messages stay on disk
+// and are sent when the program is started again.
+static void output_spill_close(output_ctx_t *ctx) {
+	g_mutex_lock(&ctx->spill_mutex);
+	if(ctx->spill != NULL) {
+		disk_queue_close(ctx->spill);
+		ctx->spill = NULL;
+	}
+	g_mutex_unlock(&ctx->spill_mutex);
+}
+
 void *output_thread(void *arg) {
 	ASSERT(arg != NULL);
 	output_instance_t *oi = arg;
@@ -231,27 +930,73 @@ void *output_thread(void *arg) {
 		}
 	}
 
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(ctx->stats.counters);
+#endif
+	// batch_size is 1 for outputs which do not support batching
+	output_qentry_t **batch = XCALLOC(ctx->batch_size, sizeof(output_qentry_t *));
+
 	while(1) {
-		output_qentry_t *q = g_async_queue_pop(ctx->q);
+		output_qentry_t *q = g_async_queue_try_pop(ctx->q);
+		// Spilled messages are sent only after the memory queue is empty,
+		// because they are newer than whatever is in there
+		if(q == NULL && ctx->spill != NULL && !output_exiting(ctx)) {
+			int const result = output_spill_replay(oi, batch);
+			if(result < 0) {
+				break;
+			} else if(result > 0) {
+				continue;
+			}
+		}
+		if(q == NULL) {
+			int timeout = 0;
+			if(oi->td->flush != NULL && (timeout = oi->td->flush(ctx->priv)) < 0) {
+				break;
+			}
+			if(timeout > 0) {
+				if((q = g_async_queue_timeout_pop(ctx->q, (guint64)timeout * 1000)) == NULL) {
+					continue;
+				}
+			} else {
+				q = g_async_queue_pop(ctx->q);
+			}
+		}
 		ASSERT(q != NULL);
 		if(q->flags & OUT_FLAG_ORDERED_SHUTDOWN) {
+			output_qentry_release(q);
+			break;
+		}
+		output_qentry_t *shutdown = NULL;
+		batch[0] = q;
+		size_t const n = output_batch_collect(ctx, batch, &shutdown);
+		output_queue_consumed(ctx, n);
+		int const result = output_deliver(oi, batch, n);
+		for(size_t i = 0; i < n; i++) {
+			output_qentry_release(batch[i]);
+		}
+		if(shutdown != NULL) {
+			output_qentry_release(shutdown);
 			break;
 		}
-		int result = oi->td->produce(ctx->priv, q->format, q->metadata, q->msg);
-		output_qentry_destroy(q);
 		if(result < 0) {
 			break;
 		}
 	}
+	XFREE(batch);
 
 	if(oi->td->handle_shutdown != NULL) {
 		oi->td->handle_shutdown(ctx->priv);
 	}
 	ctx->active = false;
+	output_queue_consumed(ctx, 0);      // wake up blocked producers
+	output_spill_close(ctx);
+	output_queue_report_if_due(oi, true);
 	return NULL;
 
 fail:
 	ctx->active = false;
+	output_queue_consumed(ctx, 0);
+	output_spill_close(ctx);
 	if(oi->td->handle_failure != NULL) {
 		oi->td->handle_failure(ctx->priv);
 	}
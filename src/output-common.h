@@ -26,6 +26,7 @@
 #include <libacars/list.h>              // la_list
 #include "dumpvdl2.h"                   // octet_string_t
 #include "kvargs.h"                     // kvargs
+#include "disk-queue.h"                 // disk_queue_t
 
 // Metadata of a VDL2 frame
 typedef struct {
@@ -55,7 +56,8 @@ typedef enum {
 	OFMT_TEXT       = 1,
 	OFMT_PP_ACARS   = 2,
 	OFMT_BINARY     = 3,
-	OFMT_JSON       = 4
+	OFMT_JSON       = 4,
+	OFMT_CBOR       = 5
 } output_format_t;
 
 typedef octet_string_t* (fmt_decoded_fun_t)(vdl2_msg_metadata *, la_proto_node *);
@@ -79,10 +81,29 @@ typedef struct {
 	la_list *outputs;                // list of output descriptors where the formatted message should be sent
 } fmtr_instance_t;
 
+// Messages passed via output queues. A single entry is shared by all
+// outputs it's been pushed to, so it must not be modified after creation.
+typedef struct {
+	octet_string_t *msg;            // formatted message
+	vdl2_msg_metadata *metadata;    // message metadata
+	output_format_t format;         // format of the data stored in msg
+	uint32_t flags;                 // flags
+	int refcount;                   // number of references held by queues and producers
+} output_qentry_t;
+
 typedef bool (output_format_check_fun_t)(output_format_t);
 typedef void* (output_configure_fun_t)(kvargs *);
 typedef int (output_init_fun_t)(void *);
-typedef int (output_produce_msg_fun_t)(void *, output_format_t, vdl2_msg_metadata *, octet_string_t *);
+// Produce functions return 0 on success or a negative value on fatal error.
+// A positive value n means that the last n messages (out of those passed in)
+// could not be delivered, because the destination is unreachable. They are
+// retried later if the output has a spill queue, otherwise they are dropped.
+typedef int (output_produce_msg_fun_t)(void *, output_format_t, vdl2_msg_metadata const *, octet_string_t const *);
+typedef int (output_produce_batch_fun_t)(void *, output_qentry_t **, size_t);
+// Called when the output queue is empty. Returns the number of milliseconds
+// after which it should be called again if no messages arrive in the meantime
+// (0 = not needed) or a negative value on error.
+typedef int (output_flush_fun_t)(void *);
 typedef void (output_shutdown_handler_fun_t)(void *);
 typedef void (output_failure_handler_fun_t)(void *);
 
@@ -95,15 +116,55 @@ typedef struct {
 	output_configure_fun_t *configure;
 	output_init_fun_t *init;
 	output_produce_msg_fun_t *produce;
+	output_produce_batch_fun_t *produce_batch;      // optional, used instead of produce
+	output_flush_fun_t *flush;
 	output_shutdown_handler_fun_t *handle_shutdown;
 	output_failure_handler_fun_t *handle_failure;
 } output_descriptor_t;
 
+// What to do with a message when the output queue is full
+typedef enum {
+	OUTPUT_OVERFLOW_DROP_NEWEST = 0,
+	OUTPUT_OVERFLOW_DROP_OLDEST,
+	OUTPUT_OVERFLOW_BLOCK,
+	OUTPUT_OVERFLOW_SPILL
+} output_overflow_policy_t;
+
+// Output queue statistics. Message counts are updated atomically by producers
+// and the output thread. The rest is only touched by whoever is reporting.
+typedef struct {
+	uint64_t enqueued;
+	uint64_t dequeued;
+	uint64_t dropped;
+	uint64_t spilled;
+	uint64_t replayed;              // messages sent from the spill queue
+	uint64_t enqueued_reported, dequeued_reported, dropped_reported, spilled_reported, replayed_reported;
+	uint64_t dropped_logged, spilled_logged;
+	gint64 next_report;             // monotonic time (us)
+	gint64 next_log;                // monotonic time (us)
+	bool reporting;                 // a report is being done right now
+	char *counters[6];              // statsd counter names (NULL-terminated)
+	char *depth_gauge;              // statsd gauge names
+	char *spill_size_gauge;
+} output_queue_stats_t;
+
 // Output instance context (passed to the thread routine)
 typedef struct {
 	GAsyncQueue *q;                 // input queue
 	void *priv;                     // output instance context (private)
 	output_format_t format;         // format of the data fed into the output
+	size_t batch_size;              // max number of messages passed to produce_batch at once
+	int batch_latency;              // max time in ms to wait for a batch to fill up
+	output_overflow_policy_t overflow_policy;
+	int block_timeout;              // max time in ms to wait for space in the queue (OUTPUT_OVERFLOW_BLOCK)
+	GMutex space_mutex;
+	GCond space_cond;               // signalled when messages are taken off the queue
+	int space_waiters;              // number of producers waiting on space_cond
+	disk_queue_t *spill;            // spill queue (OUTPUT_OVERFLOW_SPILL)
+	bool spilling;                  // new messages go to the spill queue
+	GMutex spill_mutex;             // protects spill and spilling
+	bool shutdown_requested;        // OUT_FLAG_ORDERED_SHUTDOWN entry has been queued
+	output_queue_stats_t stats;
 	bool active;                    // output thread is running
 } output_ctx_t;
 
@@ -114,13 +175,6 @@ typedef struct {
 	output_ctx_t *ctx;              // context data for the thread
 } output_instance_t;
 
-// Messages passed via output queues
-typedef struct {
-	octet_string_t *msg;            // formatted message
-	vdl2_msg_metadata *metadata;    // message metadata
-	output_format_t format;         // format of the data stored in msg
-	uint32_t flags;                 // flags
-} output_qentry_t;
 
 // output queue entry flags
 #define OUT_FLAG_ORDERED_SHUTDOWN (1 << 0)
@@ -132,8 +186,13 @@ fmtr_instance_t *fmtr_instance_new(fmtr_descriptor_t *fmttd, fmtr_input_type_t i
 output_format_t output_format_from_string(char const *str);
 output_descriptor_t *output_descriptor_get(char const *output_name);
 output_instance_t *output_instance_new(output_descriptor_t *outtd, output_format_t format, void *priv);
-output_qentry_t *output_qentry_copy(output_qentry_t const *q);
-void output_qentry_destroy(output_qentry_t *q);
+int output_configure_batching(output_instance_t *output, kvargs *kv);
+int output_configure_queue(output_instance_t *output, kvargs *kv);
+output_qentry_t *output_qentry_new(octet_string_t *msg, vdl2_msg_metadata const *metadata,
+		output_format_t format, uint32_t flags);
+output_qentry_t *output_qentry_ref(output_qentry_t *q);
+void output_qentry_release(output_qentry_t *q);
+void output_queue_push(void *output, void *qentry);
 void output_queue_drain(GAsyncQueue *q);
 void *output_thread(void *arg);
 
@@ -17,7 +17,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>                      // FILE, fprintf, fwrite, fputc
+#include <stdio.h>                      // FILE, fprintf, fwrite, fputc, setvbuf
+#include <stdlib.h>                     // strtol
+#include <limits.h>                     // INT_MAX
 #include <string.h>                     // strcmp, strdup, strerror
 #include <time.h>                       // gmtime_r, localtime_r, strftime
 #include <errno.h>                      // errno
@@ -33,6 +35,15 @@ typedef enum {
 	ROT_DAILY
 } out_file_rotation_mode;
 
+typedef enum {
+	FLUSH_ALWAYS,
+	FLUSH_IDLE,
+	FLUSH_BUFFERED
+} out_file_flush_mode;
+
+#define OUT_FILE_FLUSH_BYTES_DEFAULT 65536
+#define OUT_FILE_FLUSH_INTERVAL_DEFAULT 1000
+
 typedef struct {
 	FILE *fh;
 	char *filename_prefix;
@@ -40,10 +51,15 @@ typedef struct {
 	size_t prefix_len;
 	struct tm current_tm;
 	out_file_rotation_mode rotate;
+	out_file_flush_mode flush;
+	size_t flush_bytes;             // stdio buffer size in non-default flush modes
+	char *buf;                      // stdio buffer (reused across file rotations)
+	int flush_interval;             // max time in ms to keep a message buffered (FLUSH_BUFFERED)
+	gint64 unflushed_since;         // when the oldest buffered message was written (0 = none)
 } out_file_ctx_t;
 
 static bool out_file_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BINARY);
+	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BINARY || format == OFMT_CBOR);
 }
 
 static void *out_file_configure(kvargs *kv) {
@@ -68,12 +84,57 @@ static void *out_file_configure(kvargs *kv) {
 	} else {
 		cfg->rotate = ROT_NONE;
 	}
+	char *flush = kvargs_get(kv, "flush");
+	if(flush == NULL || !strcmp(flush, "always")) {
+		cfg->flush = FLUSH_ALWAYS;
+	} else if(!strcmp(flush, "idle")) {
+		cfg->flush = FLUSH_IDLE;
+	} else if(!strcmp(flush, "buffered")) {
+		cfg->flush = FLUSH_BUFFERED;
+	} else {
+		fprintf(stderr, "output_file: invalid flush mode: %s\n", flush);
+		goto fail;
+	}
+	cfg->flush_bytes = OUT_FILE_FLUSH_BYTES_DEFAULT;
+	char *flush_bytes = kvargs_get(kv, "flush_bytes");
+	if(flush_bytes != NULL) {
+		char *endptr = NULL;
+		long val = strtol(flush_bytes, &endptr, 10);
+		if(*endptr != '\0' || val < 1) {
+			fprintf(stderr, "output_file: invalid flush_bytes value: %s\n", flush_bytes);
+			goto fail;
+		}
+		cfg->flush_bytes = val;
+	}
+	cfg->flush_interval = OUT_FILE_FLUSH_INTERVAL_DEFAULT;
+	char *flush_interval = kvargs_get(kv, "flush_interval");
+	if(flush_interval != NULL) {
+		char *endptr = NULL;
+		long val = strtol(flush_interval, &endptr, 10);
+		if(*endptr != '\0' || val < 1 || val > INT_MAX / 1000) {
+			fprintf(stderr, "output_file: invalid flush_interval value: %s\n", flush_interval);
+			goto fail;
+		}
+		cfg->flush_interval = val;
+	}
 	return cfg;
 fail:
 	XFREE(cfg);
 	return NULL;
 }
 
+static void out_file_set_buffering(out_file_ctx_t *self) {
+	if(self->flush != FLUSH_ALWAYS) {
+		// Messages are collected in the stdio buffer and written out in one go.
+		// The buffer is supplied explicitly, because glibc ignores the size otherwise.
+		if(self->buf == NULL) {
+			self->buf = XCALLOC(self->flush_bytes, sizeof(char));
+		}
+		setvbuf(self->fh, self->buf, _IOFBF, self->flush_bytes);
+	}
+	self->unflushed_since = 0;
+}
+
 static int out_file_open(out_file_ctx_t *self) {
 	char *filename = NULL;
 	char *fmt = NULL;
@@ -110,6 +171,7 @@ static int out_file_open(out_file_ctx_t *self) {
 		return -1;
 	}
 	XFREE(filename);
+	out_file_set_buffering(self);
 	return 0;
 }
 
@@ -119,6 +181,7 @@ static int out_file_init(void *selfptr) {
 	if(!strcmp(self->filename_prefix, "-")) {
 		self->fh = stdout;
 		self->rotate = ROT_NONE;
+		out_file_set_buffering(self);
 	} else {
 		self->prefix_len = strlen(self->filename_prefix);
 		if(self->rotate != ROT_NONE) {
@@ -164,16 +227,31 @@ static int out_file_rotate(out_file_ctx_t *self) {
 	return 0;
 }
 
-static void out_file_produce_text(out_file_ctx_t *self, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+static void out_file_written(out_file_ctx_t *self) {
+	if(self->flush == FLUSH_ALWAYS) {
+		fflush(self->fh);
+		return;
+	}
+	gint64 now = g_get_monotonic_time();
+	if(self->unflushed_since == 0) {
+		self->unflushed_since = now;
+	} else if(self->flush == FLUSH_BUFFERED && now - self->unflushed_since >= self->flush_interval * 1000LL) {
+		// The queue never ran empty during flush_interval
+		fflush(self->fh);
+		self->unflushed_since = 0;
+	}
+}
+
+static void out_file_produce_text(out_file_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	ASSERT(msg != NULL);
 	ASSERT(self->fh != NULL);
 	UNUSED(metadata);
 	fwrite(msg->buf, sizeof(uint8_t), msg->len, self->fh);
 	fputc('\n', self->fh);
-	fflush(self->fh);
+	out_file_written(self);
 }
 
-static void out_file_produce_binary(out_file_ctx_t *self, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+static void out_file_produce_binary(out_file_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	ASSERT(msg != NULL);
 	ASSERT(self->fh != NULL);
 	UNUSED(metadata);
@@ -188,10 +266,19 @@ static void out_file_produce_binary(out_file_ctx_t *self, vdl2_msg_metadata *met
     debug_print(D_OUTPUT, "len: %zu frame_len_be: 0x%04x\n", frame_len, frame_len_be);
     fwrite(&frame_len_be, OUT_BINARY_FRAME_LEN_OCTETS, 1, self->fh);
     fwrite(msg->buf, sizeof(uint8_t), msg->len, self->fh);
-    fflush(self->fh);
+    out_file_written(self);
 }
 
-static int out_file_produce(void *selfptr, output_format_t format, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+// CBOR data items are self-delimiting, so they are stored without any framing
+static void out_file_produce_cbor(out_file_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
+	ASSERT(msg != NULL);
+	ASSERT(self->fh != NULL);
+	UNUSED(metadata);
+	fwrite(msg->buf, sizeof(uint8_t), msg->len, self->fh);
+	out_file_written(self);
+}
+
+static int out_file_produce(void *selfptr, output_format_t format, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	ASSERT(selfptr != NULL);
 	out_file_ctx_t *self = selfptr;
 	if(self->rotate != ROT_NONE && out_file_rotate(self) < 0) {
@@ -201,10 +288,29 @@ static int out_file_produce(void *selfptr, output_format_t format, vdl2_msg_meta
 		out_file_produce_text(self, metadata, msg);
 	} else if(format == OFMT_BINARY) {
 		out_file_produce_binary(self, metadata, msg);
+	} else if(format == OFMT_CBOR) {
+		out_file_produce_cbor(self, metadata, msg);
 	}
 	return 0;
 }
 
+static int out_file_flush(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_file_ctx_t *self = selfptr;
+	if(self->fh == NULL || self->unflushed_since == 0) {
+		return 0;
+	}
+	if(self->flush == FLUSH_BUFFERED) {
+		gint64 remaining = self->flush_interval * 1000LL - (g_get_monotonic_time() - self->unflushed_since);
+		if(remaining > 0) {
+			return (remaining + 999) / 1000;
+		}
+	}
+	fflush(self->fh);
+	self->unflushed_since = 0;
+	return 0;
+}
+
 static void out_file_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_file_ctx_t *self = selfptr;
@@ -213,6 +319,7 @@ static void out_file_handle_shutdown(void *selfptr) {
 		fclose(self->fh);
 		self->fh = NULL;
 	}
+	XFREE(self->buf);
 }
 
 static void out_file_handle_failure(void *selfptr) {
@@ -224,6 +331,7 @@ static void out_file_handle_failure(void *selfptr) {
 		fclose(self->fh);
 		self->fh = NULL;
 	}
+	XFREE(self->buf);
 }
 
 static option_descr_t const out_file_options[] = {
@@ -235,6 +343,19 @@ static option_descr_t const out_file_options[] = {
 		.name = "rotate",
 		.description = "How often to start a new file: Accepted values: daily, hourly"
 	},
+	{
+		.name = "flush",
+		.description = "When to write messages to the file. Accepted values: always (after each message, default), "
+			"idle (when there are no more messages waiting), buffered (every flush_bytes or flush_interval)"
+	},
+	{
+		.name = "flush_bytes",
+		.description = "Size of the write buffer in idle and buffered modes (default: 65536)"
+	},
+	{
+		.name = "flush_interval",
+		.description = "Maximum time in milliseconds a message stays in the buffer in buffered mode (default: 1000)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -249,6 +370,7 @@ output_descriptor_t out_DEF_file = {
 	.configure = out_file_configure,
 	.init = out_file_init,
 	.produce = out_file_produce,
+	.flush = out_file_flush,
 	.handle_shutdown = out_file_handle_shutdown,
 	.handle_failure = out_file_handle_failure
 };
@@ -0,0 +1,159 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>                      // fprintf
+#include <stdlib.h>                     // strtoll
+#include <string.h>                     // strdup, strerror
+#include <errno.h>                      // errno
+#include "config.h"                     // WITH_STATSD
+#include "output-common.h"              // output_descriptor_t
+#include "shm-ring.h"                   // shm_ring_*
+#include "kvargs.h"                     // kvargs, option_descr_t
+#include "dumpvdl2.h"                   // NEW, XFREE, ASSERT
+
+#define OUT_SHM_SIZE_DEFAULT    (16 << 20)
+#define OUT_SHM_SIZE_MIN        (64 << 10)
+#define OUT_SHM_SIZE_MAX        (1 << 30)      // fits in size_t on 32-bit platforms
+
+typedef struct {
+	char *name;
+	size_t size;
+	shm_ring_writer_t *ring;
+} out_shm_ctx_t;
+
+#ifdef WITH_STATSD
+static char *out_shm_counters[] = {
+	"output.shm.errors",
+	"output.shm.messages",
+	NULL
+};
+#endif
+
+static bool out_shm_supports_format(output_format_t format) {
+	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BINARY || format == OFMT_PP_ACARS ||
+			format == OFMT_CBOR);
+}
+
+static void *out_shm_configure(kvargs *kv) {
+	ASSERT(kv != NULL);
+	NEW(out_shm_ctx_t, cfg);
+	char *val = NULL, *endptr = NULL;
+	if((val = kvargs_get(kv, "name")) == NULL) {
+		fprintf(stderr, "output_shm: shared memory segment name not specified\n");
+		goto fail;
+	}
+	if(val[0] != '/' || strchr(val + 1, '/') != NULL) {
+		fprintf(stderr, "output_shm: invalid name '%s': must start with a slash and contain no other slashes\n", val);
+		goto fail;
+	}
+	cfg->name = strdup(val);
+	cfg->size = OUT_SHM_SIZE_DEFAULT;
+	if((val = kvargs_get(kv, "size")) != NULL) {
+		long long size = strtoll(val, &endptr, 10);
+		if(*endptr != '\0' || size < OUT_SHM_SIZE_MIN || size > OUT_SHM_SIZE_MAX) {
+			fprintf(stderr, "output_shm: invalid size: %s (must be %d-%d)\n",
+					val, OUT_SHM_SIZE_MIN, OUT_SHM_SIZE_MAX);
+			goto fail;
+		}
+		// Round up to a power of 2
+		long long rounded = OUT_SHM_SIZE_MIN;
+		while(rounded < size) {
+			rounded <<= 1;
+		}
+		cfg->size = (size_t)rounded;
+	}
+	return cfg;
+fail:
+	XFREE(cfg->name);
+	XFREE(cfg);
+	return NULL;
+}
+
+static int out_shm_init(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	self->ring = shm_ring_writer_create(self->name, self->size);
+	if(self->ring == NULL) {
+		fprintf(stderr, "output_shm: could not create shared memory ring %s: %s\n",
+				self->name, strerror(errno));
+		return -1;
+	}
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(out_shm_counters);
+#endif
+	return 0;
+}
+
+static int out_shm_produce(void *selfptr, output_format_t format, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
+	ASSERT(selfptr != NULL);
+	UNUSED(metadata);
+	ASSERT(msg != NULL);
+	out_shm_ctx_t *self = selfptr;
+	if(msg->len < 1) {
+		return 0;
+	}
+	if(shm_ring_write(self->ring, msg->buf, msg->len, format) < 0) {
+		debug_print(D_OUTPUT, "output_shm: message too large (%zu bytes)\n", msg->len);
+		statsd_increment("output.shm.errors");
+		return 0;
+	}
+	statsd_increment("output.shm.messages");
+	return 0;
+}
+
+static void out_shm_handle_shutdown(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	fprintf(stderr, "output_shm(%s): shutting down\n", self->name);
+	shm_ring_writer_destroy(self->ring);
+	self->ring = NULL;
+}
+
+static void out_shm_handle_failure(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_shm_ctx_t *self = selfptr;
+	fprintf(stderr, "output_shm: could not set up shared memory ring %s, deactivating output\n",
+			self->name);
+}
+
+static const option_descr_t out_shm_options[] = {
+	{
+		.name = "name",
+		.description = "Name of the shared memory segment, eg. /dumpvdl2 (required)"
+	},
+	{
+		.name = "size",
+		.description = "Size of the ring buffer in bytes, rounded up to a power of 2 (default: 16777216, max: 1073741824)"
+	},
+	{
+		.name = NULL,
+		.description = NULL
+	}
+};
+
+output_descriptor_t out_DEF_shm = {
+	.name = "shm",
+	.description = "Ring buffer in shared memory for local consumers",
+	.options = out_shm_options,
+	.supports_format = out_shm_supports_format,
+	.configure = out_shm_configure,
+	.init = out_shm_init,
+	.produce = out_shm_produce,
+	.handle_shutdown = out_shm_handle_shutdown,
+	.handle_failure = out_shm_handle_failure
+};
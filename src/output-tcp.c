@@ -0,0 +1,753 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE                     // accept4
+#include <stdio.h>                      // fprintf, snprintf
+#include <stdlib.h>                     // strtol
+#include <stdint.h>                     // uint*_t
+#include <inttypes.h>                   // PRIu64
+#include <string.h>                     // strdup, strerror, memset
+#include <unistd.h>                     // close, read, write
+#include <errno.h>                      // errno
+#include <pthread.h>                    // pthread_*
+#include <sys/types.h>                  // socket, bind
+#include <sys/socket.h>                 // socket, bind, listen, accept4
+#include <sys/uio.h>                    // struct iovec, writev
+#include <sys/epoll.h>                  // epoll_*
+#include <sys/eventfd.h>                // eventfd
+#include <arpa/inet.h>                  // htons
+#include <netdb.h>                      // getaddrinfo, getnameinfo
+#include <glib.h>                       // g_get_monotonic_time
+#include "config.h"                     // WITH_STATSD
+#include "output-common.h"              // output_descriptor_t, output_qentry_t
+#include "output-file.h"                // OUT_BINARY_FRAME_LEN_OCTETS, OUT_BINARY_FRAME_LEN_MAX
+#include "kvargs.h"                     // kvargs, option_descr_t
+#include "dumpvdl2.h"                   // NEW, XCALLOC, XFREE, ASSERT
+
+#define OUT_TCP_CLIENT_BUFFER_DEFAULT   (1 << 20)
+#define OUT_TCP_CLIENT_BUFFER_MIN       4096
+#define OUT_TCP_MAX_CLIENTS_DEFAULT     64
+#define OUT_TCP_MAX_CLIENTS_MAX         4096
+// Max number of messages waiting to be picked up by the network thread
+#define OUT_TCP_HANDOFF_MAX             65536
+// Max number of messages sent to a client with a single writev()
+#define OUT_TCP_WRITEV_MSGS             64
+#define OUT_TCP_STATS_INTERVAL          10000   // ms
+#define OUT_TCP_SHUTDOWN_TIMEOUT        1000    // ms
+
+typedef enum {
+	OVERFLOW_DROP,
+	OVERFLOW_DISCONNECT
+} out_tcp_overflow_t;
+
+typedef struct {
+	int fd;
+	int idx;                        // index in the clients array
+	char *name;                     // printable address of the peer
+	output_qentry_t **ring;         // messages waiting to be sent
+	size_t ring_len;                // allocated length of ring (power of 2)
+	size_t head, count;
+	size_t offset;                  // number of bytes of ring[head] already sent
+	size_t pending;                 // number of bytes in the ring not sent yet
+	uint64_t dropped;               // messages dropped because the client was too slow
+	uint64_t dropped_reported;
+	uint32_t events;                // epoll events this client is registered for
+	bool eof;                       // client has shut down its side of the connection
+	bool failed;                    // to be disconnected
+} out_tcp_client_t;
+
+typedef struct {
+	char *address;
+	char *port;
+	size_t client_buffer;
+	int max_clients;
+	out_tcp_overflow_t overflow;
+	int listen_fd;
+	int epoll_fd;
+	int event_fd;
+	pthread_t thread;
+	bool thread_running;
+	// Messages handed over from the output thread to the network thread.
+	// Protected by mutex.
+	pthread_mutex_t mutex;
+	output_qentry_t **incoming;
+	size_t incoming_count, incoming_len;
+	bool shutdown;
+	// Network thread private state
+	output_qentry_t **spare;
+	size_t spare_len;
+	out_tcp_client_t **clients;
+	int num_clients;
+	struct iovec *iovs;
+	uint8_t *hdrs;
+	gint64 next_stats_time;
+} out_tcp_ctx_t;
+
+#ifdef WITH_STATSD
+static char *out_tcp_counters[] = {
+	"output.tcp.clients_accepted",
+	"output.tcp.clients_rejected",
+	"output.tcp.clients_dropped",
+	"output.tcp.errors",
+	"output.tcp.handoff_overflows",
+	"output.tcp.messages_dropped",
+	NULL
+};
+#endif
+
+// epoll_event.data.ptr values of descriptors other than client sockets
+static int out_tcp_listen_tag, out_tcp_event_tag;
+
+static bool out_tcp_supports_format(output_format_t format) {
+	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_BINARY || format == OFMT_CBOR);
+}
+
+static void *out_tcp_configure(kvargs *kv) {
+	ASSERT(kv != NULL);
+	NEW(out_tcp_ctx_t, cfg);
+	char *val = NULL, *endptr = NULL;
+	if(kvargs_get(kv, "port") == NULL) {
+		fprintf(stderr, "output_tcp: TCP port not specified\n");
+		goto fail;
+	}
+	cfg->port = strdup(kvargs_get(kv, "port"));
+	if((val = kvargs_get(kv, "address")) != NULL) {
+		cfg->address = strdup(val);
+	}
+	cfg->client_buffer = OUT_TCP_CLIENT_BUFFER_DEFAULT;
+	if((val = kvargs_get(kv, "client_buffer")) != NULL) {
+		long long client_buffer = strtoll(val, &endptr, 10);
+		if(*endptr != '\0' || client_buffer < OUT_TCP_CLIENT_BUFFER_MIN) {
+			fprintf(stderr, "output_tcp: invalid client_buffer value: %s (must be at least %d)\n",
+					val, OUT_TCP_CLIENT_BUFFER_MIN);
+			goto fail;
+		}
+		cfg->client_buffer = (size_t)client_buffer;
+	}
+	cfg->max_clients = OUT_TCP_MAX_CLIENTS_DEFAULT;
+	if((val = kvargs_get(kv, "max_clients")) != NULL) {
+		long max_clients = strtol(val, &endptr, 10);
+		if(*endptr != '\0' || max_clients < 1 || max_clients > OUT_TCP_MAX_CLIENTS_MAX) {
+			fprintf(stderr, "output_tcp: invalid max_clients value: %s (must be 1-%d)\n",
+					val, OUT_TCP_MAX_CLIENTS_MAX);
+			goto fail;
+		}
+		cfg->max_clients = max_clients;
+	}
+	cfg->overflow = OVERFLOW_DROP;
+	if((val = kvargs_get(kv, "overflow")) != NULL) {
+		if(!strcmp(val, "drop")) {
+			cfg->overflow = OVERFLOW_DROP;
+		} else if(!strcmp(val, "disconnect")) {
+			cfg->overflow = OVERFLOW_DISCONNECT;
+		} else {
+			fprintf(stderr, "output_tcp: overflow '%s' is invalid; must be either 'drop' or 'disconnect'\n", val);
+			goto fail;
+		}
+	}
+	cfg->listen_fd = cfg->epoll_fd = cfg->event_fd = -1;
+	return cfg;
+fail:
+	XFREE(cfg->port);
+	XFREE(cfg->address);
+	XFREE(cfg);
+	return NULL;
+}
+
+// Length of the message as sent over the wire
+static size_t out_tcp_framed_len(output_qentry_t const *q) {
+	if(q->format == OFMT_BINARY) {
+		return q->msg->len + OUT_BINARY_FRAME_LEN_OCTETS;
+	} else if(q->format == OFMT_CBOR) {
+		return q->msg->len;         // self-delimiting
+	}
+	return q->msg->len + 1;     // newline
+}
+
+// Waits for writability only when there is something to send
+static void out_tcp_client_update_events(out_tcp_ctx_t *self, out_tcp_client_t *c) {
+	uint32_t events = (c->eof ? 0 : EPOLLIN | EPOLLRDHUP) | (c->count > 0 ? EPOLLOUT : 0);
+	if(c->events == events) {
+		return;
+	}
+	struct epoll_event ev = {
+		.events = events,
+		.data.ptr = c
+	};
+	if(epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+		debug_print(D_OUTPUT, "output_tcp: epoll_ctl(%s) failed: %s\n", c->name, strerror(errno));
+		c->failed = true;
+		return;
+	}
+	c->events = events;
+}
+
+static void out_tcp_client_close(out_tcp_ctx_t *self, out_tcp_client_t *c) {
+	// Per-client figures are not sent to statsd (clients come and go,
+	// so metric names would pile up), so report losses here
+	if(c->pending > 0 || c->dropped > 0) {
+		fprintf(stderr, "output_tcp(%s): client %s disconnected, %zu bytes unsent, %" PRIu64 " messages dropped\n",
+				self->port, c->name, c->pending, c->dropped);
+	} else {
+		debug_print(D_OUTPUT, "output_tcp: client %s disconnected\n", c->name);
+	}
+	close(c->fd);       // removes it from the epoll set as well
+	for(size_t i = 0; i < c->count; i++) {
+		output_qentry_release(c->ring[(c->head + i) & (c->ring_len - 1)]);
+	}
+	// Fill the gap with the last client
+	self->clients[c->idx] = self->clients[--self->num_clients];
+	self->clients[c->idx]->idx = c->idx;
+	statsd_add("output.tcp.messages_dropped", c->dropped - c->dropped_reported);
+	XFREE(c->ring);
+	XFREE(c->name);
+	XFREE(c);
+}
+
+static void out_tcp_client_send(out_tcp_ctx_t *self, out_tcp_client_t *c);
+
+// Queues a message for sending to the client according to the overflow policy.
+// The oldest message is always accepted, even if it's larger than client_buffer.
+static void out_tcp_client_enqueue(out_tcp_ctx_t *self, out_tcp_client_t *c, output_qentry_t *q, size_t len) {
+	if(c->failed) {
+		return;
+	}
+	if(c->count > 0 && c->pending + len > self->client_buffer) {
+		// Make room by moving the data to the socket buffer, if possible
+		out_tcp_client_send(self, c);
+	}
+	if(c->failed) {
+		return;
+	}
+	if(c->count > 0 && c->pending + len > self->client_buffer) {
+		if(self->overflow == OVERFLOW_DISCONNECT) {
+			fprintf(stderr, "output_tcp(%s): client %s is too slow (%zu bytes pending), disconnecting\n",
+					self->port, c->name, c->pending);
+			statsd_increment("output.tcp.clients_dropped");
+			c->failed = true;
+		} else {
+			c->dropped++;
+		}
+		return;
+	}
+	if(c->count == c->ring_len) {
+		// Grow the ring and unwrap its contents
+		size_t new_len = c->ring_len * 2;
+		output_qentry_t **ring = XCALLOC(new_len, sizeof(output_qentry_t *));
+		for(size_t i = 0; i < c->count; i++) {
+			ring[i] = c->ring[(c->head + i) & (c->ring_len - 1)];
+		}
+		XFREE(c->ring);
+		c->ring = ring;
+		c->ring_len = new_len;
+		c->head = 0;
+	}
+	c->ring[(c->head + c->count) & (c->ring_len - 1)] = output_qentry_ref(q);
+	c->count++;
+	c->pending += len;
+}
+
+// Writes as much of the client's ring as the socket accepts without blocking
+static void out_tcp_client_send(out_tcp_ctx_t *self, out_tcp_client_t *c) {
+	static char const newline = '\n';
+	size_t const mask = c->ring_len - 1;
+	while(c->count > 0 && !c->failed) {
+		size_t niov = 0;
+		size_t skip = c->offset;
+		size_t nmsgs = c->count < OUT_TCP_WRITEV_MSGS ? c->count : OUT_TCP_WRITEV_MSGS;
+		for(size_t i = 0; i < nmsgs; i++) {
+			output_qentry_t *q = c->ring[(c->head + i) & mask];
+			struct iovec seg[2];
+			if(q->format == OFMT_BINARY) {
+				uint8_t *hdr = self->hdrs + i * OUT_BINARY_FRAME_LEN_OCTETS;
+				uint16_t frame_len_be = htons((uint16_t)out_tcp_framed_len(q));
+				memcpy(hdr, &frame_len_be, OUT_BINARY_FRAME_LEN_OCTETS);
+				seg[0] = (struct iovec){ .iov_base = hdr, .iov_len = OUT_BINARY_FRAME_LEN_OCTETS };
+				seg[1] = (struct iovec){ .iov_base = q->msg->buf, .iov_len = q->msg->len };
+			} else {
+				seg[0] = (struct iovec){ .iov_base = q->msg->buf, .iov_len = q->msg->len };
+				seg[1] = (struct iovec){ .iov_base = (void *)&newline, .iov_len = q->format == OFMT_CBOR ? 0 : 1 };
+			}
+			// Skip the part of the first message which has already been sent
+			for(int j = 0; j < 2; j++) {
+				if(skip >= seg[j].iov_len) {
+					skip -= seg[j].iov_len;
+					continue;
+				}
+				self->iovs[niov].iov_base = (uint8_t *)seg[j].iov_base + skip;
+				self->iovs[niov].iov_len = seg[j].iov_len - skip;
+				niov++;
+				skip = 0;
+			}
+		}
+		ssize_t ret = writev(c->fd, self->iovs, niov);
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			} else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			debug_print(D_OUTPUT, "output_tcp: error while writing to %s: %s\n", c->name, strerror(errno));
+			statsd_increment("output.tcp.errors");
+			c->failed = true;
+			return;
+		}
+		size_t written = ret;
+		c->pending -= written;
+		while(written > 0) {
+			output_qentry_t *q = c->ring[c->head];
+			size_t remaining = out_tcp_framed_len(q) - c->offset;
+			if(written < remaining) {
+				c->offset += written;
+				break;
+			}
+			written -= remaining;
+			output_qentry_release(q);
+			c->ring[c->head] = NULL;
+			c->head = (c->head + 1) & mask;
+			c->count--;
+			c->offset = 0;
+		}
+	}
+	out_tcp_client_update_events(self, c);
+}
+
+static void out_tcp_close_failed_clients(out_tcp_ctx_t *self) {
+	for(int i = self->num_clients - 1; i >= 0; i--) {
+		if(self->clients[i]->failed) {
+			out_tcp_client_close(self, self->clients[i]);
+		}
+	}
+}
+
+static void out_tcp_accept(out_tcp_ctx_t *self) {
+	while(1) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		int fd = accept4(self->listen_fd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				debug_print(D_OUTPUT, "output_tcp: accept failed: %s\n", strerror(errno));
+				statsd_increment("output.tcp.errors");
+			}
+			return;
+		}
+		if(self->num_clients >= self->max_clients) {
+			debug_print(D_OUTPUT, "output_tcp: rejecting connection: too many clients\n");
+			statsd_increment("output.tcp.clients_rejected");
+			close(fd);
+			continue;
+		}
+		char host[NI_MAXHOST], serv[NI_MAXSERV];
+		if(getnameinfo((struct sockaddr *)&addr, addrlen, host, sizeof(host), serv, sizeof(serv),
+					NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+			strcpy(host, "unknown");
+			strcpy(serv, "0");
+		}
+		NEW(out_tcp_client_t, c);
+		c->fd = fd;
+		size_t name_len = strlen(host) + strlen(serv) + 4;
+		c->name = XCALLOC(name_len, sizeof(char));
+		snprintf(c->name, name_len, addr.ss_family == AF_INET6 ? "[%s]:%s" : "%s:%s", host, serv);
+		c->ring_len = 64;
+		c->ring = XCALLOC(c->ring_len, sizeof(output_qentry_t *));
+		c->events = EPOLLIN | EPOLLRDHUP;
+		struct epoll_event ev = {
+			.events = c->events,
+			.data.ptr = c
+		};
+		if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			debug_print(D_OUTPUT, "output_tcp: epoll_ctl(%s) failed: %s\n", c->name, strerror(errno));
+			statsd_increment("output.tcp.errors");
+			close(fd);
+			XFREE(c->ring);
+			XFREE(c->name);
+			XFREE(c);
+			continue;
+		}
+		c->idx = self->num_clients;
+		self->clients[self->num_clients++] = c;
+		debug_print(D_OUTPUT, "output_tcp: client %s connected\n", c->name);
+		statsd_increment("output.tcp.clients_accepted");
+	}
+}
+
+// Clients are not supposed to send anything - read and discard the data.
+// A client which has closed its sending side may still be receiving, so
+// it's disconnected only after a write error.
+static void out_tcp_client_read(out_tcp_ctx_t *self, out_tcp_client_t *c) {
+	uint8_t buf[256];
+	while(1) {
+		ssize_t ret = read(c->fd, buf, sizeof(buf));
+		if(ret > 0) {
+			continue;
+		} else if(ret == 0) {
+			c->eof = true;
+			out_tcp_client_update_events(self, c);
+			return;
+		} else if(errno == EINTR) {
+			continue;
+		} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			c->failed = true;
+		}
+		return;
+	}
+}
+
+// Passes messages received from the output thread to all clients.
+// Returns true if shutdown has been requested.
+static bool out_tcp_distribute(out_tcp_ctx_t *self) {
+	uint64_t val;
+	while(read(self->event_fd, &val, sizeof(val)) < 0 && errno == EINTR)
+		;
+	pthread_mutex_lock(&self->mutex);
+	// Swap the buffers, so that the output thread does not need to wait
+	// until all messages are queued
+	output_qentry_t **batch = self->incoming;
+	size_t count = self->incoming_count, len = self->incoming_len;
+	self->incoming = self->spare;
+	self->incoming_len = self->spare_len;
+	self->incoming_count = 0;
+	bool shutdown = self->shutdown;
+	pthread_mutex_unlock(&self->mutex);
+	self->spare = batch;
+	self->spare_len = len;
+
+	for(size_t i = 0; i < count; i++) {
+		output_qentry_t *q = batch[i];
+		size_t framed_len = out_tcp_framed_len(q);
+		for(int j = 0; j < self->num_clients; j++) {
+			out_tcp_client_enqueue(self, self->clients[j], q, framed_len);
+		}
+		output_qentry_release(q);
+		batch[i] = NULL;
+	}
+	if(count > 0) {
+		for(int j = 0; j < self->num_clients; j++) {
+			out_tcp_client_send(self, self->clients[j]);
+		}
+	}
+	return shutdown;
+}
+
+static void out_tcp_report_stats(out_tcp_ctx_t *self) {
+	size_t max_lag = 0;
+	for(int i = 0; i < self->num_clients; i++) {
+		out_tcp_client_t *c = self->clients[i];
+		if(c->pending > max_lag) {
+			max_lag = c->pending;
+		}
+		statsd_add("output.tcp.messages_dropped", c->dropped - c->dropped_reported);
+		c->dropped_reported = c->dropped;
+	}
+	statsd_set("output.tcp.clients", self->num_clients);
+	statsd_set("output.tcp.max_lag_bytes", max_lag);
+}
+
+static bool out_tcp_data_pending(out_tcp_ctx_t *self) {
+	for(int i = 0; i < self->num_clients; i++) {
+		if(self->clients[i]->count > 0 && !self->clients[i]->failed) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#define OUT_TCP_MAX_EVENTS 64
+
+static void *out_tcp_thread(void *arg) {
+	ASSERT(arg != NULL);
+	out_tcp_ctx_t *self = arg;
+	struct epoll_event events[OUT_TCP_MAX_EVENTS];
+	gint64 shutdown_deadline = 0;
+	self->next_stats_time = g_get_monotonic_time() + OUT_TCP_STATS_INTERVAL * 1000LL;
+
+	while(1) {
+		gint64 now = g_get_monotonic_time();
+		if(now >= self->next_stats_time) {
+			out_tcp_report_stats(self);
+			self->next_stats_time = now + OUT_TCP_STATS_INTERVAL * 1000LL;
+		}
+		if(shutdown_deadline > 0 && (now >= shutdown_deadline || !out_tcp_data_pending(self))) {
+			break;
+		}
+		gint64 wakeup = shutdown_deadline > 0 ? shutdown_deadline : self->next_stats_time;
+		int timeout = (wakeup - now + 999) / 1000;
+		int nev = epoll_wait(self->epoll_fd, events, OUT_TCP_MAX_EVENTS, timeout);
+		if(nev < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "output_tcp(%s): epoll_wait failed: %s\n", self->port, strerror(errno));
+			break;
+		}
+		for(int i = 0; i < nev; i++) {
+			void *ptr = events[i].data.ptr;
+			if(ptr == &out_tcp_listen_tag) {
+				out_tcp_accept(self);
+			} else if(ptr == &out_tcp_event_tag) {
+				if(out_tcp_distribute(self) && shutdown_deadline == 0) {
+					// Stop accepting connections and give the clients
+					// a moment to receive the remaining data
+					epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, self->listen_fd, NULL);
+					shutdown_deadline = g_get_monotonic_time() + OUT_TCP_SHUTDOWN_TIMEOUT * 1000LL;
+				}
+			} else {
+				out_tcp_client_t *c = ptr;
+				if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+					c->failed = true;
+				} else {
+					if(events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+						out_tcp_client_read(self, c);
+					}
+					if(events[i].events & EPOLLOUT) {
+						out_tcp_client_send(self, c);
+					}
+				}
+			}
+		}
+		// Clients are removed only after processing all events,
+		// as the returned events may still refer to them
+		out_tcp_close_failed_clients(self);
+	}
+	out_tcp_report_stats(self);
+	while(self->num_clients > 0) {
+		out_tcp_client_close(self, self->clients[0]);
+	}
+	return NULL;
+}
+
+static int out_tcp_listen(out_tcp_ctx_t *self) {
+	struct addrinfo hints, *result, *rptr;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int ret = getaddrinfo(self->address, self->port, &hints, &result);
+	if(ret != 0) {
+		fprintf(stderr, "output_tcp: could not resolve %s: %s\n",
+				self->address != NULL ? self->address : "listen address", gai_strerror(ret));
+		return -1;
+	}
+	int err = 0;
+	for(rptr = result; rptr != NULL; rptr = rptr->ai_next) {
+		self->listen_fd = socket(rptr->ai_family, rptr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				rptr->ai_protocol);
+		if(self->listen_fd == -1) {
+			err = errno;
+			continue;
+		}
+		int one = 1;
+		setsockopt(self->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(bind(self->listen_fd, rptr->ai_addr, rptr->ai_addrlen) == 0 &&
+				listen(self->listen_fd, SOMAXCONN) == 0) {
+			break;
+		}
+		err = errno;
+		close(self->listen_fd);
+		self->listen_fd = -1;
+	}
+	freeaddrinfo(result);
+	if(rptr == NULL) {
+		fprintf(stderr, "output_tcp: could not listen on %s:%s: %s\n",
+				self->address != NULL ? self->address : "*", self->port, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+static int out_tcp_init(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_ctx_t *self = selfptr;
+
+	if(out_tcp_listen(self) < 0) {
+		return -1;
+	}
+	if((self->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		fprintf(stderr, "output_tcp: epoll_create1 failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if((self->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		fprintf(stderr, "output_tcp: eventfd failed: %s\n", strerror(errno));
+		return -1;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &out_tcp_listen_tag };
+	if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->listen_fd, &ev) < 0) {
+		fprintf(stderr, "output_tcp: epoll_ctl failed: %s\n", strerror(errno));
+		return -1;
+	}
+	ev = (struct epoll_event){ .events = EPOLLIN, .data.ptr = &out_tcp_event_tag };
+	if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->event_fd, &ev) < 0) {
+		fprintf(stderr, "output_tcp: epoll_ctl failed: %s\n", strerror(errno));
+		return -1;
+	}
+	pthread_mutex_init(&self->mutex, NULL);
+	self->clients = XCALLOC(self->max_clients, sizeof(out_tcp_client_t *));
+	self->iovs = XCALLOC(2 * OUT_TCP_WRITEV_MSGS, sizeof(struct iovec));
+	self->hdrs = XCALLOC(OUT_TCP_WRITEV_MSGS, OUT_BINARY_FRAME_LEN_OCTETS);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(out_tcp_counters);
+#endif
+	start_thread(&self->thread, out_tcp_thread, self);
+	self->thread_running = true;
+	fprintf(stderr, "output_tcp: listening on %s:%s\n",
+			self->address != NULL ? self->address : "*", self->port);
+	return 0;
+}
+
+static void out_tcp_wakeup(out_tcp_ctx_t *self) {
+	uint64_t one = 1;
+	while(write(self->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+}
+
+// Hands the messages over to the network thread. Never blocks on the network.
+static int out_tcp_produce_batch(void *selfptr, output_qentry_t **batch, size_t count) {
+	ASSERT(selfptr != NULL);
+	out_tcp_ctx_t *self = selfptr;
+	size_t overflows = 0;
+	pthread_mutex_lock(&self->mutex);
+	bool was_empty = (self->incoming_count == 0);
+	if(self->incoming_count + count > self->incoming_len) {
+		size_t new_len = self->incoming_count + count;
+		if(new_len < 2 * self->incoming_len) {
+			new_len = 2 * self->incoming_len;
+		}
+		if(new_len > OUT_TCP_HANDOFF_MAX) {
+			new_len = OUT_TCP_HANDOFF_MAX;
+		}
+		if(new_len > self->incoming_len) {
+			self->incoming = XREALLOC(self->incoming, new_len * sizeof(output_qentry_t *));
+			self->incoming_len = new_len;
+		}
+	}
+	for(size_t i = 0; i < count; i++) {
+		if(batch[i]->format == OFMT_BINARY &&
+				batch[i]->msg->len + OUT_BINARY_FRAME_LEN_OCTETS > OUT_BINARY_FRAME_LEN_MAX) {
+			fprintf(stderr, "output_tcp: encoded payload too large: %zu > %d\n",
+					batch[i]->msg->len + OUT_BINARY_FRAME_LEN_OCTETS, OUT_BINARY_FRAME_LEN_MAX);
+			continue;
+		}
+		if(self->incoming_count == self->incoming_len) {
+			overflows++;
+			continue;
+		}
+		self->incoming[self->incoming_count++] = output_qentry_ref(batch[i]);
+	}
+	bool wakeup = was_empty && self->incoming_count > 0;
+	pthread_mutex_unlock(&self->mutex);
+	if(wakeup) {
+		out_tcp_wakeup(self);
+	}
+	if(overflows > 0) {
+		statsd_add("output.tcp.handoff_overflows", overflows);
+	}
+	return 0;
+}
+
+static void out_tcp_cleanup(out_tcp_ctx_t *self) {
+	if(self->listen_fd >= 0) {
+		close(self->listen_fd);
+		self->listen_fd = -1;
+	}
+	if(self->epoll_fd >= 0) {
+		close(self->epoll_fd);
+		self->epoll_fd = -1;
+	}
+	if(self->event_fd >= 0) {
+		close(self->event_fd);
+		self->event_fd = -1;
+	}
+}
+
+static void out_tcp_handle_shutdown(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_ctx_t *self = selfptr;
+	fprintf(stderr, "output_tcp(%s): shutting down\n", self->port);
+	if(self->thread_running) {
+		pthread_mutex_lock(&self->mutex);
+		self->shutdown = true;
+		pthread_mutex_unlock(&self->mutex);
+		out_tcp_wakeup(self);
+		pthread_join(self->thread, NULL);
+		self->thread_running = false;
+	}
+	for(size_t i = 0; i < self->incoming_count; i++) {
+		output_qentry_release(self->incoming[i]);
+	}
+	self->incoming_count = 0;
+	out_tcp_cleanup(self);
+	XFREE(self->incoming);
+	XFREE(self->spare);
+	XFREE(self->clients);
+	XFREE(self->iovs);
+	XFREE(self->hdrs);
+}
+
+static void out_tcp_handle_failure(void *selfptr) {
+	ASSERT(selfptr != NULL);
+	out_tcp_ctx_t *self = selfptr;
+	fprintf(stderr, "output_tcp: could not set up a server on port %s, deactivating output\n",
+			self->port);
+	out_tcp_cleanup(self);
+}
+
+static const option_descr_t out_tcp_options[] = {
+	{
+		.name = "address",
+		.description = "Local host name or IP address to listen on (default: all addresses)"
+	},
+	{
+		.name = "port",
+		.description = "TCP port to listen on (required)"
+	},
+	{
+		.name = "max_clients",
+		.description = "Maximum number of connected clients (default: 64)"
+	},
+	{
+		.name = "client_buffer",
+		.description = "Maximum number of bytes queued for a single client (default: 1048576)"
+	},
+	{
+		.name = "overflow",
+		.description = "What to do when a client can't keep up: 'drop' - skip messages, 'disconnect' - close the connection (default: drop)"
+	},
+	{
+		.name = "batch_size",
+		.description = "Maximum number of queued messages handed over to the network thread at once (default: 64)"
+	},
+	{
+		.name = NULL,
+		.description = NULL
+	}
+};
+
+output_descriptor_t out_DEF_tcp = {
+	.name = "tcp",
+	.description = "TCP server, sends messages to all connected clients",
+	.options = out_tcp_options,
+	.supports_format = out_tcp_supports_format,
+	.configure = out_tcp_configure,
+	.init = out_tcp_init,
+	.produce_batch = out_tcp_produce_batch,
+	.handle_shutdown = out_tcp_handle_shutdown,
+	.handle_failure = out_tcp_handle_failure
+};
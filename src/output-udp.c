@@ -16,13 +16,15 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-
+#define _GNU_SOURCE                     // sendmmsg
 #include <stdio.h>                      // fprintf
 #include <string.h>                     // strdup, strerror
 #include <unistd.h>                     // close
 #include <errno.h>                      // errno
 #include <sys/types.h>                  // socket, connect
-#include <sys/socket.h>                 // socket, connect
+#include <sys/socket.h>                 // socket, connect, send, sendmmsg
+#include <sys/uio.h>                    // struct iovec
+#include "config.h"                     // WITH_STATSD, HAVE_SENDMMSG
 #include <netdb.h>                      // getaddrinfo
 #include "output-common.h"              // output_descriptor_t, output_qentry_t, output_queue_drain
 #include "kvargs.h"                     // kvargs, option_descr_t
@@ -32,10 +34,25 @@ typedef struct {
 	char *address;
 	char *port;
 	int sockfd;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr *msgs;           // sendmmsg() batch
+#endif
+	struct iovec *iovs;
+	size_t *batch_idx;              // index of the batch entry sent in each msgs slot
+	size_t batch_len;               // allocated length of msgs, iovs and batch_idx
 } out_udp_ctx_t;
 
+#ifdef WITH_STATSD
+static char *out_udp_counters[] = {
+	"output.udp.batches",
+	"output.udp.datagrams",
+	"output.udp.errors",
+	NULL
+};
+#endif
+
 static bool out_udp_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS);
+	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS || format == OFMT_CBOR);
 }
 
 static void *out_udp_configure(kvargs *kv) {
@@ -90,49 +107,133 @@ static int out_udp_init(void *selfptr) {
 		return -1;
 	}
 	freeaddrinfo(result);
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(out_udp_counters);
+#endif
 	return 0;
 }
 
-static void out_udp_produce_pp_acars(out_udp_ctx_t *self, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+// Errors reported on a connected UDP socket when the destination
+// can't be reached (eg. ICMP port unreachable received for an earlier datagram)
+static bool out_udp_dest_unreachable(int err) {
+	return err == ECONNREFUSED || err == EHOSTUNREACH || err == ENETUNREACH ||
+		err == ENETDOWN || err == EHOSTDOWN;
+}
+
+static int out_udp_produce_pp_acars(out_udp_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	UNUSED(metadata);
 	ASSERT(msg != NULL);
 	ASSERT(self->sockfd != 0);
 	if(msg->len < 1) {
-		return;
+		return 0;
 	}
 	if(write(self->sockfd, msg->buf, msg->len) < 0) {
 		debug_print(D_OUTPUT, "output_udp: error while writing to the network socket: %s", strerror(errno));
+		return out_udp_dest_unreachable(errno) ? 1 : 0;
 	}
+	return 0;
 }
 
-static void out_udp_produce_text(out_udp_ctx_t *self, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+static int out_udp_produce_text(out_udp_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	UNUSED(metadata);
 	ASSERT(msg != NULL);
 	ASSERT(self->sockfd != 0);
 	if(msg->len < 2) {
-		return;
+		return 0;
 	}
 	if(write(self->sockfd, msg->buf, msg->len) < 0) {
 		debug_print(D_OUTPUT, "output_udp: error while writing to the network socket: %s", strerror(errno));
+		return out_udp_dest_unreachable(errno) ? 1 : 0;
 	}
+	return 0;
 }
 
-static int out_udp_produce(void *selfptr, output_format_t format, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+static int out_udp_produce(void *selfptr, output_format_t format, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	ASSERT(selfptr != NULL);
 	out_udp_ctx_t *self = selfptr;
 	if(format == OFMT_TEXT || format == OFMT_JSON) {
-		out_udp_produce_text(self, metadata, msg);
-	} else if(format == OFMT_PP_ACARS) {
-		out_udp_produce_pp_acars(self, metadata, msg);
+		return out_udp_produce_text(self, metadata, msg);
+	} else if(format == OFMT_PP_ACARS || format == OFMT_CBOR) {
+		// Sent as is, like pp_acars
+		return out_udp_produce_pp_acars(self, metadata, msg);
 	}
 	return 0;
 }
 
+// Sends all messages in one sendmmsg() call, one datagram per message.
+// Where sendmmsg() is unavailable, datagrams are sent one by one.
+static int out_udp_produce_batch(void *selfptr, output_qentry_t **batch, size_t count) {
+	ASSERT(selfptr != NULL);
+	out_udp_ctx_t *self = selfptr;
+	ASSERT(self->sockfd != 0);
+	if(count > self->batch_len) {
+#ifdef HAVE_SENDMMSG
+		self->msgs = XREALLOC(self->msgs, count * sizeof(struct mmsghdr));
+#endif
+		self->iovs = XREALLOC(self->iovs, count * sizeof(struct iovec));
+		self->batch_idx = XREALLOC(self->batch_idx, count * sizeof(size_t));
+		self->batch_len = count;
+	}
+	size_t n = 0;
+	for(size_t i = 0; i < count; i++) {
+		octet_string_t const *msg = batch[i]->msg;
+		ASSERT(msg != NULL);
+		// Same minimum lengths as in out_udp_produce_text / out_udp_produce_pp_acars
+		size_t min_len = (batch[i]->format == OFMT_TEXT || batch[i]->format == OFMT_JSON) ? 2 : 1;
+		if(msg->len < min_len) {
+			continue;
+		}
+		self->iovs[n].iov_base = msg->buf;
+		self->iovs[n].iov_len = msg->len;
+#ifdef HAVE_SENDMMSG
+		self->msgs[n] = (struct mmsghdr){
+			.msg_hdr = { .msg_iov = &self->iovs[n], .msg_iovlen = 1 }
+		};
+#endif
+		self->batch_idx[n] = i;
+		n++;
+	}
+	size_t sent = 0;
+	while(sent < n) {
+#ifdef HAVE_SENDMMSG
+		int ret = sendmmsg(self->sockfd, self->msgs + sent, n - sent, 0);
+#else
+		int ret = send(self->sockfd, self->iovs[sent].iov_base, self->iovs[sent].iov_len, 0) < 0 ? -1 : 1;
+#endif
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			debug_print(D_OUTPUT, "output_udp: error while writing to the network socket: %s", strerror(errno));
+			statsd_increment("output.udp.errors");
+			if(out_udp_dest_unreachable(errno)) {
+				// Report this datagram and the following ones as not delivered
+				statsd_increment("output.udp.batches");
+				statsd_add("output.udp.datagrams", sent);
+				return count - self->batch_idx[sent];
+			}
+			// Skip the datagram which couldn't be sent
+			sent++;
+		} else {
+			sent += ret;
+		}
+	}
+	statsd_increment("output.udp.batches");
+	statsd_add("output.udp.datagrams", n);
+	return 0;
+}
+
 static void out_udp_handle_shutdown(void *selfptr) {
 	ASSERT(selfptr != NULL);
 	out_udp_ctx_t *self = selfptr;
 	fprintf(stderr, "output_udp(%s:%s): shutting down\n", self->address, self->port);
 	close(self->sockfd);
+#ifdef HAVE_SENDMMSG
+	XFREE(self->msgs);
+#endif
+	XFREE(self->iovs);
+	XFREE(self->batch_idx);
+	self->batch_len = 0;
 }
 
 static void out_udp_handle_failure(void *selfptr) {
@@ -152,6 +253,14 @@ static const option_descr_t out_udp_options[] = {
 		.name = "port",
 		.description = "Destination UDP port (required)"
 	},
+	{
+		.name = "batch_size",
+		.description = "Maximum number of queued messages sent with a single system call (default: 64)"
+	},
+	{
+		.name = "batch_latency",
+		.description = "Maximum time in milliseconds to wait for more messages to fill up a batch (default: 0)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -166,6 +275,7 @@ output_descriptor_t out_DEF_udp = {
 	.configure = out_udp_configure,
 	.init = out_udp_init,
 	.produce = out_udp_produce,
+	.produce_batch = out_udp_produce_batch,
 	.handle_shutdown = out_udp_handle_shutdown,
 	.handle_failure = out_udp_handle_failure
 };
@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>                      // fprintf
+#include <stdlib.h>                     // strtol
+#include <limits.h>                     // INT_MAX
 #include <string.h>                     // strdup, strerror
 #include <errno.h>                      // errno
 #include <zmq.h>                        // zmq_*
@@ -36,10 +38,22 @@ typedef struct {
 	void *zmq_ctx;
 	void *zmq_sock;
 	out_zmq_mode_t mode;
+	int sndhwm;                     // -1 = use --output-queue-hwm value
+	bool multipart;                 // send each batch as a single multipart message
+	bool nodrop;                    // refuse messages instead of dropping them when any subscriber is full
 } out_zmq_ctx_t;
 
+#ifdef WITH_STATSD
+static char *out_zmq_counters[] = {
+	"output.zmq.errors",
+	"output.zmq.messages",
+	"output.zmq.overflows",
+	NULL
+};
+#endif
+
 static bool out_zmq_supports_format(output_format_t format) {
-	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS);
+	return(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS || format == OFMT_CBOR);
 }
 
 static void *out_zmq_configure(kvargs *kv) {
@@ -72,6 +86,46 @@ static void *out_zmq_configure(kvargs *kv) {
 		fprintf(stderr, "output_zmq: mode '%s' is invalid; must be either 'client' or 'server'\n", mode);
 		goto fail;
 	}
+	// --output-queue-hwm may follow the --output option,
+	// so the default is applied in out_zmq_init
+	cfg->sndhwm = -1;
+	char *sndhwm = kvargs_get(kv, "sndhwm");
+	if(sndhwm != NULL) {
+		char *endptr = NULL;
+		long val = strtol(sndhwm, &endptr, 10);
+		if(*endptr != '\0' || val < 0 || val > INT_MAX) {
+			fprintf(stderr, "output_zmq: invalid sndhwm value: %s\n", sndhwm);
+			goto fail;
+		}
+		cfg->sndhwm = val;
+	}
+	char *multipart = kvargs_get(kv, "multipart");
+	if(multipart != NULL) {
+		if(!strcmp(multipart, "true")) {
+			cfg->multipart = true;
+		} else if(!strcmp(multipart, "false")) {
+			cfg->multipart = false;
+		} else {
+			fprintf(stderr, "output_zmq: multipart '%s' is invalid; must be either 'true' or 'false'\n", multipart);
+			goto fail;
+		}
+	}
+	char *nodrop = kvargs_get(kv, "nodrop");
+	if(nodrop != NULL) {
+		if(!strcmp(nodrop, "true")) {
+#ifdef ZMQ_XPUB_NODROP
+			cfg->nodrop = true;
+#else
+			fprintf(stderr, "output_zmq: nodrop requires libzmq 4.1 or later\n");
+			goto fail;
+#endif
+		} else if(!strcmp(nodrop, "false")) {
+			cfg->nodrop = false;
+		} else {
+			fprintf(stderr, "output_zmq: nodrop '%s' is invalid; must be either 'true' or 'false'\n", nodrop);
+			goto fail;
+		}
+	}
 	return cfg;
 fail:
 	XFREE(cfg);
@@ -100,33 +154,131 @@ static int out_zmq_init(void *selfptr) {
 				self->endpoint, zmq_strerror(errno));
 		return -1;
 	}
-	rc = zmq_setsockopt(self->zmq_sock, ZMQ_SNDHWM, &Config.output_queue_hwm,
-			sizeof(Config.output_queue_hwm));
+	if(self->sndhwm < 0) {
+		self->sndhwm = Config.output_queue_hwm;
+	}
+	rc = zmq_setsockopt(self->zmq_sock, ZMQ_SNDHWM, &self->sndhwm, sizeof(self->sndhwm));
 	if(rc < 0) {
 		fprintf(stderr, "output_zmq: could not set ZMQ_SNDHWM option for socket: %s\n",
 				zmq_strerror(errno));
 		return -1;
 	}
+#ifdef ZMQ_XPUB_NODROP
+	// Report messages exceeding SNDHWM with EAGAIN instead of dropping
+	// them silently. The socket then refuses messages for all subscribers
+	// as long as any one of them is full, so this is opt-in.
+	if(self->nodrop) {
+		int nodrop = 1;
+		if(zmq_setsockopt(self->zmq_sock, ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop)) < 0) {
+			fprintf(stderr, "output_zmq: could not set ZMQ_XPUB_NODROP option for socket: %s\n",
+					zmq_strerror(errno));
+			return -1;
+		}
+	}
+#endif
+#ifdef WITH_STATSD
+	statsd_initialize_counter_set(out_zmq_counters);
+#endif
 	return 0;
 }
 
-static void out_zmq_produce_text(out_zmq_ctx_t *self, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+static int out_zmq_produce_text(out_zmq_ctx_t *self, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
 	UNUSED(metadata);
 	ASSERT(msg != NULL);
 	ASSERT(self->zmq_sock != 0);
 	if(msg->len < 2) {
-		return;
+		return 0;
 	}
-	if(zmq_send(self->zmq_sock, msg->buf, msg->len, 0) < 0) {
+	if(zmq_send(self->zmq_sock, msg->buf, msg->len, ZMQ_DONTWAIT) < 0) {
+		if(errno == EAGAIN) {
+			// Refused because of nodrop - not delivered
+			statsd_increment("output.zmq.overflows");
+			return 1;
+		}
 		debug_print(D_OUTPUT, "output_zmq: zmq_send error: %s", zmq_strerror(errno));
+		statsd_increment("output.zmq.errors");
 	}
+	return 0;
+}
+
+static int out_zmq_produce(void *selfptr, output_format_t format, vdl2_msg_metadata const *metadata, octet_string_t const *msg) {
+	ASSERT(selfptr != NULL);
+	out_zmq_ctx_t *self = selfptr;
+	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS || format == OFMT_CBOR) {
+		return out_zmq_produce_text(self, metadata, msg);
+	}
+	return 0;
 }
 
-static int out_zmq_produce(void *selfptr, output_format_t format, vdl2_msg_metadata *metadata, octet_string_t *msg) {
+// Called by libzmq (possibly from its I/O thread) when it's done with the message
+static void out_zmq_msg_free(void *data, void *hint) {
+	UNUSED(data);
+	output_qentry_release(hint);
+}
+
+// Publishes message buffers without copying. Each ZMQ message holds
+// a reference to its queue entry until libzmq releases it.
+static int out_zmq_produce_batch(void *selfptr, output_qentry_t **batch, size_t count) {
 	ASSERT(selfptr != NULL);
 	out_zmq_ctx_t *self = selfptr;
-	if(format == OFMT_TEXT || format == OFMT_JSON || format == OFMT_PP_ACARS) {
-		out_zmq_produce_text(self, metadata, msg);
+	ASSERT(self->zmq_sock != 0);
+	// Messages shorter than 2 bytes are skipped, as in out_zmq_produce_text
+	size_t last = 0;
+	for(size_t i = 0; i < count; i++) {
+		ASSERT(batch[i]->msg != NULL);
+		if(batch[i]->msg->len >= 2) {
+			last = i;
+		}
+	}
+	bool started = false;           // a multipart message is in progress
+	for(size_t i = 0; i < count; i++) {
+		octet_string_t const *ostr = batch[i]->msg;
+		if(ostr->len < 2) {
+			continue;
+		}
+		zmq_msg_t msg;
+		zmq_msg_init_data(&msg, ostr->buf, ostr->len, out_zmq_msg_free, output_qentry_ref(batch[i]));
+		int flags = ZMQ_DONTWAIT;
+		if(self->multipart && i < last) {
+			flags |= ZMQ_SNDMORE;
+		}
+		if(zmq_msg_send(&msg, self->zmq_sock, flags) < 0) {
+			int const err = errno;
+			// Frees the message (and drops the reference) if it hasn't been sent
+			zmq_msg_close(&msg);
+			if(self->multipart && started) {
+				// Terminate the message with an empty part, otherwise the
+				// next message would be appended to it. libzmq accepts
+				// the remaining parts of a message once the first one
+				// has been accepted, so this does not block.
+				if(zmq_send(self->zmq_sock, NULL, 0, 0) < 0) {
+					debug_print(D_OUTPUT, "output_zmq: zmq_send error: %s", zmq_strerror(errno));
+				}
+			}
+			if(err == EAGAIN) {
+				// Refused because of nodrop. This message and the following
+				// ones are handed back to the queue_overflow policy.
+				statsd_increment("output.zmq.overflows");
+				return count - i;
+			}
+			debug_print(D_OUTPUT, "output_zmq: zmq_send error: %s", zmq_strerror(err));
+			// In multipart mode the remaining parts are lost as well
+			size_t lost = 1;
+			if(self->multipart) {
+				for(size_t j = i + 1; j <= last; j++) {
+					if(batch[j]->msg->len >= 2) {
+						lost++;
+					}
+				}
+			}
+			statsd_add("output.zmq.errors", lost);
+			if(self->multipart) {
+				break;
+			}
+		} else {
+			started = (flags & ZMQ_SNDMORE) != 0;
+			statsd_increment("output.zmq.messages");
+		}
 	}
 	return 0;
 }
@@ -155,6 +307,26 @@ static const option_descr_t out_zmq_options[] = {
 		.name= "endpoint",
 		.description = "Socket endpoint: tcp://address:port (required)"
 	},
+	{
+		.name = "sndhwm",
+		.description = "Max number of messages queued for each subscriber (default: --output-queue-hwm value)"
+	},
+	{
+		.name = "multipart",
+		.description = "Send each batch of messages as a single multipart message: true or false (default: false)"
+	},
+	{
+		.name = "nodrop",
+		.description = "Stop sending to all subscribers while any one of them has sndhwm messages queued, instead of dropping its messages: true or false (default: false)"
+	},
+	{
+		.name = "batch_size",
+		.description = "Maximum number of queued messages sent at once (default: 64)"
+	},
+	{
+		.name = "batch_latency",
+		.description = "Maximum time in milliseconds to wait for more messages to fill up a batch (default: 0)"
+	},
 	{
 		.name = NULL,
 		.description = NULL
@@ -169,6 +341,7 @@ output_descriptor_t out_DEF_zmq = {
 	.configure = out_zmq_configure,
 	.init = out_zmq_init,
 	.produce = out_zmq_produce,
+	.produce_batch = out_zmq_produce_batch,
 	.handle_shutdown = out_zmq_handle_shutdown,
 	.handle_failure = out_zmq_handle_failure
 };
@@ -16,34 +16,380 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+
+// Reed-Solomon block verification.
+// Most blocks arrive without errors, so syndromes are computed first with
+// vectorized GF(256) arithmetic (SSSE3 or AVX2 on x86, chosen at runtime,
+// NEON on AArch64). The full libfec decoder (Berlekamp-Massey, Chien search,
+// Forney) only runs on blocks with nonzero syndromes. Shortened blocks, where
+// some FEC octets are not transmitted and are treated as erasures, are first
+// tried with an erasures-only decoder, which needs no search at all.
+
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include "fec.h"
 #include "dumpvdl2.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS_X86 1
+#include <immintrin.h>
+#endif
+
+// vqtbl1q_u8 is only available on AArch64
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define RS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define RS_GFPOLY 0x187         // GF(256) field generator polynomial
+#define RS_FCR 120              // first consecutive root of the code generator polynomial (index form)
+#define RS_NROOTS (RS_N - RS_K)
+#define GF_NN 255
+
+typedef void (*rs_syndromes_fn)(uint8_t const *data, uint32_t len, uint32_t stride,
+		uint32_t num_blocks, uint8_t (*synd)[RS_NROOTS]);
+
 void *rs;
+static rs_syndromes_fn rs_syndromes;
+
+static uint8_t gf_exp[2 * GF_NN];
+static uint8_t gf_log[256];
+// gf_mul_root[j][x] = x * alpha^(RS_FCR + j)
+static uint8_t gf_mul_root[RS_NROOTS][256];
+// Split multiplication tables for vector kernels:
+// [k][j][0][x] = x * y and [k][j][1][x] = (x << 4) * y, where y = alpha^((RS_FCR + j) * 2^k)
+#define GF_SPLIT_LEVELS 6
+static uint8_t gf_split[GF_SPLIT_LEVELS][RS_NROOTS][2][16] __attribute__((aligned(16)));
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+	return (a == 0 || b == 0) ? 0 : gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline uint8_t gf_div(uint8_t a, uint8_t b) {
+	return a == 0 ? 0 : gf_exp[gf_log[a] + GF_NN - gf_log[b]];
+}
+
+// alpha^n
+static inline uint8_t gf_pow(uint32_t n) {
+	return gf_exp[n % GF_NN];
+}
+
+// Computes syndromes of num_blocks blocks, each one stride octets apart, by
+// evaluating the first len octets of each block at the roots of the code
+// generator polynomial with Horner's scheme.
+static void rs_syndromes_generic(uint8_t const *data, uint32_t len, uint32_t stride,
+		uint32_t num_blocks, uint8_t (*synd)[RS_NROOTS]) {
+	for(uint32_t b = 0; b < num_blocks; b++, data += stride) {
+		uint8_t s[RS_NROOTS] = { 0 };
+		for(uint32_t i = 0; i < len; i++) {
+			for(int j = 0; j < RS_NROOTS; j++) {
+				s[j] = gf_mul_root[j][s[j]] ^ data[i];
+			}
+		}
+		memcpy(synd[b], s, RS_NROOTS);
+	}
+}
+
+// Vector kernels run Horner's scheme on 16 or 32 interleaved subsequences of
+// the block at once: lane l accumulates octets l, l + lanes, l + 2 * lanes, ...
+// using x_j^lanes as the multiplier. Multiplication by a constant is done
+// with two 16-entry table lookups, one per nibble. If len is not a multiple of
+// the lane count, the first chunk is padded with leading zeros, which do not
+// change the result. Finally lanes are folded in halves: lane l of the lower
+// half becomes lane[l] * x_j^half + lane[l + half], until one lane is left.
+
+// Returns the first chunk of len octets, zero-padded in buf if necessary
+static inline uint8_t const *first_chunk(uint8_t *buf, uint32_t lanes, uint8_t const *data, uint32_t len) {
+	uint32_t const head = len % lanes;
+	if(head == 0) {
+		return data;
+	}
+	memset(buf, 0, lanes - head);
+	memcpy(buf + lanes - head, data, head);
+	return buf;
+}
+
+#ifdef RS_X86
+__attribute__((target("ssse3")))
+static inline __m128i gf_mul_ssse3(__m128i a, uint8_t const (*tab)[16]) {
+	__m128i const mask = _mm_set1_epi8(0x0f);
+	__m128i const l = _mm_shuffle_epi8(_mm_load_si128((__m128i const *)tab[0]), _mm_and_si128(a, mask));
+	__m128i const h = _mm_shuffle_epi8(_mm_load_si128((__m128i const *)tab[1]),
+			_mm_and_si128(_mm_srli_epi64(a, 4), mask));
+	return _mm_xor_si128(l, h);
+}
+
+__attribute__((target("ssse3")))
+static inline uint8_t fold_ssse3(__m128i acc, int j) {
+	acc = _mm_xor_si128(gf_mul_ssse3(acc, gf_split[3][j]), _mm_srli_si128(acc, 8));
+	acc = _mm_xor_si128(gf_mul_ssse3(acc, gf_split[2][j]), _mm_srli_si128(acc, 4));
+	acc = _mm_xor_si128(gf_mul_ssse3(acc, gf_split[1][j]), _mm_srli_si128(acc, 2));
+	acc = _mm_xor_si128(gf_mul_ssse3(acc, gf_split[0][j]), _mm_srli_si128(acc, 1));
+	return (uint8_t)_mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("ssse3")))
+static void rs_syndromes_ssse3(uint8_t const *data, uint32_t len, uint32_t stride,
+		uint32_t num_blocks, uint8_t (*synd)[RS_NROOTS]) {
+	__m128i const mask = _mm_set1_epi8(0x0f);
+	__m128i lo[RS_NROOTS], hi[RS_NROOTS];
+	for(int j = 0; j < RS_NROOTS; j++) {
+		lo[j] = _mm_load_si128((__m128i const *)gf_split[4][j][0]);
+		hi[j] = _mm_load_si128((__m128i const *)gf_split[4][j][1]);
+	}
+	uint32_t const chunks = (len + 15) / 16;
+	uint8_t head[16];
+	for(uint32_t b = 0; b < num_blocks; b++, data += stride) {
+		__m128i acc[RS_NROOTS];
+		for(int j = 0; j < RS_NROOTS; j++) {
+			acc[j] = _mm_setzero_si128();
+		}
+		uint8_t const *in = first_chunk(head, 16, data, len);
+		uint8_t const *next = data + (len - 1) % 16 + 1;
+		for(uint32_t c = 0; c < chunks; c++, in = next, next += 16) {
+			__m128i const v = _mm_loadu_si128((__m128i const *)in);
+			for(int j = 0; j < RS_NROOTS; j++) {
+				__m128i const l = _mm_shuffle_epi8(lo[j], _mm_and_si128(acc[j], mask));
+				__m128i const h = _mm_shuffle_epi8(hi[j], _mm_and_si128(_mm_srli_epi64(acc[j], 4), mask));
+				acc[j] = _mm_xor_si128(_mm_xor_si128(l, h), v);
+			}
+		}
+		for(int j = 0; j < RS_NROOTS; j++) {
+			synd[b][j] = fold_ssse3(acc[j], j);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void rs_syndromes_avx2(uint8_t const *data, uint32_t len, uint32_t stride,
+		uint32_t num_blocks, uint8_t (*synd)[RS_NROOTS]) {
+	__m256i const mask = _mm256_set1_epi8(0x0f);
+	__m256i lo[RS_NROOTS], hi[RS_NROOTS];
+	for(int j = 0; j < RS_NROOTS; j++) {
+		lo[j] = _mm256_broadcastsi128_si256(_mm_load_si128((__m128i const *)gf_split[5][j][0]));
+		hi[j] = _mm256_broadcastsi128_si256(_mm_load_si128((__m128i const *)gf_split[5][j][1]));
+	}
+	uint32_t const chunks = (len + 31) / 32;
+	uint8_t head[32];
+	for(uint32_t b = 0; b < num_blocks; b++, data += stride) {
+		__m256i acc[RS_NROOTS];
+		for(int j = 0; j < RS_NROOTS; j++) {
+			acc[j] = _mm256_setzero_si256();
+		}
+		uint8_t const *in = first_chunk(head, 32, data, len);
+		uint8_t const *next = data + (len - 1) % 32 + 1;
+		for(uint32_t c = 0; c < chunks; c++, in = next, next += 32) {
+			__m256i const v = _mm256_loadu_si256((__m256i const *)in);
+			for(int j = 0; j < RS_NROOTS; j++) {
+				__m256i const l = _mm256_shuffle_epi8(lo[j], _mm256_and_si256(acc[j], mask));
+				__m256i const h = _mm256_shuffle_epi8(hi[j], _mm256_and_si256(_mm256_srli_epi64(acc[j], 4), mask));
+				acc[j] = _mm256_xor_si256(_mm256_xor_si256(l, h), v);
+			}
+		}
+		for(int j = 0; j < RS_NROOTS; j++) {
+			__m128i const a = _mm_xor_si128(gf_mul_ssse3(_mm256_castsi256_si128(acc[j]), gf_split[4][j]),
+					_mm256_extracti128_si256(acc[j], 1));
+			synd[b][j] = fold_ssse3(a, j);
+		}
+	}
+}
+#endif
+
+#ifdef RS_NEON
+static inline uint8x16_t gf_mul_neon(uint8x16_t a, uint8_t const (*tab)[16]) {
+	return veorq_u8(vqtbl1q_u8(vld1q_u8(tab[0]), vandq_u8(a, vdupq_n_u8(0x0f))),
+			vqtbl1q_u8(vld1q_u8(tab[1]), vshrq_n_u8(a, 4)));
+}
+
+static inline uint8_t fold_neon(uint8x16_t acc, int j) {
+	uint8x16_t const zero = vdupq_n_u8(0);
+	acc = veorq_u8(gf_mul_neon(acc, gf_split[3][j]), vextq_u8(acc, zero, 8));
+	acc = veorq_u8(gf_mul_neon(acc, gf_split[2][j]), vextq_u8(acc, zero, 4));
+	acc = veorq_u8(gf_mul_neon(acc, gf_split[1][j]), vextq_u8(acc, zero, 2));
+	acc = veorq_u8(gf_mul_neon(acc, gf_split[0][j]), vextq_u8(acc, zero, 1));
+	return vgetq_lane_u8(acc, 0);
+}
+
+static void rs_syndromes_neon(uint8_t const *data, uint32_t len, uint32_t stride,
+		uint32_t num_blocks, uint8_t (*synd)[RS_NROOTS]) {
+	uint8x16_t const mask = vdupq_n_u8(0x0f);
+	uint8x16_t lo[RS_NROOTS], hi[RS_NROOTS];
+	for(int j = 0; j < RS_NROOTS; j++) {
+		lo[j] = vld1q_u8(gf_split[4][j][0]);
+		hi[j] = vld1q_u8(gf_split[4][j][1]);
+	}
+	uint32_t const chunks = (len + 15) / 16;
+	uint8_t head[16];
+	for(uint32_t b = 0; b < num_blocks; b++, data += stride) {
+		uint8x16_t acc[RS_NROOTS];
+		for(int j = 0; j < RS_NROOTS; j++) {
+			acc[j] = vdupq_n_u8(0);
+		}
+		uint8_t const *in = first_chunk(head, 16, data, len);
+		uint8_t const *next = data + (len - 1) % 16 + 1;
+		for(uint32_t c = 0; c < chunks; c++, in = next, next += 16) {
+			uint8x16_t const v = vld1q_u8(in);
+			for(int j = 0; j < RS_NROOTS; j++) {
+				uint8x16_t const l = vqtbl1q_u8(lo[j], vandq_u8(acc[j], mask));
+				uint8x16_t const h = vqtbl1q_u8(hi[j], vshrq_n_u8(acc[j], 4));
+				acc[j] = veorq_u8(veorq_u8(l, h), v);
+			}
+		}
+		for(int j = 0; j < RS_NROOTS; j++) {
+			synd[b][j] = fold_neon(acc[j], j);
+		}
+	}
+}
+#endif
+
+// Corrects a block assuming the only errors are at erasure positions eras_pos.
+// This is the common case for shortened blocks, where missing FEC octets are
+// erased. synd holds syndromes in polynomial form.
+// Returns the number of erasures (like decode_rs_char() does) or -1 if there
+// are errors outside erased positions, in which case the block is not modified.
+static int rs_correct_erasures(uint8_t *data, uint8_t const *synd, int const *eras_pos, int no_eras) {
+	uint8_t x[RS_NROOTS];                   // erasure locators
+	uint8_t gamma[RS_NROOTS + 1] = { 1 };   // erasure locator polynomial
+	for(int k = 0; k < no_eras; k++) {
+		x[k] = gf_pow(GF_NN - 1 - eras_pos[k]);
+		for(int i = k + 1; i > 0; i--) {
+			gamma[i] ^= gf_mul(gamma[i-1], x[k]);
+		}
+	}
+	// Coefficients of gamma(x) * S(x) at powers no_eras..RS_NROOTS-1
+	// (Forney syndromes) must be zero if there are no errors besides erasures.
+	// Lower ones form the error evaluator polynomial.
+	uint8_t omega[RS_NROOTS];
+	for(int i = 0; i < RS_NROOTS; i++) {
+		uint8_t v = 0;
+		for(int k = 0; k <= i && k <= no_eras; k++) {
+			v ^= gf_mul(gamma[k], synd[i-k]);
+		}
+		if(i < no_eras) {
+			omega[i] = v;
+		} else if(v != 0) {
+			return -1;
+		}
+	}
+	// Forney algorithm
+	for(int k = 0; k < no_eras; k++) {
+		uint8_t const xinv = gf_div(1, x[k]);
+		uint8_t num = 0, den = 0, xpow = 1;
+		for(int i = 0; i < no_eras; i++) {
+			num ^= gf_mul(omega[i], xpow);
+			if(i % 2 == 0) {    // formal derivative of gamma(x)
+				den ^= gf_mul(gamma[i+1], xpow);
+			}
+			xpow = gf_mul(xpow, xinv);
+		}
+		// num * xinv^(RS_FCR - 1)
+		num = gf_mul(num, gf_pow((uint32_t)gf_log[xinv] * (RS_FCR - 1)));
+		if(den == 0) {
+			return -1;
+		}
+		data[eras_pos[k]] ^= gf_div(num, den);
+	}
+	return no_eras;
+}
 
 int rs_init() {
-	rs = init_rs_char(8, 0x187, 120, 1, RS_N - RS_K, 0);
-	return (rs ? 0 : -1);
-}
-
-int rs_verify(uint8_t *data, int fec_octets) {
-	if(fec_octets == 0)
-		return 0;
-	debug_print_buf_hex(D_BURST_DETAIL, data, RS_N, "Input data:\n");
-	int erasure_cnt = RS_N - RS_K - fec_octets;
-	int ret;
-	debug_print(D_BURST_DETAIL, "erasure_cnt=%d\n", erasure_cnt);
-	if(erasure_cnt > 0) {
-		int erasures[RS_N - RS_K];
-		for(int i = 0; i < erasure_cnt; i++)
-			erasures[i] = RS_K + fec_octets + i;
-		debug_print_buf_hex(D_BURST_DETAIL, erasures, (size_t)erasure_cnt, "Erasures:\n");
-		ret = decode_rs_char(rs, data, erasures, erasure_cnt);
-	} else {
-		ret = decode_rs_char(rs, data, NULL, erasure_cnt);
-	}
-	return ret;
+	rs = init_rs_char(8, RS_GFPOLY, RS_FCR, 1, RS_NROOTS, 0);
+	if(rs == NULL) {
+		return -1;
+	}
+	uint32_t sr = 1;
+	for(int i = 0; i < GF_NN; i++) {
+		gf_exp[i] = gf_exp[i + GF_NN] = (uint8_t)sr;
+		gf_log[sr] = (uint8_t)i;
+		sr <<= 1;
+		if(sr & 0x100) {
+			sr ^= RS_GFPOLY;
+		}
+	}
+	for(int j = 0; j < RS_NROOTS; j++) {
+		for(int x = 0; x < 256; x++) {
+			gf_mul_root[j][x] = gf_mul(x, gf_pow(RS_FCR + j));
+		}
+	}
+	for(int k = 0; k < GF_SPLIT_LEVELS; k++) {
+		for(int j = 0; j < RS_NROOTS; j++) {
+			uint8_t y = gf_pow((RS_FCR + j) << k);
+			for(int x = 0; x < 16; x++) {
+				gf_split[k][j][0][x] = gf_mul(x, y);
+				gf_split[k][j][1][x] = gf_mul(x << 4, y);
+			}
+		}
+	}
+
+	rs_syndromes = rs_syndromes_generic;
+#ifdef RS_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		rs_syndromes = rs_syndromes_avx2;
+	} else if(__builtin_cpu_supports("ssse3")) {
+		rs_syndromes = rs_syndromes_ssse3;
+	}
+#endif
+#ifdef RS_NEON
+	rs_syndromes = rs_syndromes_neon;
+#endif
+	return 0;
+}
+
+// Verifies and corrects num_blocks Reed-Solomon blocks in place. All blocks
+// except the last one are full. The last one holds last_len data octets
+// (the rest of its data part must be zeroed) and last_fec FEC octets.
+// Missing FEC octets are treated as erasures. Stores the result for each
+// block in ret: the number of corrected octets (including erasures)
+// or -1 if the block is uncorrectable.
+void rs_verify_blocks(uint8_t (*blocks)[RS_N], uint32_t num_blocks,
+		uint32_t last_len, int last_fec, int *ret) {
+	if(num_blocks == 0) {
+		return;
+	}
+	uint8_t synd[num_blocks][RS_NROOTS];
+	// full blocks in one go
+	rs_syndromes(blocks[0], RS_N, RS_N, num_blocks - 1, synd);
+	// Zeros between data and FEC octets of the last block do not contribute to
+	// syndromes, so they are skipped by multiplying partial results by x_j^num_zeros.
+	uint8_t *last = blocks[num_blocks - 1];
+	uint8_t *s = synd[num_blocks - 1];
+	rs_syndromes(last, last_len, RS_N, 1, &synd[num_blocks - 1]);
+	for(int j = 0; j < RS_NROOTS; j++) {
+		s[j] = gf_mul(s[j], gf_pow((RS_FCR + j) * (RS_K - last_len)));
+		for(int i = RS_K; i < RS_N; i++) {
+			s[j] = gf_mul_root[j][s[j]] ^ last[i];
+		}
+	}
+
+	for(uint32_t b = 0; b < num_blocks; b++) {
+		int fec_octets = (b == num_blocks - 1 ? last_fec : RS_NROOTS);
+		if(fec_octets == 0) {
+			ret[b] = 0;
+			continue;
+		}
+		uint8_t syn_error = 0;
+		for(int j = 0; j < RS_NROOTS; j++) {
+			syn_error |= synd[b][j];
+		}
+		if(syn_error == 0) {
+			ret[b] = 0;
+			continue;
+		}
+		debug_print_buf_hex(D_BURST_DETAIL, blocks[b], RS_N, "Input data:\n");
+		int erasure_cnt = RS_NROOTS - fec_octets;
+		debug_print(D_BURST_DETAIL, "erasure_cnt=%d\n", erasure_cnt);
+		if(erasure_cnt > 0) {
+			int erasures[RS_NROOTS];
+			for(int i = 0; i < erasure_cnt; i++)
+				erasures[i] = RS_K + fec_octets + i;
+			debug_print_buf_hex(D_BURST_DETAIL, erasures, (size_t)erasure_cnt, "Erasures:\n");
+			if((ret[b] = rs_correct_erasures(blocks[b], synd[b], erasures, erasure_cnt)) < 0) {
+				ret[b] = decode_rs_char(rs, blocks[b], erasures, erasure_cnt);
+			}
+		} else {
+			ret[b] = decode_rs_char(rs, blocks[b], NULL, 0);
+		}
+	}
 }
@@ -0,0 +1,134 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Publishing, fetching and releasing blocks does not take any locks.
+// The mutex and condition variable are used only to put threads to sleep
+// when there is nothing to do (readers) or no free slot (blocking producer).
+// Wakeups are skipped when nobody sleeps. Sleepers register themselves before
+// re-checking the condition and wakers check for sleepers after updating it
+// (both sequentially consistent), so a wakeup cannot be lost.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "sample_ring.h"
+#include "dumpvdl2.h"           // NEW, ASSERT
+
+sample_ring_t *sample_ring_new(int num_readers, bool blocking) {
+	ASSERT(num_readers > 0);
+	NEW(sample_ring_t, r);
+	r->num_readers = num_readers;
+	r->blocking = blocking;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->sleepers, 0);
+	atomic_init(&r->stopped, false);
+	for(int i = 0; i < SAMPLE_RING_LEN; i++) {
+		atomic_init(&r->blocks[i].refcount, 0);
+	}
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	return r;
+}
+
+static void sample_ring_wake(sample_ring_t *r) {
+	if(atomic_load(&r->sleepers) > 0) {
+		pthread_mutex_lock(&r->mutex);
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+	}
+}
+
+static void sample_ring_wait_released(sample_ring_t *r, sample_block_t *b) {
+	pthread_mutex_lock(&r->mutex);
+	atomic_fetch_add(&r->sleepers, 1);
+	while(atomic_load(&b->refcount) != 0) {
+		pthread_cond_wait(&r->cond, &r->mutex);
+	}
+	atomic_fetch_sub(&r->sleepers, 1);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+// Returns the block to be filled by the producer or NULL if the ring
+// is full and the ring is non-blocking.
+sample_block_t *sample_ring_reserve(sample_ring_t *r) {
+	uint64_t const head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	sample_block_t *b = &r->blocks[head % SAMPLE_RING_LEN];
+	if(atomic_load(&b->refcount) != 0) {
+		if(!r->blocking) {
+			return NULL;
+		}
+		sample_ring_wait_released(r, b);
+	}
+	return b;
+}
+
+// Makes the most recently reserved block available to readers
+void sample_ring_publish(sample_ring_t *r) {
+	uint64_t const head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	atomic_store_explicit(&r->blocks[head % SAMPLE_RING_LEN].refcount, r->num_readers, memory_order_relaxed);
+	atomic_store(&r->head, head + 1);
+	sample_ring_wake(r);
+}
+
+// Returns the number of blocks published so far
+uint64_t sample_ring_head(sample_ring_t *r) {
+	return atomic_load(&r->head);
+}
+
+// Waits until the block with the given sequence number gets published
+// or the ring is stopped
+void sample_ring_wait(sample_ring_t *r, uint64_t seq) {
+	if(atomic_load(&r->head) <= seq && !atomic_load(&r->stopped)) {
+		pthread_mutex_lock(&r->mutex);
+		atomic_fetch_add(&r->sleepers, 1);
+		while(atomic_load(&r->head) <= seq && !atomic_load(&r->stopped)) {
+			pthread_cond_wait(&r->cond, &r->mutex);
+		}
+		atomic_fetch_sub(&r->sleepers, 1);
+		pthread_mutex_unlock(&r->mutex);
+	}
+}
+
+// Returns the block with the given sequence number, waiting until it gets published.
+// Readers must call it with consecutive sequence numbers, starting from 0,
+// and release each block when done.
+sample_block_t *sample_ring_get(sample_ring_t *r, uint64_t seq) {
+	sample_ring_wait(r, seq);
+	return &r->blocks[seq % SAMPLE_RING_LEN];
+}
+
+void sample_ring_release(sample_ring_t *r, sample_block_t *b) {
+	if(atomic_fetch_sub(&b->refcount, 1) == 1) {
+		sample_ring_wake(r);
+	}
+}
+
+// Wakes up all readers waiting in sample_ring_wait and makes further
+// calls return immediately
+void sample_ring_stop(sample_ring_t *r) {
+	atomic_store(&r->stopped, true);
+	sample_ring_wake(r);
+}
+
+// Waits until all readers have processed all published blocks
+void sample_ring_drain(sample_ring_t *r) {
+	uint64_t const head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if(head > 0) {
+		sample_ring_wait_released(r, &r->blocks[(head - 1) % SAMPLE_RING_LEN]);
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SAMPLE_RING_H
+#define _SAMPLE_RING_H 1
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "fft.h"                // cfloat_t
+
+// Number of sample blocks buffered between the input thread and demodulators
+#define SAMPLE_RING_LEN 16
+
+typedef struct {
+	float *samples;                 // interleaved I/Q samples (per-channel front ends)
+	uint32_t len;                   // number of floats in samples
+	uint32_t capacity;
+	cfloat_t *spectra;              // channelizer output (FFT front end)
+	uint32_t num_spectra;
+	uint32_t spectra_capacity;      // number of bins allocated
+	atomic_int refcount;            // number of readers which have not released this block yet
+} sample_block_t;
+
+// Single producer, multiple consumer ring of sample blocks.
+// Every reader processes every block and keeps its own read position.
+// A slot is reused after all readers have released it.
+typedef struct {
+	sample_block_t blocks[SAMPLE_RING_LEN];
+	atomic_uint_fast64_t head;      // sequence number of the next block to be published
+	atomic_int sleepers;            // number of threads waiting on cond
+	atomic_bool stopped;            // readers must not wait for new blocks anymore
+	int num_readers;
+	bool blocking;                  // when full, wait for readers instead of dropping blocks
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} sample_ring_t;
+
+sample_ring_t *sample_ring_new(int num_readers, bool blocking);
+sample_block_t *sample_ring_reserve(sample_ring_t *r);
+void sample_ring_publish(sample_ring_t *r);
+uint64_t sample_ring_head(sample_ring_t *r);
+void sample_ring_wait(sample_ring_t *r, uint64_t seq);
+sample_block_t *sample_ring_get(sample_ring_t *r, uint64_t seq);
+void sample_ring_release(sample_ring_t *r, sample_block_t *b);
+void sample_ring_drain(sample_ring_t *r);
+void sample_ring_stop(sample_ring_t *r);
+
+#endif // !_SAMPLE_RING_H
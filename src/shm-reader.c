@@ -0,0 +1,135 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// dumpvdl2-shm-reader - prints messages published by the shm output
+// of dumpvdl2 to standard output.
+
+#include <errno.h>
+#include <inttypes.h>                   // PRIu64
+#include <signal.h>                     // sigaction
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>                     // strtol
+#include <string.h>                     // strerror
+#include <time.h>                       // nanosleep
+#include <unistd.h>                     // getopt
+#include "shm-ring.h"
+
+// Same as OFMT_BINARY and OFMT_CBOR in output-common.h
+#define FORMAT_BINARY 3
+#define FORMAT_CBOR 5
+#define MSG_BUF_LEN 65536
+
+static volatile sig_atomic_t do_exit = 0;
+
+static void sighandler(int sig) {
+	(void)sig;
+	do_exit = 1;
+}
+
+static void usage(char const *progname) {
+	fprintf(stderr,
+		"Usage: %s [-o] [-i <poll_interval_ms>] <segment_name>\n\n"
+		"Prints messages from a dumpvdl2 shared memory ring (shm output) to standard output.\n\n"
+		"Options:\n"
+		"  -o    start with the oldest message in the ring (default: print only new messages)\n"
+		"  -i    how often to check for new messages when idle (default: 10 ms)\n",
+		progname);
+}
+
+int main(int argc, char **argv) {
+	bool from_oldest = false;
+	long poll_interval = 10;
+	int opt;
+	while((opt = getopt(argc, argv, "oi:h")) != -1) {
+		switch(opt) {
+			case 'o':
+				from_oldest = true;
+				break;
+			case 'i':
+				poll_interval = strtol(optarg, NULL, 10);
+				if(poll_interval < 1 || poll_interval > 10000) {
+					fprintf(stderr, "Invalid poll interval: %s (must be 1-10000)\n", optarg);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	char const *name = argv[optind];
+	shm_ring_reader_t *r = shm_ring_reader_open(name, from_oldest);
+	if(r == NULL) {
+		fprintf(stderr, "Could not open shared memory ring %s: %s\n", name, strerror(errno));
+		return 1;
+	}
+
+	struct sigaction sigact;
+	memset(&sigact, 0, sizeof(sigact));
+	sigact.sa_handler = &sighandler;
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+
+	static uint8_t buf[MSG_BUF_LEN];
+	struct timespec const idle = { .tv_sec = poll_interval / 1000, .tv_nsec = (poll_interval % 1000) * 1000000L };
+	uint64_t lost = 0;
+	while(!do_exit) {
+		uint32_t format = 0;
+		long len = r != NULL ? shm_ring_read(r, buf, sizeof(buf), &format, &lost) : -1;
+		if(len < 0) {
+			// The ring has been reinitialized - attach to it again
+			shm_ring_reader_close(r);
+			r = shm_ring_reader_open(name, true);
+		}
+		if(len <= 0) {
+			fflush(stdout);
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if(lost > 0) {
+			fprintf(stderr, "%s: %" PRIu64 " messages lost\n", name, lost);
+			lost = 0;
+		}
+		if(len > MSG_BUF_LEN) {
+			fprintf(stderr, "%s: message truncated (%ld bytes)\n", name, len);
+			len = MSG_BUF_LEN;
+		}
+		if(format == FORMAT_BINARY) {
+			// Same framing as in the file output
+			uint32_t frame_len = len + 2;
+			uint8_t frame_len_be[2] = { (frame_len >> 8) & 0xff, frame_len & 0xff };
+			fwrite(frame_len_be, 1, sizeof(frame_len_be), stdout);
+			fwrite(buf, 1, len, stdout);
+		} else if(format == FORMAT_CBOR) {
+			// CBOR data items are self-delimiting
+			fwrite(buf, 1, len, stdout);
+		} else {
+			fwrite(buf, 1, len, stdout);
+			fputc('\n', stdout);
+		}
+	}
+	shm_ring_reader_close(r);
+	return 0;
+}
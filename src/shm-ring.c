@@ -0,0 +1,313 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The writer appends records at head. Records never wrap around the end
+// of the data area - if a record does not fit, the rest of the area is
+// filled with a padding record and the message is stored at the beginning.
+// Before overwriting anything, the writer moves tail past the records
+// which are about to be destroyed. Head is advanced after the record is
+// complete.
+// Readers work like seqlock readers: a record is copied out first and then
+// tail is checked to see whether the writer has started overwriting it in
+// the meantime. If it has, the copy is discarded and the reader skips to
+// the current tail. Lost messages are counted by comparing record sequence
+// numbers. Reading does not involve any system calls.
+
+#include <errno.h>
+#include <fcntl.h>                      // O_* constants
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>                     // calloc, free
+#include <string.h>                     // memcpy, strdup
+#include <time.h>                       // clock_gettime
+#include <unistd.h>                     // ftruncate, close, getpid
+#include <sys/mman.h>                   // shm_open, mmap
+#include <sys/stat.h>                   // fstat
+#include "shm-ring.h"
+
+#define SHM_RING_REC_LEN(len) \
+	((sizeof(shm_ring_record_t) + (len) + SHM_RING_ALIGN - 1) & ~(uint64_t)(SHM_RING_ALIGN - 1))
+
+struct shm_ring_writer {
+	shm_ring_header_t *hdr;
+	uint8_t *data;
+	size_t map_len;
+	uint64_t mask;
+	uint64_t head, tail;            // local copies of hdr->head and hdr->tail
+	uint64_t seq;                   // sequence number of the next message
+};
+
+struct shm_ring_reader {
+	shm_ring_header_t *hdr;
+	uint8_t *data;
+	size_t map_len;
+	uint64_t mask;
+	uint64_t instance;
+	uint64_t pos;                   // position of the next record to read
+	uint64_t seq;                   // expected sequence number of the next record
+	bool seq_valid;
+};
+
+// Creates the segment (or reuses the existing one) and initializes an empty
+// ring in it. data_size must be a power of 2.
+shm_ring_writer_t *shm_ring_writer_create(char const *name, size_t data_size) {
+	if(name == NULL || data_size < 4096 || (data_size & (data_size - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		return NULL;
+	}
+	size_t map_len = SHM_RING_HEADER_LEN + data_size;
+	if(ftruncate(fd, map_len) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+	if(map == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+	shm_ring_writer_t *w = calloc(1, sizeof(shm_ring_writer_t));
+	if(w == NULL) {
+		munmap(map, map_len);
+		errno = ENOMEM;
+		return NULL;
+	}
+	w->hdr = map;
+	w->data = (uint8_t *)map + SHM_RING_HEADER_LEN;
+	w->map_len = map_len;
+	w->mask = data_size - 1;
+
+	// Readers attached to the previous instance of the ring resynchronize
+	// when they notice the instance change
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	shm_ring_header_t *hdr = w->hdr;
+	atomic_store(&hdr->magic, 0);
+	hdr->version = SHM_RING_VERSION;
+	hdr->data_size = data_size;
+	atomic_store(&hdr->tail, 0);
+	atomic_store(&hdr->head, 0);
+	atomic_store(&hdr->instance, ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ (uint64_t)getpid());
+	atomic_store_explicit(&hdr->magic, SHM_RING_MAGIC, memory_order_release);
+	return w;
+}
+
+// Advances tail until there is room for len more bytes at head
+static void shm_ring_make_room(shm_ring_writer_t *w, uint64_t len) {
+	uint64_t const size = w->mask + 1;
+	if(w->head + len - w->tail <= size) {
+		return;
+	}
+	while(w->head + len - w->tail > size) {
+		shm_ring_record_t const *rec = (shm_ring_record_t const *)(w->data + (w->tail & w->mask));
+		if(rec->len == SHM_RING_PADDING) {
+			w->tail += size - (w->tail & w->mask);
+		} else {
+			w->tail += SHM_RING_REC_LEN(rec->len);
+		}
+	}
+	atomic_store_explicit(&w->hdr->tail, w->tail, memory_order_relaxed);
+	// Make the new tail visible before the old records get overwritten
+	atomic_thread_fence(memory_order_release);
+}
+
+// Appends a message to the ring and makes it visible to readers.
+// Returns 0 on success, -1 if the message is too large.
+int shm_ring_write(shm_ring_writer_t *w, void const *buf, size_t len, uint32_t format) {
+	uint64_t const size = w->mask + 1;
+	uint64_t const rec_len = SHM_RING_REC_LEN(len);
+	if(len >= SHM_RING_PADDING || rec_len > size / 2) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	uint64_t off = w->head & w->mask;
+	uint64_t pad_len = (off + rec_len > size) ? size - off : 0;
+	shm_ring_make_room(w, pad_len + rec_len);
+	if(pad_len > 0) {
+		shm_ring_record_t *pad = (shm_ring_record_t *)(w->data + off);
+		*pad = (shm_ring_record_t){ .seq = w->seq, .len = SHM_RING_PADDING };
+		w->head += pad_len;
+		off = 0;
+	}
+	shm_ring_record_t *rec = (shm_ring_record_t *)(w->data + off);
+	*rec = (shm_ring_record_t){ .seq = w->seq, .len = len, .format = format };
+	memcpy(rec + 1, buf, len);
+	w->seq++;
+	w->head += rec_len;
+	atomic_store_explicit(&w->hdr->head, w->head, memory_order_release);
+	return 0;
+}
+
+// The segment is not removed, so that readers can fetch remaining messages
+void shm_ring_writer_destroy(shm_ring_writer_t *w) {
+	if(w == NULL) {
+		return;
+	}
+	munmap(w->hdr, w->map_len);
+	free(w);
+}
+
+// Attaches to an existing ring. Reading starts from the oldest available
+// message if from_oldest is true or from the next message written otherwise.
+shm_ring_reader_t *shm_ring_reader_open(char const *name, bool from_oldest) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	if((size_t)st.st_size < SHM_RING_HEADER_LEN + 4096) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+	if(map == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+	shm_ring_header_t *hdr = map;
+	if(atomic_load_explicit(&hdr->magic, memory_order_acquire) != SHM_RING_MAGIC ||
+			hdr->version != SHM_RING_VERSION) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	uint64_t data_size = hdr->data_size;
+	if(data_size < 4096 || (data_size & (data_size - 1)) != 0 ||
+			SHM_RING_HEADER_LEN + data_size > (uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	shm_ring_reader_t *r = calloc(1, sizeof(shm_ring_reader_t));
+	if(r == NULL) {
+		munmap(map, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	r->hdr = hdr;
+	r->data = (uint8_t *)map + SHM_RING_HEADER_LEN;
+	r->map_len = st.st_size;
+	r->mask = data_size - 1;
+	r->instance = atomic_load(&hdr->instance);
+	r->pos = from_oldest ? atomic_load(&hdr->tail) : atomic_load(&hdr->head);
+	// The first record of the ring always has sequence number 0. Otherwise
+	// lost messages are counted from the first message read.
+	r->seq_valid = (r->pos == 0);
+	return r;
+}
+
+// Copies the next message to buf. Returns the length of the message (which
+// is truncated if it's longer than buflen), 0 if there is no new message
+// or -1 if the ring is not usable (eg. it's being reinitialized or it has
+// been recreated with a different size and must be reopened).
+// If any messages have been overwritten before they could be read,
+// their number is added to *lost. A reinitialization of the ring by
+// the writer resets the reader to the beginning of the ring.
+long shm_ring_read(shm_ring_reader_t *r, void *buf, size_t buflen, uint32_t *format, uint64_t *lost) {
+	shm_ring_header_t *hdr = r->hdr;
+	uint64_t const size = r->mask + 1;
+	while(1) {
+		if(atomic_load_explicit(&hdr->magic, memory_order_acquire) != SHM_RING_MAGIC) {
+			return -1;
+		}
+		if(atomic_load_explicit(&hdr->instance, memory_order_relaxed) != r->instance) {
+			if(hdr->data_size != size) {
+				// The ring has been recreated with a different size - reopen it
+				return -1;
+			}
+			r->instance = atomic_load(&hdr->instance);
+			r->pos = 0;
+			r->seq = 0;
+			r->seq_valid = true;
+		}
+		uint64_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+		if(r->pos == head) {
+			return 0;
+		}
+		uint64_t tail = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+		if(r->pos < tail || r->pos > head) {
+			// Overrun - skip to the oldest record still available
+			r->pos = tail;
+			continue;
+		}
+		uint64_t const off = r->pos & r->mask;
+		shm_ring_record_t rec;
+		memcpy(&rec, r->data + off, sizeof(rec));
+		uint64_t rec_len = 0;
+		size_t copied = 0;
+		if(rec.len == SHM_RING_PADDING) {
+			rec_len = size - off;
+		} else {
+			rec_len = SHM_RING_REC_LEN(rec.len);
+			if(off + rec_len <= size) {
+				copied = rec.len < buflen ? rec.len : buflen;
+				memcpy(buf, r->data + off + sizeof(rec), copied);
+			}
+		}
+		// Discard the copy if the writer has started overwriting the record
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&hdr->tail, memory_order_relaxed) > r->pos) {
+			continue;
+		}
+		if(off + rec_len > size) {
+			// Can only happen if the header was read while being reinitialized
+			r->pos = head;
+			r->seq_valid = false;
+			continue;
+		}
+		r->pos += rec_len;
+		if(rec.len == SHM_RING_PADDING) {
+			continue;
+		}
+		if(r->seq_valid && rec.seq > r->seq && lost != NULL) {
+			*lost += rec.seq - r->seq;
+		}
+		r->seq = rec.seq + 1;
+		r->seq_valid = true;
+		if(format != NULL) {
+			*format = rec.format;
+		}
+		return rec.len;
+	}
+}
+
+void shm_ring_reader_close(shm_ring_reader_t *r) {
+	if(r == NULL) {
+		return;
+	}
+	munmap(r->hdr, r->map_len);
+	free(r);
+}
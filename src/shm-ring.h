@@ -0,0 +1,72 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Single writer, multiple reader message ring in a POSIX shared memory
+// segment. The writer never waits for readers - it overwrites the oldest
+// messages when the ring is full. Readers detect this with the help of
+// message sequence numbers.
+//
+// This file and shm-ring.c do not depend on the rest of dumpvdl2, so they
+// can be copied into consumer programs as they are.
+
+#ifndef _SHM_RING_H
+#define _SHM_RING_H 1
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC          0x32564453      // "SDV2"
+#define SHM_RING_VERSION        1
+#define SHM_RING_HEADER_LEN     4096            // offset of the data area in the segment
+#define SHM_RING_ALIGN          16              // alignment of records in the data area
+#define SHM_RING_PADDING        UINT32_MAX      // len of a record which fills up the end of the data area
+
+// Segment header. Positions are byte offsets counted from the creation
+// of the ring; they are reduced modulo data_size to get the offset
+// in the data area.
+typedef struct {
+	_Atomic uint32_t magic;         // set after the rest of the header is initialized
+	uint32_t version;
+	uint64_t data_size;             // length of the data area (power of 2)
+	_Atomic uint64_t instance;      // changes whenever the writer initializes the ring
+	alignas(64) _Atomic uint64_t head;      // end of the last complete record
+	_Atomic uint64_t tail;          // start of the oldest record which has not been overwritten
+} shm_ring_header_t;
+
+// Record header, followed by len bytes of data padded to SHM_RING_ALIGN
+typedef struct {
+	uint64_t seq;                   // message sequence number
+	uint32_t len;
+	uint32_t format;                // data format (output_format_t)
+} shm_ring_record_t;
+
+typedef struct shm_ring_writer shm_ring_writer_t;
+typedef struct shm_ring_reader shm_ring_reader_t;
+
+shm_ring_writer_t *shm_ring_writer_create(char const *name, size_t data_size);
+int shm_ring_write(shm_ring_writer_t *w, void const *buf, size_t len, uint32_t format);
+void shm_ring_writer_destroy(shm_ring_writer_t *w);
+
+shm_ring_reader_t *shm_ring_reader_open(char const *name, bool from_oldest);
+long shm_ring_read(shm_ring_reader_t *r, void *buf, size_t buflen, uint32_t *format, uint64_t *lost);
+void shm_ring_reader_close(shm_ring_reader_t *r);
+
+#endif // !_SHM_RING_H
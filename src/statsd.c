@@ -42,8 +42,10 @@ static char const *counters_per_channel[] = {
 	"avlc.msg.gnd2air",
 	"avlc.msg.gnd2all",
 	"avlc.msg.gnd2gnd",
+	"decoder.allocs",
 	"decoder.blocks.fec_ok",
 	"decoder.blocks.processed",
+	"decoder.bytes.touched",
 	"decoder.crc.good",
 	"decoder.crc.bad",
 	"decoder.errors.bitstream",
@@ -60,6 +62,9 @@ static char const *counters_per_channel[] = {
 	"decoder.msg.good",
 	"decoder.msg.good_loud",
 	"decoder.preambles.good",
+	"demod.squelch.opened",
+	"demod.squelch.samples_gated",
+	"demod.squelch.samples_total",
 	"demod.sync.good",
 	NULL
 };
@@ -160,6 +165,15 @@ void statsd_counter_per_channel_increment(uint32_t freq, char *counter) {
 	statsd_inc(statsd, metric, 1.0);
 }
 
+void statsd_counter_per_channel_add(uint32_t freq, char *counter, size_t value) {
+	if(statsd == NULL) {
+		return;
+	}
+	char metric[256];
+	snprintf(metric, sizeof(metric), "%d.%s", freq, counter);
+	statsd_count(statsd, metric, value, 1.0);
+}
+
 void statsd_counter_per_msgdir_increment(la_msg_dir msg_dir, char *counter) {
 	if(statsd == NULL) {
 		return;
@@ -176,6 +190,13 @@ void statsd_counter_increment(char *counter) {
 	statsd_inc(statsd, counter, 1.0);
 }
 
+void statsd_counter_add(char *counter, size_t value) {
+	if(statsd == NULL) {
+		return;
+	}
+	statsd_count(statsd, counter, value, 1.0);
+}
+
 void statsd_gauge_set(char *gauge, size_t value) {
 	if(statsd == NULL) {
 		return;
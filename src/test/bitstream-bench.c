@@ -0,0 +1,162 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares the speed of bit stream operations done while decoding
+// a burst, for the packed bit streams and the byte-per-bit reference.
+// Usage: bitstream-bench [iterations]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "dumpvdl2.h"                   // bitstream_*, BSLEN
+#include "bitstream-ref.h"              // ref_bitstream_*
+#include "test-common.h"
+
+#define LFSR_IV 0x6959u
+#define BURST_OCTETS 1500
+#define NUM_SYMBOLS (BURST_OCTETS * 8 / 3 + 1)
+
+static uint8_t symbols[NUM_SYMBOLS];
+static uint8_t payload[BURST_OCTETS];
+static uint8_t octets[BURST_OCTETS];
+static uint8_t frame[BURST_OCTETS];
+
+typedef struct {
+	double append, descramble, octets, unstuff;
+} timings_t;
+
+static void timings_print(char const *name, timings_t const *t, int iterations) {
+	double const f = 1e6 / iterations;
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f %10.2f\n", name,
+			t->append * f, t->descramble * f, t->octets * f, t->unstuff * f,
+			(t->append + t->descramble + t->octets + t->unstuff) * f);
+}
+
+// Random symbols and an HDLC-like payload: flag, random data with
+// zeros stuffed after five ones, flag
+static void generate_input() {
+	for(int i = 0; i < NUM_SYMBOLS; i++) {
+		symbols[i] = test_rand() & 7;
+	}
+	memset(payload, 0, sizeof(payload));
+	int nbits = 0, ones = 0;
+#define PUT_BIT(b) do { payload[nbits / 8] |= (b) << (nbits % 8); nbits++; } while(0)
+	for(int i = 0; i < 8; i++) {
+		PUT_BIT((0x7e >> i) & 1);
+	}
+	while(nbits < BURST_OCTETS * 8 - 16) {
+		int const bit = test_rand() & 1;
+		PUT_BIT(bit);
+		if(bit && ++ones == 5) {
+			PUT_BIT(0);
+			ones = 0;
+		} else if(!bit) {
+			ones = 0;
+		}
+	}
+	for(int i = 0; i < 8; i++) {
+		PUT_BIT((0x7e >> i) & 1);
+	}
+#undef PUT_BIT
+}
+
+static void bench_packed(int iterations, timings_t *t) {
+	bitstream_t *bs = bitstream_init(BSLEN);
+	for(int it = 0; it < iterations; it++) {
+		double t0 = test_now();
+		bitstream_reset(bs);
+		for(int i = 0; i < NUM_SYMBOLS; i++) {
+			bitstream_append_msbfirst(bs, &symbols[i], 1, 3);
+		}
+		double t1 = test_now();
+		uint32_t lfsr_pos = 0;
+		bitstream_descramble(bs, &lfsr_pos);
+		double t2 = test_now();
+		bitstream_read_lsbfirst(bs, octets, BURST_OCTETS, 8);
+		bitstream_reset(bs);
+		bitstream_append_lsbfirst(bs, payload, BURST_OCTETS, 8);
+		double t3 = test_now();
+		uint32_t num_bits;
+		uint16_t fcs;
+		while(bitstream_unstuff_next_frame(bs, frame, sizeof(frame), &num_bits, &fcs) > 0)
+			;
+		double t4 = test_now();
+		t->append += t1 - t0;
+		t->descramble += t2 - t1;
+		t->octets += t3 - t2;
+		t->unstuff += t4 - t3;
+	}
+	bitstream_destroy(bs);
+}
+
+static void bench_ref(int iterations, timings_t *t) {
+	ref_bitstream_t *bs = ref_bitstream_init(BSLEN), *frame_bs = ref_bitstream_init(BSLEN);
+	for(int it = 0; it < iterations; it++) {
+		double t0 = test_now();
+		ref_bitstream_reset(bs);
+		for(int i = 0; i < NUM_SYMBOLS; i++) {
+			ref_bitstream_append_msbfirst(bs, &symbols[i], 1, 3);
+		}
+		double t1 = test_now();
+		uint16_t lfsr = LFSR_IV;
+		ref_bitstream_descramble(bs, &lfsr);
+		double t2 = test_now();
+		ref_bitstream_read_lsbfirst(bs, octets, BURST_OCTETS, 8);
+		ref_bitstream_reset(bs);
+		ref_bitstream_append_lsbfirst(bs, payload, BURST_OCTETS, 8);
+		double t3 = test_now();
+		// Frames had to be converted to octets in a separate pass
+		while(ref_bitstream_copy_next_frame(bs, frame_bs) > 0) {
+			ref_bitstream_read_lsbfirst(frame_bs, frame, (frame_bs->end - frame_bs->start) / 8, 8);
+		}
+		double t4 = test_now();
+		t->append += t1 - t0;
+		t->descramble += t2 - t1;
+		t->octets += t3 - t2;
+		t->unstuff += t4 - t3;
+	}
+	ref_bitstream_destroy(bs);
+	ref_bitstream_destroy(frame_bs);
+}
+
+int main(int argc, char **argv) {
+	int const iterations = test_iterations(argc, argv, 20000);
+	bitstream_descrambler_init(LFSR_IV);
+	bitstream_unstuffer_init();
+	generate_input();
+
+	timings_t packed = {0}, ref = {0};
+	// Warm up caches and branch predictors first
+	bench_ref(iterations / 10 + 1, &ref);
+	bench_packed(iterations / 10 + 1, &packed);
+	memset(&ref, 0, sizeof(ref));
+	memset(&packed, 0, sizeof(packed));
+	bench_ref(iterations, &ref);
+	bench_packed(iterations, &packed);
+
+	printf("%d-octet burst, %d 3-bit symbol appends, %d iterations\n",
+			BURST_OCTETS, NUM_SYMBOLS, iterations);
+	printf("%-8s %10s %10s %10s %10s %10s   (us per burst)\n",
+			"", "append", "descramble", "octets", "unstuff", "total");
+	timings_print("bytes", &ref, iterations);
+	timings_print("packed", &packed, iterations);
+	printf("bit stream buffer size: bytes %zu B, packed %zu B\n",
+			(size_t)BSLEN, (size_t)(BSLEN / 64 + 2) * sizeof(uint64_t));
+	return 0;
+}
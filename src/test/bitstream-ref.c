@@ -0,0 +1,139 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include "dumpvdl2.h"                   // NEW, XCALLOC, XFREE
+#include "bitstream-ref.h"
+
+ref_bitstream_t *ref_bitstream_init(uint32_t len) {
+	if(len == 0) return NULL;
+	NEW(ref_bitstream_t, ret);
+	ret->buf = XCALLOC(len, sizeof(uint8_t));
+	ret->start = ret->end = ret->descrambler_pos = 0;
+	ret->len = len;
+	return ret;
+}
+
+void ref_bitstream_reset(ref_bitstream_t *bs) {
+	bs->start = bs->end = bs->descrambler_pos = 0;
+}
+
+void ref_bitstream_destroy(ref_bitstream_t *bs) {
+	if(bs != NULL) XFREE(bs->buf);
+	XFREE(bs);
+}
+
+int ref_bitstream_append_msbfirst(ref_bitstream_t *bs, uint8_t const *bytes,
+		uint32_t numbytes, uint32_t numbits) {
+	if(bs->end + numbits * numbytes > bs->len)
+		return -1;
+	for(uint32_t i = 0; i < numbytes; i++) {
+		uint8_t t = bytes[i];
+		for(int j = numbits - 1; j >= 0; j--)
+			bs->buf[bs->end++] = (t >> j) & 0x01;
+	}
+	return 0;
+}
+
+int ref_bitstream_append_lsbfirst(ref_bitstream_t *bs, uint8_t const *bytes,
+		uint32_t numbytes, uint32_t numbits) {
+	if(bs->end + numbits * numbytes > bs->len)
+		return -1;
+	for(uint32_t i = 0; i < numbytes; i++) {
+		uint8_t t = bytes[i];
+		for(uint32_t j = 0; j < numbits; j++)
+			bs->buf[bs->end++] = (t >> j) & 0x01;
+	}
+	return 0;
+}
+
+int ref_bitstream_read_lsbfirst(ref_bitstream_t *bs, uint8_t *bytes,
+		uint32_t numbytes, uint32_t numbits) {
+	if(bs->start + numbits * numbytes > bs->end)
+		return -1;
+	for(uint32_t i = 0; i < numbytes; i++) {
+		bytes[i] = 0x00;
+		for(uint32_t j = 0; j < numbits; j++) {
+			bytes[i] |= (0x01 & bs->buf[bs->start++]) << j;
+		}
+	}
+	return 0;
+}
+
+int ref_bitstream_read_word_msbfirst(ref_bitstream_t *bs, uint32_t *ret,
+		uint32_t numbits) {
+	if(bs->start + numbits > bs->end)
+		return -1;
+	*ret = 0;
+	for(uint32_t i = 0; i < numbits; i++) {
+		*ret |= (0x01 & bs->buf[bs->start++]) << (numbits-i-1);
+	}
+	return 0;
+}
+
+void ref_bitstream_descramble(ref_bitstream_t *bs, uint16_t *lfsr) {
+	uint8_t bit;
+
+	if(bs->descrambler_pos < bs->start)
+		bs->descrambler_pos = bs->start;
+	for(uint32_t i = bs->descrambler_pos; i < bs->end; i++) {
+		/* LFSR length: 15; feedback polynomial: x^15 + x + 1 */
+		bit = ((*lfsr >> 0) ^ (*lfsr >> 14)) & 1;
+		*lfsr = (*lfsr >> 1) | (bit << 14);
+		bs->buf[i] ^= bit;
+	}
+	bs->descrambler_pos = bs->end;
+}
+
+int ref_bitstream_copy_next_frame(ref_bitstream_t *src, ref_bitstream_t *dst) {
+	int ones;
+	uint32_t i, j;
+restart:
+	ones = 0;
+	ref_bitstream_reset(dst);
+	for(i = src->start, j = 0; i < src->end; i++, src->start++) {
+		if(src->buf[i] == 0x0 && ones == 5) {   // stuffed 0 bit - skip it
+			ones = 0;
+			continue;
+		} else if(src->buf[i] == 0x1) {
+			ones++;
+			if(ones > 6) {                      // 7 ones - invalid bit sequence
+				return -1;
+			}
+		}
+		dst->buf[j] = src->buf[i];
+		if(src->buf[i] == 0x0) {
+			if(ones == 6) {                     // frame boundary flag (0x7e)
+				if(j == 7) {                    // move past the initial flag
+					src->start++;
+					goto restart;
+				} else {
+					if(j < 7) {
+						return -1;
+					}
+					dst->end = j - 7;           // remove trailing flag from the result
+					src->start++;
+					break;
+				}
+			}
+			ones = 0;
+		}
+		j++; dst->end++;
+	}
+	return (src->start < src->end ? 1 : 0);
+}
@@ -0,0 +1,44 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Reference bit stream implementation, storing one bit per byte.
+// This is how bit streams were handled before they were packed into
+// 64-bit words. It is kept here to check the packed implementation
+// against it and to compare their speed.
+
+#ifndef _BITSTREAM_REF_H
+#define _BITSTREAM_REF_H 1
+#include <stdint.h>
+
+typedef struct {
+	uint8_t *buf;
+	uint32_t start, end, len, descrambler_pos;
+} ref_bitstream_t;
+
+ref_bitstream_t *ref_bitstream_init(uint32_t len);
+void ref_bitstream_reset(ref_bitstream_t *bs);
+void ref_bitstream_destroy(ref_bitstream_t *bs);
+int ref_bitstream_append_msbfirst(ref_bitstream_t *bs, uint8_t const *bytes, uint32_t numbytes, uint32_t numbits);
+int ref_bitstream_append_lsbfirst(ref_bitstream_t *bs, uint8_t const *bytes, uint32_t numbytes, uint32_t numbits);
+int ref_bitstream_read_lsbfirst(ref_bitstream_t *bs, uint8_t *bytes, uint32_t numbytes, uint32_t numbits);
+int ref_bitstream_read_word_msbfirst(ref_bitstream_t *bs, uint32_t *ret, uint32_t numbits);
+void ref_bitstream_descramble(ref_bitstream_t *bs, uint16_t *lfsr);
+int ref_bitstream_copy_next_frame(ref_bitstream_t *src, ref_bitstream_t *dst);
+
+#endif // !_BITSTREAM_REF_H
@@ -0,0 +1,80 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "dumpvdl2.h"                   // dumpvdl2_config_t
+#include "test-common.h"
+
+// Tested modules are linked without the rest of the program,
+// so provide the globals they use
+dumpvdl2_config_t Config;
+
+void *xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func) {
+	void *ptr = calloc(nmemb, size);
+	if(ptr == NULL) {
+		fprintf(stderr, "%s:%d: %s(): calloc(%zu, %zu) failed: %s\n",
+				file, line, func, nmemb, size, strerror(errno));
+		exit(1);
+	}
+	return ptr;
+}
+
+void *xrealloc(void *ptr, size_t size, char const *file, int line, char const *func) {
+	ptr = realloc(ptr, size);
+	if(ptr == NULL) {
+		fprintf(stderr, "%s:%d: %s(): realloc(%zu) failed: %s\n",
+				file, line, func, size, strerror(errno));
+		exit(1);
+	}
+	return ptr;
+}
+
+int test_failures = 0;
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+void test_srand(uint64_t seed) {
+	rand_state = seed != 0 ? seed : 88172645463325252ULL;
+}
+
+uint32_t test_rand() {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return (uint32_t)(rand_state >> 32);
+}
+
+double test_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int test_iterations(int argc, char **argv, int dflt) {
+	if(argc > 1) {
+		int n = atoi(argv[1]);
+		if(n > 0) {
+			return n;
+		}
+	}
+	return dflt;
+}
@@ -0,0 +1,51 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Helpers shared by the randomized equivalence tests and benchmarks
+
+#ifndef _TEST_COMMON_H
+#define _TEST_COMMON_H 1
+#include <stdio.h>
+#include <stdint.h>
+
+// Deterministic pseudo-random numbers (xorshift64), so that failures
+// can be reproduced
+void test_srand(uint64_t seed);
+uint32_t test_rand();
+
+// Monotonic time in seconds
+double test_now();
+
+// Number of iterations given as the first argument, or the default
+int test_iterations(int argc, char **argv, int dflt);
+
+extern int test_failures;
+
+// Reports a failed check (only the first few, to keep the output readable)
+#define TEST_CHECK(cond, iter) \
+	do { \
+		if(!(cond)) { \
+			if(test_failures++ < 10) { \
+				fprintf(stderr, "%s:%d: iteration %d: check failed: %s\n", \
+						__FILE__, __LINE__, (iter), #cond); \
+			} \
+		} \
+	} while(0)
+
+#endif // !_TEST_COMMON_H
@@ -0,0 +1,121 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks the table-driven descrambler against the bit-by-bit LFSR.
+// Usage: test-descrambler [iterations]
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dumpvdl2.h"                   // bitstream_*
+#include "bitstream-ref.h"              // ref_bitstream_*
+#include "test-common.h"
+
+#define LFSR_IV 0x6959u
+#define LFSR_PERIOD 32767u
+#define LONG_STREAM_BITS (3 * LFSR_PERIOD + 1000)
+
+// Reads all remaining bits of both streams and compares them
+static void compare_rest(bitstream_t *bs, ref_bitstream_t *ref, int it) {
+	uint8_t a, b;
+	TEST_CHECK(bs->end - bs->start == ref->end - ref->start, it);
+	while(bs->start < bs->end && ref->start < ref->end) {
+		bitstream_read_lsbfirst(bs, &a, 1, 1);
+		ref_bitstream_read_lsbfirst(ref, &b, 1, 1);
+		if(a != b) {
+			TEST_CHECK(a == b, it);
+			return;
+		}
+	}
+}
+
+// Appends random symbols in random-sized pieces, like the demodulator,
+// descrambling and consuming some bits after each piece
+static void test_bursts(int iterations) {
+	bitstream_t *bs = bitstream_init(BSLEN);
+	ref_bitstream_t *ref = ref_bitstream_init(BSLEN);
+	for(int it = 0; it < iterations; it++) {
+		bitstream_reset(bs);
+		ref_bitstream_reset(ref);
+		uint32_t pos = 0;
+		uint16_t lfsr = LFSR_IV;
+		int const pieces = 1 + test_rand() % 8;
+		for(int p = 0; p < pieces; p++) {
+			int const nsym = test_rand() % 1200;
+			for(int k = 0; k < nsym; k++) {
+				uint8_t const sym = test_rand() & 7;
+				bitstream_append_msbfirst(bs, &sym, 1, 3);
+				ref_bitstream_append_msbfirst(ref, &sym, 1, 3);
+			}
+			bitstream_descramble(bs, &pos);
+			ref_bitstream_descramble(ref, &lfsr);
+			uint32_t const avail = bs->end - bs->start;
+			uint32_t const skip = avail > 0 ? test_rand() % (avail / 2 + 1) : 0;
+			uint32_t w1, w2;
+			for(uint32_t n = skip; n > 0; ) {
+				uint32_t const len = n > 32 ? 32 : n;
+				TEST_CHECK(bitstream_read_word_msbfirst(bs, &w1, len) ==
+						ref_bitstream_read_word_msbfirst(ref, &w2, len), it);
+				TEST_CHECK(w1 == w2, it);
+				n -= len;
+			}
+		}
+		compare_rest(bs, ref, it);
+	}
+	bitstream_destroy(bs);
+	ref_bitstream_destroy(ref);
+}
+
+// Descrambles a stream longer than the scrambler sequence in random-sized
+// pieces, so that the sequence wraps around at various word offsets
+static void test_wraparound(int iterations) {
+	bitstream_t *bs = bitstream_init(LONG_STREAM_BITS);
+	ref_bitstream_t *ref = ref_bitstream_init(LONG_STREAM_BITS);
+	int const rounds = iterations / 1000 + 1;
+	for(int it = 0; it < rounds; it++) {
+		bitstream_reset(bs);
+		ref_bitstream_reset(ref);
+		uint32_t pos = 0;
+		uint16_t lfsr = LFSR_IV;
+		while(bs->end < LONG_STREAM_BITS) {
+			uint32_t n = 1 + test_rand() % 300;
+			if(n > LONG_STREAM_BITS - bs->end) {
+				n = LONG_STREAM_BITS - bs->end;
+			}
+			for(uint32_t k = 0; k < n; k++) {
+				uint8_t const bit = test_rand() & 1;
+				bitstream_append_lsbfirst(bs, &bit, 1, 1);
+				ref_bitstream_append_lsbfirst(ref, &bit, 1, 1);
+			}
+			bitstream_descramble(bs, &pos);
+			ref_bitstream_descramble(ref, &lfsr);
+		}
+		compare_rest(bs, ref, it);
+	}
+	bitstream_destroy(bs);
+	ref_bitstream_destroy(ref);
+}
+
+int main(int argc, char **argv) {
+	int const iterations = test_iterations(argc, argv, 20000);
+	bitstream_descrambler_init(LFSR_IV);
+	test_bursts(iterations);
+	test_wraparound(iterations);
+	printf("%s: %d failures\n", argv[0], test_failures);
+	return test_failures != 0;
+}
@@ -0,0 +1,104 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Stress test of the MPSC queue. Several producers push sequence-numbered
+// entries while the consumer pops them in batches of random size. Checks
+// that every entry arrives exactly once and in order per producer.
+// Usage: test-mpsc-queue [entries per producer]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "mpsc_queue.h"
+#include "test-common.h"
+
+#define PRODUCERS 4
+#define MAX_BATCH 32
+#define SEQ_BITS 24               // leaves room for the id in a 32-bit pointer
+#define SEQ_MASK (((uintptr_t)1 << SEQ_BITS) - 1)
+
+typedef struct {
+	mpsc_queue_t *q;
+	uintptr_t id;
+	uintptr_t count;
+} producer_t;
+
+// Entries carry the producer id in the upper bits and the sequence number
+// (starting at 1, so that no entry is NULL) in the lower bits
+static void *producer_thread(void *arg) {
+	producer_t *p = arg;
+	for(uintptr_t seq = 1; seq <= p->count; seq++) {
+		mpsc_queue_push(p->q, (void *)(p->id << SEQ_BITS | seq));
+	}
+	return NULL;
+}
+
+static void test_queue(size_t capacity, uintptr_t count) {
+	mpsc_queue_t *q = mpsc_queue_new(capacity);
+	producer_t producers[PRODUCERS];
+	pthread_t threads[PRODUCERS];
+	for(uintptr_t i = 0; i < PRODUCERS; i++) {
+		producers[i] = (producer_t){ .q = q, .id = i, .count = count };
+		pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+	}
+
+	uintptr_t last[PRODUCERS] = { 0 };
+	uintptr_t const total = count * PRODUCERS;
+	uintptr_t received = 0;
+	void *batch[MAX_BATCH];
+	while(received < total) {
+		size_t const max = 1 + test_rand() % MAX_BATCH;
+		size_t const n = mpsc_queue_pop_batch(q, batch, max);
+		TEST_CHECK(n > 0 && n <= max, (int)capacity);
+		for(size_t k = 0; k < n; k++) {
+			uintptr_t const v = (uintptr_t)batch[k];
+			uintptr_t const id = v >> SEQ_BITS;
+			uintptr_t const seq = v & SEQ_MASK;
+			if(id >= PRODUCERS) {
+				TEST_CHECK(id < PRODUCERS, (int)capacity);
+				continue;
+			}
+			TEST_CHECK(seq == last[id] + 1, (int)capacity);
+			last[id] = seq;
+		}
+		received += n;
+	}
+	for(int i = 0; i < PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		TEST_CHECK(last[i] == count, (int)capacity);
+	}
+	TEST_CHECK(mpsc_queue_depth(q) == 0, (int)capacity);
+	TEST_CHECK(mpsc_queue_high_water(q) <= capacity, (int)capacity);
+	printf("capacity %zu: high water %zu\n", capacity, mpsc_queue_high_water(q));
+}
+
+int main(int argc, char **argv) {
+	uintptr_t count = test_iterations(argc, argv, 100000);
+	if(count > SEQ_MASK) {
+		count = SEQ_MASK;
+	}
+	// A tiny queue keeps producers waiting for free cells most of the time,
+	// a larger one lets the consumer pop long batches
+	size_t const capacities[] = { 2, 64, 1024 };
+	for(size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+		test_queue(capacities[i], count);
+	}
+	printf("%s: %d failures\n", argv[0], test_failures);
+	return test_failures != 0;
+}
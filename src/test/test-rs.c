@@ -0,0 +1,118 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks rs_verify_blocks() against running libfec's decoder on each
+// block, which is how blocks were verified before.
+// Usage: test-rs [iterations]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "fec.h"                        // init_rs_char, decode_rs_char
+#include "dumpvdl2.h"                   // rs_init, rs_verify_blocks, RS_N, RS_K
+#include "test-common.h"
+
+#define RS_NROOTS (RS_N - RS_K)
+#define MAX_BLOCKS 4
+
+static void *ref_rs;
+
+static int ref_rs_verify(uint8_t *data, int fec_octets) {
+	if(fec_octets == 0) {
+		return 0;
+	}
+	int const erasure_cnt = RS_NROOTS - fec_octets;
+	if(erasure_cnt > 0) {
+		int erasures[RS_NROOTS];
+		for(int i = 0; i < erasure_cnt; i++) {
+			erasures[i] = RS_K + fec_octets + i;
+		}
+		return decode_rs_char(ref_rs, data, erasures, erasure_cnt);
+	}
+	return decode_rs_char(ref_rs, data, NULL, 0);
+}
+
+// Number of FEC octets of a block with the given number of data octets
+static int fec_octets(uint32_t len) {
+	return len < 3 ? 0 : len < 31 ? 2 : len < 68 ? 4 : 6;
+}
+
+// Turns the data part of the block into a codeword
+static void rs_encode(uint8_t *block) {
+	int erasures[RS_NROOTS];
+	for(int i = 0; i < RS_NROOTS; i++) {
+		erasures[i] = RS_K + i;
+	}
+	memset(block + RS_K, 0, RS_NROOTS);
+	decode_rs_char(ref_rs, block, erasures, RS_NROOTS);
+}
+
+int main(int argc, char **argv) {
+	int const iterations = test_iterations(argc, argv, 20000);
+	rs_init();
+	ref_rs = init_rs_char(8, 0x187, 120, 1, RS_NROOTS, 0);
+	long corrected = 0, uncorrectable = 0;
+
+	for(int it = 0; it < iterations; it++) {
+		uint32_t const num_blocks = 1 + test_rand() % MAX_BLOCKS;
+		uint32_t const last_len = 1 + test_rand() % RS_K;
+		int const last_fec = fec_octets(last_len);
+		uint8_t blocks[MAX_BLOCKS][RS_N], ref_blocks[MAX_BLOCKS][RS_N];
+		memset(blocks, 0, sizeof(blocks));
+		for(uint32_t b = 0; b < num_blocks; b++) {
+			uint32_t const data_len = b == num_blocks - 1 ? last_len : RS_K;
+			int const fec = b == num_blocks - 1 ? last_fec : RS_NROOTS;
+			for(uint32_t i = 0; i < data_len; i++) {
+				blocks[b][i] = (uint8_t)test_rand();
+			}
+			rs_encode(blocks[b]);
+			// FEC octets which are not transmitted
+			memset(blocks[b] + RS_K + fec, 0, RS_NROOTS - fec);
+			// Errors in some blocks, sometimes more than can be corrected
+			int const num_errors = test_rand() % 5 == 0 ? test_rand() % 5 : 0;
+			for(int e = 0; e < num_errors; e++) {
+				uint32_t const pos = test_rand() % (RS_K + fec);
+				if(pos >= data_len && pos < RS_K) {
+					continue;       // the zeros of a shortened block are not transmitted
+				}
+				blocks[b][pos] ^= 1 + test_rand() % 255;
+			}
+		}
+		memcpy(ref_blocks, blocks, sizeof(blocks));
+
+		int ret[MAX_BLOCKS];
+		rs_verify_blocks(blocks, num_blocks, last_len, last_fec, ret);
+		for(uint32_t b = 0; b < num_blocks; b++) {
+			int const fec = b == num_blocks - 1 ? last_fec : RS_NROOTS;
+			int const ref_ret = ref_rs_verify(ref_blocks[b], fec);
+			TEST_CHECK(ret[b] == ref_ret, it);
+			if(ref_ret >= 0) {
+				TEST_CHECK(memcmp(blocks[b], ref_blocks[b], RS_N) == 0, it);
+			}
+			if(ref_ret > 0) {
+				corrected++;
+			} else if(ref_ret < 0) {
+				uncorrectable++;
+			}
+		}
+	}
+	printf("%s: %ld blocks corrected, %ld uncorrectable, %d failures\n",
+			argv[0], corrected, uncorrectable, test_failures);
+	return test_failures != 0;
+}
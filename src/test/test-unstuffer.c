@@ -0,0 +1,146 @@
+/*
+ *  This file is a part of dumpvdl2
+ *
+ *  Copyright (c) 2017-2026 Tomasz Lemiech <szpajder@gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks the table-driven HDLC unstuffer against the bit-by-bit one
+// of the reference bit stream, and the FCS it computes against crc16_ccitt().
+// Usage: test-unstuffer [iterations]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "dumpvdl2.h"                   // bitstream_*, BSLEN, crc16_ccitt, FCS_INIT
+#include "bitstream-ref.h"              // ref_bitstream_*
+#include "test-common.h"
+
+#define MAX_BITS 32000
+#define FRAME_BUF_LEN 4096
+
+enum {
+	STREAM_VALID,                       // well-formed frames
+	STREAM_CORRUPTED,                   // random bits inserted before closing flags
+	STREAM_GARBAGE                      // no initial flag, followed by random bits
+};
+
+static uint8_t bits[MAX_BITS];
+static int num_bits;
+
+static void put_flag() {
+	for(int i = 0; i < 8; i++) {
+		bits[num_bits++] = (0x7e >> i) & 1;
+	}
+}
+
+// Appends octets LSB first, inserting a zero after each five ones
+static void put_stuffed_octets(int len) {
+	int ones = 0;
+	for(int k = 0; k < len; k++) {
+		// Plenty of 0xff octets, to get long runs of ones
+		uint8_t const octet = (test_rand() % 4 == 0) ? 0xff : (uint8_t)test_rand();
+		for(int i = 0; i < 8; i++) {
+			int const bit = (octet >> i) & 1;
+			bits[num_bits++] = bit;
+			if(bit && ++ones == 5) {
+				bits[num_bits++] = 0;
+				ones = 0;
+			} else if(!bit) {
+				ones = 0;
+			}
+		}
+	}
+}
+
+static void generate_stream(int type) {
+	num_bits = 0;
+	if(type != STREAM_GARBAGE) {
+		put_flag();
+	}
+	int const num_frames = 1 + test_rand() % 4;
+	for(int f = 0; f < num_frames; f++) {
+		put_stuffed_octets(test_rand() % 300);
+		if(type == STREAM_CORRUPTED && test_rand() % 3 == 0) {
+			bits[num_bits++] = test_rand() & 1;
+		}
+		put_flag();
+		if(type == STREAM_VALID && test_rand() % 5 == 0) {
+			// seven ones - invalid sequence
+			for(int i = 0; i < 7; i++) {
+				bits[num_bits++] = 1;
+			}
+		}
+	}
+	if(type == STREAM_GARBAGE) {
+		int const len = test_rand() % 2000;
+		for(int k = 0; k < len; k++) {
+			bits[num_bits++] = test_rand() % 8 ? 1 : 0;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	int const iterations = test_iterations(argc, argv, 20000);
+	bitstream_unstuffer_init();
+	bitstream_t *bs = bitstream_init(BSLEN);
+	ref_bitstream_t *ref = ref_bitstream_init(BSLEN), *ref_frame = ref_bitstream_init(BSLEN);
+	uint8_t frame[FRAME_BUF_LEN], ref_octets[FRAME_BUF_LEN];
+	long frames = 0;
+
+	for(int it = 0; it < iterations; it++) {
+		generate_stream(test_rand() % 3);
+		bitstream_reset(bs);
+		ref_bitstream_reset(ref);
+		for(int k = 0; k < num_bits; k++) {
+			bitstream_append_lsbfirst(bs, &bits[k], 1, 1);
+			ref_bitstream_append_lsbfirst(ref, &bits[k], 1, 1);
+		}
+		if(test_rand() % 3 == 0) {
+			// truncated stream
+			uint32_t const cut = test_rand() % 5;
+			bs->end -= cut;
+			ref->end -= cut;
+		}
+		while(1) {
+			uint32_t frame_bits = 0;
+			uint16_t fcs = 0;
+			int const ret = bitstream_unstuff_next_frame(bs, frame, sizeof(frame), &frame_bits, &fcs);
+			int const ref_ret = ref_bitstream_copy_next_frame(ref, ref_frame);
+			TEST_CHECK(ret == ref_ret, it);
+			if(ret < 0 || ref_ret < 0) {
+				break;
+			}
+			TEST_CHECK(bs->start == ref->start, it);
+			TEST_CHECK(frame_bits == ref_frame->end - ref_frame->start, it);
+			if(frame_bits == ref_frame->end - ref_frame->start) {
+				uint32_t const len = frame_bits / 8;
+				ref_bitstream_read_lsbfirst(ref_frame, ref_octets, len, 8);
+				TEST_CHECK(memcmp(frame, ref_octets, len) == 0, it);
+				// The FCS computed on the way covers all complete octets
+				TEST_CHECK(fcs == crc16_ccitt(ref_octets, len, FCS_INIT), it);
+			}
+			frames++;
+			if(ret == 0 || ref_ret == 0) {
+				break;
+			}
+		}
+	}
+	bitstream_destroy(bs);
+	ref_bitstream_destroy(ref);
+	ref_bitstream_destroy(ref_frame);
+	printf("%s: %ld frames, %d failures\n", argv[0], frames, test_failures);
+	return test_failures != 0;
+}